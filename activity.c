@@ -0,0 +1,69 @@
+#define _GNU_SOURCE
+#include "activity.h"
+#include "analog.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+
+#define MODULE_NAME "activity"
+
+#define set_bit(bits, bit) ((bits)[(bit) / 64] |= 1ULL << ((bit) % 64))
+
+static i32 set_mask(i32 fd, u32 type, const u64 *codes, u32 codes_size);
+
+i32 activity_set_kernel_event_mask(i32 fd, bool analog)
+{
+    u64 key_codes[u_nbits(KEY_CNT)];
+    memset(key_codes, 0xff, sizeof(key_codes));
+
+    u64 abs_codes[u_nbits(ABS_CNT)] = { 0 };
+#define X_(code) set_bit(abs_codes, code);
+    ACTIVITY_ABS_CODES_LIST
+#undef X_
+    if (analog) {
+#define X_(code, kind) set_bit(abs_codes, code);
+        ANALOG_AXES_LIST
+#undef X_
+    }
+
+    /* EV_SYN can't be masked, and empty SYN_REPORTs
+     * (with all other events in the frame filtered out)
+     * are dropped by the kernel, so they won't wake us up either */
+    u64 ev_types[u_nbits(EV_CNT)] = { 0 };
+    set_bit(ev_types, EV_KEY);
+    set_bit(ev_types, EV_ABS);
+
+    /* Set the code masks first, so that no unwanted events
+     * slip through in between */
+    i32 ret = set_mask(fd, EV_KEY, key_codes, sizeof(key_codes));
+    if (ret == 0) ret = set_mask(fd, EV_ABS, abs_codes, sizeof(abs_codes));
+    if (ret == 0) ret = set_mask(fd, 0, ev_types, sizeof(ev_types));
+
+    return ret;
+}
+
+static i32 set_mask(i32 fd, u32 type, const u64 *codes, u32 codes_size)
+{
+    const struct input_mask mask = {
+        .type = type,
+        .codes_size = codes_size,
+        .codes_ptr = (u64)(uintptr_t)codes,
+    };
+    if (ioctl(fd, EVIOCSMASK, &mask) == 0)
+        return 0;
+
+    if (errno == EINVAL || errno == ENOTTY) {
+        s_log_debug("EVIOCSMASK is not supported on fd %i: %s",
+            fd, strerror(errno));
+        return -1;
+    }
+
+    s_log_error("Failed to set the event mask (type %u) on fd %i: %s",
+        type, fd, strerror(errno));
+    return 1;
+}
@@ -0,0 +1,50 @@
+#ifndef ACTIVITY_H_
+#define ACTIVITY_H_
+
+#include <core/int.h>
+#include <stdbool.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+
+/* The rules that decide which controller events count as user activity
+ * (except for the analog axes, see `analog.h`).
+ *
+ * They are used both for filtering the events in user space
+ * and for building the kernel-side event mask (see `EVIOCSMASK`),
+ * so the two can never disagree. */
+
+/* All EV_KEY events (buttons) count as activity,
+ * and out of the EV_ABS events - only the ones listed here */
+#define ACTIVITY_ABS_CODES_LIST \
+    X_(ABS_HAT0X) /* D-pad */   \
+    X_(ABS_HAT0Y)               \
+
+static inline bool activity_is_relevant_event(const struct input_event *ev)
+{
+    if (ev->type == EV_KEY)
+        return true;
+    if (ev->type != EV_ABS)
+        return false;
+
+    switch (ev->code) {
+#define X_(code) case code:
+    ACTIVITY_ABS_CODES_LIST
+#undef X_
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Installs a per-client event mask on the event device `fd`,
+ * so that the kernel only delivers the events that count as activity
+ * and the daemon isn't woken up by e.g. analog stick noise.
+ * If `analog` is true, the axes of `ANALOG_AXES_LIST` are let through too
+ * (whether their events count is decided by `analog_detector_feed`).
+ *
+ * Returns 0 on success, a negative value if the kernel doesn't support
+ * `EVIOCSMASK` (in which case the events just have to be filtered
+ * in user space) and a positive value on other failures. */
+i32 activity_set_kernel_event_mask(i32 fd, bool analog);
+
+#endif /* ACTIVITY_H_ */
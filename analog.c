@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include "analog.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+
+#define MODULE_NAME "analog"
+
+static void init_axis(struct analog_axis *a, enum analog_axis_kind kind,
+    const struct analog_params *params, const struct input_absinfo *absinfo);
+
+void analog_detector_init(struct analog_detector *o, i32 fd,
+    const struct analog_params *params)
+{
+    u_check_params(o != NULL && params != NULL);
+    memset(o, 0, sizeof(struct analog_detector));
+    o->recalibrate_ns = params->recalibrate_ns;
+    if (!params->enabled)
+        return;
+
+    bool queried = false;
+#define X_(code, kind) do {                                             \
+        struct input_absinfo absinfo = { 0 };                           \
+        if (fd >= 0 && ioctl(fd, EVIOCGABS(code), &absinfo) == 0) {    \
+            queried = true;                                             \
+            if (absinfo.maximum > absinfo.minimum)                      \
+                init_axis(&o->axes[code], kind, params, &absinfo);      \
+        }                                                               \
+    } while (0);
+    ANALOG_AXES_LIST
+#undef X_
+
+    if (!queried) {
+        s_log_debug("Couldn't query the analog axes of fd %i (%s); "
+            "assuming the range [%i, %i]", fd, strerror(errno),
+            ANALOG_DEFAULT_MIN, ANALOG_DEFAULT_MAX);
+        analog_detector_init_range(o, params,
+            ANALOG_DEFAULT_MIN, ANALOG_DEFAULT_MAX, ANALOG_DEFAULT_MIN - 1);
+    }
+}
+
+void analog_detector_init_range(struct analog_detector *o,
+    const struct analog_params *params, i32 min, i32 max, i32 value)
+{
+    u_check_params(o != NULL && params != NULL && max > min);
+    memset(o, 0, sizeof(struct analog_detector));
+    o->recalibrate_ns = params->recalibrate_ns;
+    if (!params->enabled)
+        return;
+
+    const struct input_absinfo absinfo = {
+        .minimum = min,
+        .maximum = max,
+        .value = value,
+    };
+#define X_(code, kind) init_axis(&o->axes[code], kind, params, &absinfo);
+    ANALOG_AXES_LIST
+#undef X_
+}
+
+static void init_axis(struct analog_axis *a, enum analog_axis_kind kind,
+    const struct analog_params *params, const struct input_absinfo *absinfo)
+{
+    const i64 range = (i64)absinfo->maximum - absinfo->minimum;
+
+    i32 deadzone = range * params->deadzone_percent / 100;
+    /* The kernel's own idea of the deadzone, if it has one */
+    if (deadzone < absinfo->flat)
+        deadzone = absinfo->flat;
+
+    i32 hysteresis = range * params->hysteresis_percent / 100;
+    if (hysteresis < 1)
+        hysteresis = 1;
+    if (hysteresis > deadzone)
+        hysteresis = deadzone;
+
+    /* Start from where the axis should rest, unless it's already
+     * close to that (and so probably resting a bit off-center) */
+    const i32 nominal_rest = kind == ANALOG_AXIS_TRIGGER ? absinfo->minimum
+        : absinfo->minimum + (i32)(range / 2);
+    i32 rest = nominal_rest;
+    if (absinfo->value >= absinfo->minimum &&
+        absinfo->value <= absinfo->maximum &&
+        analog_abs_(absinfo->value - nominal_rest) <= deadzone)
+    {
+        rest = absinfo->value;
+    }
+
+    *a = (struct analog_axis) {
+        .rest_q8 = rest * ANALOG_Q8_ONE,
+        .anchor = rest,
+        .anchor_ns = 0,
+        .enter_threshold = deadzone,
+        .exit_threshold = deadzone - hysteresis,
+        .hysteresis = hysteresis,
+        .kind = kind,
+        .active = false,
+    };
+}
@@ -0,0 +1,154 @@
+#ifndef ANALOG_H_
+#define ANALOG_H_
+
+#include <core/int.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <linux/input.h>
+#include <linux/input-event-codes.h>
+
+/* Tells real movements of the analog sticks and triggers apart
+ * from noise and drift, so that e.g. a racing game played only with
+ * the sticks and triggers keeps the screen awake, but a drifting stick
+ * lying on the table doesn't.
+ *
+ * Every axis has a rest position, taken from `EVIOCGABS` when the device
+ * is connected and then slowly following the values read while the axis
+ * is inside its deadzone (so a stick that drifts slowly is recalibrated
+ * on the fly). Leaving the deadzone (`deadzone_percent` of the axis range
+ * from the rest position) counts as activity, and so does every further
+ * movement by more than the hysteresis (`hysteresis_percent`) while
+ * outside of it. The axis is back at rest once it's within the deadzone
+ * minus the hysteresis again, so noise around the edge of the deadzone
+ * doesn't count more than once. An axis that stays at the same spot
+ * outside of the deadzone for `recalibrate_ms` (e.g. a stuck stick)
+ * takes that spot as its new rest position.
+ *
+ * Everything is integer arithmetic on a few bytes of state per axis. */
+
+/* X_(code, kind) */
+#define ANALOG_AXES_LIST                                \
+    X_(ABS_X, ANALOG_AXIS_STICK)    /* Left stick */    \
+    X_(ABS_Y, ANALOG_AXIS_STICK)                        \
+    X_(ABS_RX, ANALOG_AXIS_STICK)   /* Right stick */   \
+    X_(ABS_RY, ANALOG_AXIS_STICK)                       \
+    X_(ABS_Z, ANALOG_AXIS_TRIGGER)  /* L2 */            \
+    X_(ABS_RZ, ANALOG_AXIS_TRIGGER) /* R2 */            \
+
+/* The axes are indexed by their codes directly */
+#define ANALOG_N_AXES (ABS_RZ + 1)
+#define X_(code, kind) static_assert(code < ANALOG_N_AXES, \
+    "The analog axis codes must be below ANALOG_N_AXES");
+ANALOG_AXES_LIST
+#undef X_
+
+enum analog_axis_kind {
+    ANALOG_AXIS_NONE, /* Not an analog axis, or not present on the device */
+    ANALOG_AXIS_STICK, /* Rests in the middle of its range */
+    ANALOG_AXIS_TRIGGER, /* Rests at the minimum */
+};
+
+/* The range assumed for devices that can't be queried with `EVIOCGABS`
+ * (i.e. emulated ones) - that of a DualShock 4 */
+#define ANALOG_DEFAULT_MIN 0
+#define ANALOG_DEFAULT_MAX 255
+
+/* The rest position moves towards every value read inside
+ * the deadzone by 1/2^ANALOG_REST_EWMA_SHIFT of the difference */
+#define ANALOG_REST_EWMA_SHIFT 6
+
+/* The rest position is kept in fixed point with 8 fractional bits */
+#define ANALOG_Q8_ONE (1 << 8)
+
+struct analog_params {
+    bool enabled;
+    u32 deadzone_percent;
+    u32 hysteresis_percent;
+    u64 recalibrate_ns;
+};
+
+struct analog_axis {
+    i32 rest_q8;
+
+    /* The value at which the last activity was reported,
+     * or at which the axis settled */
+    i32 anchor;
+    u64 anchor_ns;
+
+    /* How far from `rest` the axis has to be to leave the deadzone,
+     * and how close to it to be back at rest */
+    i32 enter_threshold;
+    i32 exit_threshold;
+
+    /* How far from `anchor` a movement has to be to count */
+    i32 hysteresis;
+
+    u8 kind; /* `enum analog_axis_kind` */
+    bool active; /* Outside of the deadzone */
+};
+
+struct analog_detector {
+    struct analog_axis axes[ANALOG_N_AXES];
+    u64 recalibrate_ns;
+};
+
+/* Sets up the detector `o` for the device `fd`, reading the range and
+ * the current position of each axis with `EVIOCGABS` (if that fails,
+ * e.g. for emulated devices, the `ANALOG_DEFAULT_*` range is assumed).
+ * If `params->enabled` is false, no analog events will ever count. */
+void analog_detector_init(struct analog_detector *o, i32 fd,
+    const struct analog_params *params);
+
+/* Same as `analog_detector_init`, but with the given range and current
+ * `value` (outside of the range if unknown) for all the axes
+ * instead of `EVIOCGABS` */
+void analog_detector_init_range(struct analog_detector *o,
+    const struct analog_params *params, i32 min, i32 max, i32 value);
+
+static inline i32 analog_abs_(i32 x)
+{
+    return x < 0 ? -x : x;
+}
+
+/* Feeds the value `value` of the axis `code` (read at `now_ns`)
+ * to the detector. Returns true if it counts as activity. */
+static inline bool analog_detector_feed(struct analog_detector *d,
+    u16 code, i32 value, u64 now_ns)
+{
+    if (code >= ANALOG_N_AXES || d->axes[code].kind == ANALOG_AXIS_NONE)
+        return false;
+
+    struct analog_axis *a = &d->axes[code];
+    const i32 distance = analog_abs_(value - a->rest_q8 / ANALOG_Q8_ONE);
+
+    if (!a->active) {
+        if (distance > a->enter_threshold) {
+            a->active = true;
+            a->anchor = value;
+            a->anchor_ns = now_ns;
+            return true;
+        }
+
+        /* Follow the drift */
+        a->rest_q8 += (value * ANALOG_Q8_ONE - a->rest_q8)
+            / (1 << ANALOG_REST_EWMA_SHIFT);
+        return false;
+    }
+
+    if (distance < a->exit_threshold) {
+        a->active = false;
+        return false;
+    } else if (analog_abs_(value - a->anchor) > a->hysteresis) {
+        a->anchor = value;
+        a->anchor_ns = now_ns;
+        return true;
+    } else if (now_ns - a->anchor_ns > d->recalibrate_ns) {
+        /* Stuck (or just held still for very long) - make this the rest */
+        a->rest_q8 = value * ANALOG_Q8_ONE;
+        a->active = false;
+    }
+
+    return false;
+}
+
+#endif /* ANALOG_H_ */
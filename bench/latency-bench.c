@@ -0,0 +1,861 @@
+#define _GNU_SOURCE
+#define KBDDEV_INTERNAL_GUARD__
+#include "kbddev.h"
+#undef KBDDEV_INTERNAL_GUARD__
+#include "ptime.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/math.h>
+#include <core/util.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#define MODULE_NAME "latency-bench"
+
+/* Measures the end-to-end latency of the daemon, from the moment
+ * a controller event is written to the moment the resulting fake keypress
+ * can be read back, together with the throughput.
+ *
+ * For every scenario, the daemon (`--daemon`) is started in a temporary
+ * directory with its own config file. By default, the controllers are FIFOs
+ * (see `EVDEV_SOURCE_EMULATED`) and the fake keypresses are written to another
+ * FIFO (`fake_keyboard_output`). With `--uinput`, virtual DS4s are created
+ * with uinput instead, and the keypresses are read back from the daemon's
+ * real fake keyboard device (this needs root).
+ *
+ * Every frame of every controller contains one button event, and the daemon
+ * runs in `EMIT_MODE_EVERY_EVENT`, so each frame results in exactly one
+ * fake keypress. The keypresses arrive in the same order as the frames
+ * were written, which is how they're matched.
+ *
+ * The results are written as JSON lines (one object per scenario)
+ * to `--output`, or to stdout. */
+
+#define DEFAULT_DAEMON_PATH "bin/main"
+#define DEFAULT_BACKEND "EVENT_LOOP_BACKEND_EPOLL"
+#define DEFAULT_DURATION_MS 2000
+
+#define DAEMON_STARTUP_TIMEOUT_MS 5000
+#define DAEMON_EXIT_TIMEOUT_MS 2000
+#define WARMUP_INTERVAL_MS 10
+#define WARMUP_SETTLE_MS 100
+#define DRAIN_TIMEOUT_MS 1000
+#define READER_POLL_TIMEOUT_MS 50
+
+#define CONFIG_FILE_NAME "ps4-controller-input-faker.ini"
+#define DS4_NAME "Sony Interactive Entertainment Wireless Controller"
+#define DS4_MOTION_SENSORS_NAME DS4_NAME " Motion Sensors"
+#define DS4_VENDOR 0x054c
+#define DS4_PRODUCT 0x09cc
+
+static const u32 scenario_n_controllers[] = { 1, 4, 16 };
+static const u32 scenario_rates_hz[] = { 250, 1000 };
+static const bool scenario_gyro[] = { false, true };
+
+struct bench_args {
+    const char *daemon_path;
+    const char *backend;
+    const char *output_path;
+    u32 duration_ms;
+    bool uinput;
+};
+
+struct scenario {
+    u32 n_controllers;
+    u32 rate_hz;
+    bool gyro;
+};
+
+struct controller {
+    i32 fd; /* The buttons and sticks */
+    i32 motion_fd; /* The gyro and accelerometer; might be the same as `fd` */
+};
+
+/* State shared by the writer (the main thread) and the reader thread */
+struct run {
+    i32 sink_fd;
+
+    /* `send_ts_ns[i]` is when the frame that should result
+     * in the `i`-th fake keypress was written */
+    u64 *send_ts_ns;
+    u64 capacity;
+    _Atomic u64 n_sent;
+    _Atomic bool writer_done;
+
+    /* Only touched by the reader */
+    u64 *latency_ns;
+    u64 n_received;
+    u64 n_unmatched;
+    u64 last_recv_ns;
+};
+
+struct scenario_result {
+    u64 n_sent;
+    u64 n_received;
+    u64 n_dropped; /* Frames that didn't fit into a full FIFO */
+    u64 n_events_written;
+    u64 elapsed_ns;
+    u64 p50_ns, p90_ns, p99_ns, max_ns;
+};
+
+static i32 parse_args(i32 argc, char **argv, struct bench_args *o);
+static i32 run_scenario(const struct bench_args *args,
+    const struct scenario *sc, struct scenario_result *o);
+static void print_result(FILE *fp, const struct bench_args *args,
+    const struct scenario *sc, const struct scenario_result *r);
+
+static i32 write_config(const char *dir, const struct bench_args *args);
+static pid_t start_daemon(const char *dir, const char *daemon_path);
+static void stop_daemon(pid_t pid);
+
+static i32 open_fifo_controllers(const char *dir, struct controller *ctrls,
+    u32 n);
+static i32 open_uinput_controllers(struct controller *ctrls, u32 n,
+    bool gyro);
+static void close_controllers(struct controller *ctrls, u32 n);
+static i32 create_uinput_device(const char *name, const u16 *keys, u32 n_keys,
+    const u16 *abs_codes, u32 n_abs, i32 abs_min, i32 abs_max);
+static i32 open_fake_keyboard(void);
+
+static i32 warm_up(const struct controller *ctrl, i32 sink_fd);
+static void * reader_thread_fn(void *arg);
+static u32 fill_button_frame(struct input_event *buf, u64 frame_index);
+static u32 fill_motion_frame(struct input_event *buf, u64 frame_index);
+static i64 write_events(i32 fd, const struct input_event *events, u32 n);
+
+static u64 get_time_ns(void);
+static void sleep_until_ns(u64 deadline_ns);
+static i32 compare_u64(const void *a, const void *b);
+static u64 percentile(const u64 *sorted, u64 n, u32 p);
+static void remove_dir(const char *dir, u32 n_controllers);
+
+int main(int argc, char **argv)
+{
+    s_configure_log(LOG_INFO, stderr, stderr);
+
+    struct bench_args args;
+    if (parse_args(argc, argv, &args))
+        return EXIT_FAILURE;
+
+    FILE *out = stdout;
+    if (args.output_path != NULL) {
+        out = fopen(args.output_path, "w");
+        if (out == NULL) {
+            s_log_error("Failed to open \"%s\": %s",
+                args.output_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    i32 ret = EXIT_SUCCESS;
+    for (u32 i = 0; i < u_arr_size(scenario_n_controllers); i++) {
+        for (u32 j = 0; j < u_arr_size(scenario_rates_hz); j++) {
+            for (u32 k = 0; k < u_arr_size(scenario_gyro); k++) {
+                const struct scenario sc = {
+                    .n_controllers = scenario_n_controllers[i],
+                    .rate_hz = scenario_rates_hz[j],
+                    .gyro = scenario_gyro[k],
+                };
+                struct scenario_result result = { 0 };
+                if (run_scenario(&args, &sc, &result)) {
+                    s_log_error("Scenario %ux%u Hz%s failed",
+                        sc.n_controllers, sc.rate_hz, sc.gyro ? "+gyro" : "");
+                    ret = EXIT_FAILURE;
+                    continue;
+                }
+                print_result(out, &args, &sc, &result);
+            }
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    return ret;
+}
+
+static i32 parse_args(i32 argc, char **argv, struct bench_args *o)
+{
+    *o = (struct bench_args) {
+        .daemon_path = DEFAULT_DAEMON_PATH,
+        .backend = DEFAULT_BACKEND,
+        .output_path = NULL,
+        .duration_ms = DEFAULT_DURATION_MS,
+        .uinput = false,
+    };
+
+    for (i32 i = 1; i < argc; i++) {
+        const bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--uinput")) {
+            o->uinput = true;
+        } else if (!strcmp(argv[i], "--daemon") && has_value) {
+            o->daemon_path = argv[++i];
+        } else if (!strcmp(argv[i], "--backend") && has_value) {
+            o->backend = argv[++i];
+        } else if (!strcmp(argv[i], "--output") && has_value) {
+            o->output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--duration") && has_value) {
+            o->duration_ms = strtoul(argv[++i], NULL, 10);
+            if (o->duration_ms == 0)
+                goto usage;
+        } else {
+            goto usage;
+        }
+    }
+
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [--daemon PATH] [--uinput] [--backend NAME] "
+        "[--duration MS] [--output FILE]\n", argv[0]);
+    return 1;
+}
+
+static i32 run_scenario(const struct bench_args *args,
+    const struct scenario *sc, struct scenario_result *o)
+{
+    char dir[] = "/tmp/ps4-controller-bench.XXXXXX";
+    struct controller ctrls[16];
+    pid_t daemon_pid = -1;
+    struct run run = { .sink_fd = -1 };
+    pthread_t reader_thread;
+    bool reader_started = false;
+    bool ok = false;
+
+    s_assert(sc->n_controllers <= u_arr_size(ctrls), "Too many controllers");
+    for (u32 i = 0; i < u_arr_size(ctrls); i++)
+        ctrls[i].fd = ctrls[i].motion_fd = -1;
+
+    if (mkdtemp(dir) == NULL)
+        goto_error("Failed to create a temporary directory: %s",
+            strerror(errno));
+    if (write_config(dir, args))
+        goto err;
+
+    if (args->uinput) {
+        if (open_uinput_controllers(ctrls, sc->n_controllers, sc->gyro))
+            goto err;
+    } else {
+        if (open_fifo_controllers(dir, ctrls, sc->n_controllers))
+            goto err;
+
+        char sink_path[u_FILEPATH_MAX];
+        (void) snprintf(sink_path, sizeof(sink_path), "%s/kbd", dir);
+        if (mkfifo(sink_path, 0600))
+            goto_error("Failed to create \"%s\": %s", sink_path,
+                strerror(errno));
+        /* O_RDWR so that this doesn't block until the daemon opens it */
+        run.sink_fd = open(sink_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (run.sink_fd == -1)
+            goto_error("Failed to open \"%s\": %s", sink_path,
+                strerror(errno));
+    }
+
+    daemon_pid = start_daemon(dir, args->daemon_path);
+    if (daemon_pid == -1)
+        goto err;
+
+    if (args->uinput) {
+        const u64 deadline = get_time_ns() +
+            DAEMON_STARTUP_TIMEOUT_MS * 1000000ULL;
+        while ((run.sink_fd = open_fake_keyboard()) == -1 &&
+            get_time_ns() < deadline)
+        {
+            p_time_msleep(WARMUP_INTERVAL_MS);
+        }
+        if (run.sink_fd == -1)
+            goto_error("The daemon's fake keyboard didn't show up");
+    }
+
+    if (warm_up(&ctrls[0], run.sink_fd))
+        goto err;
+
+    run.capacity = (u64)sc->n_controllers * sc->rate_hz *
+        args->duration_ms / 1000 + 1024;
+    run.send_ts_ns = calloc(run.capacity, sizeof(u64));
+    run.latency_ns = calloc(run.capacity, sizeof(u64));
+    if (run.send_ts_ns == NULL || run.latency_ns == NULL)
+        goto_error("Failed to allocate the timestamp buffers");
+
+    if (pthread_create(&reader_thread, NULL, reader_thread_fn, &run))
+        goto_error("Failed to create the reader thread");
+    reader_started = true;
+
+    /* The controllers are staggered evenly, like real ones would be */
+    const u64 period_ns = 1000000000ULL / sc->rate_hz / sc->n_controllers;
+    const u64 start_ns = get_time_ns();
+    const u64 end_ns = start_ns + args->duration_ms * 1000000ULL;
+    u64 n_sent = 0;
+    for (u64 i = 0; ; i++) {
+        const u64 deadline_ns = start_ns + i * period_ns;
+        if (deadline_ns >= end_ns || n_sent >= run.capacity)
+            break;
+        sleep_until_ns(deadline_ns);
+
+        const struct controller *c = &ctrls[i % sc->n_controllers];
+        const u64 frame_index = i / sc->n_controllers;
+        struct input_event buf[8];
+
+        /* The motion sensors don't count as activity,
+         * so they're just extra load */
+        if (sc->gyro) {
+            const u32 n = fill_motion_frame(buf, frame_index);
+            if (write_events(c->motion_fd, buf, n) == 0)
+                o->n_events_written += n;
+        }
+
+        const u32 n = fill_button_frame(buf, frame_index);
+        run.send_ts_ns[n_sent] = get_time_ns();
+        const i64 r = write_events(c->fd, buf, n);
+        if (r < 0) {
+            goto_error("Failed to write to controller %lu: %s",
+                (unsigned long)(i % sc->n_controllers), strerror(errno));
+        } else if (r > 0) {
+            o->n_dropped++;
+            continue;
+        }
+        o->n_events_written += n;
+        atomic_store_explicit(&run.n_sent, ++n_sent, memory_order_release);
+    }
+    atomic_store(&run.writer_done, true);
+
+    (void) pthread_join(reader_thread, NULL);
+    reader_started = false;
+
+    o->n_sent = n_sent;
+    o->n_received = u_min(run.n_received, n_sent);
+    o->elapsed_ns = (run.last_recv_ns > start_ns ?
+        run.last_recv_ns : get_time_ns()) - start_ns;
+    qsort(run.latency_ns, o->n_received, sizeof(u64), compare_u64);
+    o->p50_ns = percentile(run.latency_ns, o->n_received, 50);
+    o->p90_ns = percentile(run.latency_ns, o->n_received, 90);
+    o->p99_ns = percentile(run.latency_ns, o->n_received, 99);
+    o->max_ns = percentile(run.latency_ns, o->n_received, 100);
+
+    if (run.n_unmatched > 0) {
+        s_log_warn("%lu fake keypress(es) didn't match any frame",
+            (unsigned long)run.n_unmatched);
+    }
+    s_log_info("%2ux%4u Hz%-5s: %lu/%lu keypresses, p50 %lu us, "
+        "p99 %lu us, max %lu us",
+        sc->n_controllers, sc->rate_hz, sc->gyro ? "+gyro" : "",
+        (unsigned long)o->n_received, (unsigned long)o->n_sent,
+        (unsigned long)(o->p50_ns / 1000), (unsigned long)(o->p99_ns / 1000),
+        (unsigned long)(o->max_ns / 1000));
+
+    ok = true;
+err:
+    if (reader_started) {
+        atomic_store(&run.writer_done, true);
+        (void) pthread_join(reader_thread, NULL);
+    }
+    if (daemon_pid != -1)
+        stop_daemon(daemon_pid);
+    close_controllers(ctrls, u_arr_size(ctrls));
+    if (run.sink_fd != -1)
+        close(run.sink_fd);
+    u_nfree(&run.send_ts_ns);
+    u_nfree(&run.latency_ns);
+
+    if (ok)
+        remove_dir(dir, sc->n_controllers);
+    else if (daemon_pid != -1)
+        s_log_error("See \"%s/daemon.log\" for the daemon's output", dir);
+
+    return ok ? 0 : 1;
+}
+
+static void print_result(FILE *fp, const struct bench_args *args,
+    const struct scenario *sc, const struct scenario_result *r)
+{
+    const double elapsed_s = (double)r->elapsed_ns / 1e9;
+    fprintf(fp, "{\"scenario\":\"%ux%uHz%s\",\"source\":\"%s\","
+        "\"backend\":\"%s\",\"controllers\":%u,\"rate_hz\":%u,"
+        "\"gyro\":%s,\"duration_ms\":%u,"
+        "\"sent\":%lu,\"received\":%lu,\"dropped\":%lu,"
+        "\"events_written\":%lu,"
+        "\"throughput_keypresses_per_s\":%.1f,"
+        "\"throughput_events_per_s\":%.1f,"
+        "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}"
+        "}\n",
+        sc->n_controllers, sc->rate_hz, sc->gyro ? "+gyro" : "",
+        args->uinput ? "uinput" : "fifo", args->backend,
+        sc->n_controllers, sc->rate_hz, sc->gyro ? "true" : "false",
+        args->duration_ms,
+        (unsigned long)r->n_sent, (unsigned long)r->n_received,
+        (unsigned long)r->n_dropped, (unsigned long)r->n_events_written,
+        elapsed_s > 0 ? r->n_received / elapsed_s : 0.0,
+        elapsed_s > 0 ? r->n_events_written / elapsed_s : 0.0,
+        r->p50_ns / 1e3, r->p90_ns / 1e3, r->p99_ns / 1e3, r->max_ns / 1e3);
+    fflush(fp);
+}
+
+static i32 write_config(const char *dir, const struct bench_args *args)
+{
+    char path[u_FILEPATH_MAX];
+    (void) snprintf(path, sizeof(path), "%s/" CONFIG_FILE_NAME, dir);
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        s_log_error("Failed to create \"%s\": %s", path, strerror(errno));
+        return 1;
+    }
+
+    fprintf(fp,
+        "log_level = LOG_WARNING\n"
+        "emit_mode = EMIT_MODE_EVERY_EVENT\n"
+        "event_loop_backend = %s\n", args->backend);
+    if (!args->uinput) {
+        /* The motion frames are written to the controllers' own FIFOs,
+         * where they'd look like stick movements */
+        fprintf(fp,
+            "analog_activity = false\n"
+            "input_source = EVDEV_SOURCE_EMULATED\n"
+            "input_dir = %s/in\n"
+            "fake_keyboard_output = %s/kbd\n", dir, dir);
+    }
+
+    return fclose(fp) != 0;
+}
+
+static pid_t start_daemon(const char *dir, const char *daemon_path)
+{
+    char *abs_path = realpath(daemon_path, NULL);
+    if (abs_path == NULL) {
+        s_log_error("Failed to find the daemon \"%s\": %s",
+            daemon_path, strerror(errno));
+        return -1;
+    }
+
+    const pid_t pid = fork();
+    if (pid == -1) {
+        s_log_error("Failed to fork: %s", strerror(errno));
+        u_nfree(&abs_path);
+        return -1;
+    } else if (pid == 0) {
+        /* The daemon picks up the config file from its working directory */
+        char log_path[u_FILEPATH_MAX];
+        (void) snprintf(log_path, sizeof(log_path), "%s/daemon.log", dir);
+        const i32 log_fd = open(log_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (chdir(dir) || log_fd == -1 ||
+            dup2(log_fd, STDOUT_FILENO) == -1 ||
+            dup2(log_fd, STDERR_FILENO) == -1)
+        {
+            _exit(127);
+        }
+        execl(abs_path, abs_path, (char *)NULL);
+        _exit(127);
+    }
+
+    u_nfree(&abs_path);
+    return pid;
+}
+
+static void stop_daemon(pid_t pid)
+{
+    (void) kill(pid, SIGINT);
+
+    const u64 deadline = get_time_ns() + DAEMON_EXIT_TIMEOUT_MS * 1000000ULL;
+    i32 status = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (get_time_ns() >= deadline) {
+            s_log_warn("The daemon didn't exit in time, killing it");
+            (void) kill(pid, SIGKILL);
+            (void) waitpid(pid, &status, 0);
+            return;
+        }
+        p_time_msleep(10);
+    }
+}
+
+static i32 open_fifo_controllers(const char *dir, struct controller *ctrls,
+    u32 n)
+{
+    char path[u_FILEPATH_MAX];
+    (void) snprintf(path, sizeof(path), "%s/in", dir);
+    if (mkdir(path, 0700)) {
+        s_log_error("Failed to create \"%s\": %s", path, strerror(errno));
+        return 1;
+    }
+
+    for (u32 i = 0; i < n; i++) {
+        (void) snprintf(path, sizeof(path), "%s/in/event%u", dir, i);
+        if (mkfifo(path, 0600)) {
+            s_log_error("Failed to create \"%s\": %s", path, strerror(errno));
+            return 1;
+        }
+        ctrls[i].fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (ctrls[i].fd == -1) {
+            s_log_error("Failed to open \"%s\": %s", path, strerror(errno));
+            return 1;
+        }
+        ctrls[i].motion_fd = ctrls[i].fd;
+    }
+
+    return 0;
+}
+
+static i32 open_uinput_controllers(struct controller *ctrls, u32 n,
+    bool gyro)
+{
+    static const u16 ds4_keys[] = {
+        BTN_SOUTH, BTN_EAST, BTN_WEST, BTN_NORTH,
+        BTN_TL, BTN_TR, BTN_TL2, BTN_TR2,
+        BTN_THUMBL, BTN_THUMBR,
+        BTN_SELECT, BTN_START, BTN_MODE,
+    };
+    static const u16 ds4_abs[] = {
+        ABS_X, ABS_Y, ABS_RX, ABS_RY, ABS_Z, ABS_RZ, ABS_HAT0X, ABS_HAT0Y,
+    };
+    static const u16 motion_abs[] = {
+        ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ,
+    };
+
+    for (u32 i = 0; i < n; i++) {
+        ctrls[i].fd = create_uinput_device(DS4_NAME,
+            ds4_keys, u_arr_size(ds4_keys), ds4_abs, u_arr_size(ds4_abs),
+            -1, 255);
+        if (ctrls[i].fd == -1)
+            return 1;
+
+        if (!gyro) {
+            ctrls[i].motion_fd = -1;
+            continue;
+        }
+        ctrls[i].motion_fd = create_uinput_device(DS4_MOTION_SENSORS_NAME,
+            NULL, 0, motion_abs, u_arr_size(motion_abs), -32768, 32767);
+        if (ctrls[i].motion_fd == -1)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void close_controllers(struct controller *ctrls, u32 n)
+{
+    for (u32 i = 0; i < n; i++) {
+        if (ctrls[i].motion_fd != -1 && ctrls[i].motion_fd != ctrls[i].fd)
+            close(ctrls[i].motion_fd);
+        if (ctrls[i].fd != -1)
+            close(ctrls[i].fd);
+        ctrls[i].fd = ctrls[i].motion_fd = -1;
+    }
+}
+
+static i32 create_uinput_device(const char *name, const u16 *keys, u32 n_keys,
+    const u16 *abs_codes, u32 n_abs, i32 abs_min, i32 abs_max)
+{
+    const i32 fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        s_log_error("Failed to open /dev/uinput: %s", strerror(errno));
+        return -1;
+    }
+
+    if (n_keys > 0 && ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1)
+        goto err;
+    for (u32 i = 0; i < n_keys; i++) {
+        if (ioctl(fd, UI_SET_KEYBIT, keys[i]) == -1)
+            goto err;
+    }
+
+    if (n_abs > 0 && ioctl(fd, UI_SET_EVBIT, EV_ABS) == -1)
+        goto err;
+    for (u32 i = 0; i < n_abs; i++) {
+        const bool is_hat = abs_codes[i] == ABS_HAT0X ||
+            abs_codes[i] == ABS_HAT0Y;
+        struct uinput_abs_setup abs_setup = {
+            .code = abs_codes[i],
+            .absinfo = {
+                .minimum = is_hat ? -1 : abs_min,
+                .maximum = is_hat ? 1 : abs_max,
+            },
+        };
+        if (ioctl(fd, UI_SET_ABSBIT, abs_codes[i]) == -1 ||
+            ioctl(fd, UI_ABS_SETUP, &abs_setup) == -1)
+        {
+            goto err;
+        }
+    }
+
+    struct uinput_setup setup = {
+        .id = {
+            .bustype = BUS_USB,
+            .vendor = DS4_VENDOR,
+            .product = DS4_PRODUCT,
+        },
+    };
+    (void) snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%s", name);
+    if (ioctl(fd, UI_DEV_SETUP, &setup) == -1 ||
+        ioctl(fd, UI_DEV_CREATE) == -1)
+    {
+        goto err;
+    }
+
+    return fd;
+
+err:
+    s_log_error("Failed to create the uinput device \"%s\": %s",
+        name, strerror(errno));
+    close(fd);
+    return -1;
+}
+
+/* Returns an fd of the daemon's fake keyboard device, or -1 if there's none */
+static i32 open_fake_keyboard(void)
+{
+    DIR *d = opendir("/dev/input");
+    if (d == NULL)
+        return -1;
+
+    i32 ret = -1;
+    struct dirent *ent;
+    while (ret == -1 && (ent = readdir(d)) != NULL) {
+        if (strncmp(ent->d_name, "event", u_strlen("event")))
+            continue;
+
+        char path[u_FILEPATH_MAX];
+        if (snprintf(path, sizeof(path), "/dev/input/%s", ent->d_name)
+            >= (i32)sizeof(path))
+        {
+            continue;
+        }
+        const i32 fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd == -1)
+            continue;
+
+        char name[256] = { 0 };
+        if (ioctl(fd, EVIOCGNAME(sizeof(name) - 1), name) >= 0 &&
+            !strcmp(name, KBDDEV_UINPUT_DEV_NAME))
+        {
+            ret = fd;
+        } else {
+            close(fd);
+        }
+    }
+
+    closedir(d);
+    return ret;
+}
+
+/* Waits until the daemon picks up the controllers,
+ * and then discards all the keypresses it produced */
+static i32 warm_up(const struct controller *ctrl, i32 sink_fd)
+{
+    const u64 deadline = get_time_ns() + DAEMON_STARTUP_TIMEOUT_MS * 1000000ULL;
+    u8 buf[4096];
+    bool got_keypress = false;
+
+    for (u64 i = 0; !got_keypress; i++) {
+        if (get_time_ns() >= deadline) {
+            s_log_error("The daemon didn't respond in time");
+            return 1;
+        }
+
+        struct input_event frame[2];
+        const u32 n = fill_button_frame(frame, i);
+        if (write_events(ctrl->fd, frame, n) < 0) {
+            s_log_error("Failed to write the warm-up events: %s",
+                strerror(errno));
+            return 1;
+        }
+
+        p_time_msleep(WARMUP_INTERVAL_MS);
+        while (read(sink_fd, buf, sizeof(buf)) > 0)
+            got_keypress = true;
+    }
+
+    p_time_msleep(WARMUP_SETTLE_MS);
+    while (read(sink_fd, buf, sizeof(buf)) > 0)
+        ;
+
+    return 0;
+}
+
+static void * reader_thread_fn(void *arg)
+{
+    struct run *run = arg;
+
+    /* The daemon's writes might (in theory) be split anywhere,
+     * so an event can be left incomplete by one read */
+    u8 buf[256 * sizeof(struct input_event)];
+    u32 buf_len = 0;
+    u64 drain_start_ns = 0;
+
+    while (true) {
+        struct pollfd pfd = { .fd = run->sink_fd, .events = POLLIN };
+        const i32 ret = poll(&pfd, 1, READER_POLL_TIMEOUT_MS);
+        if (ret == -1 && errno != EINTR) {
+            s_log_error("Failed to poll the fake keyboard: %s",
+                strerror(errno));
+            break;
+        }
+
+        if (ret > 0) {
+            const i64 n_read = read(run->sink_fd, buf + buf_len,
+                sizeof(buf) - buf_len);
+            const u64 now = get_time_ns();
+            if (n_read > 0) {
+                buf_len += n_read;
+                const u32 n_events = buf_len / sizeof(struct input_event);
+                for (u32 i = 0; i < n_events; i++) {
+                    struct input_event ev;
+                    memcpy(&ev, buf + i * sizeof(ev), sizeof(ev));
+                    if (ev.type != EV_KEY || ev.value != 1)
+                        continue;
+
+                    /* The frame's write() might not have returned yet */
+                    u64 n_sent;
+                    while ((n_sent = atomic_load_explicit(&run->n_sent,
+                        memory_order_acquire)) <= run->n_received &&
+                        !atomic_load(&run->writer_done))
+                    {
+                        sched_yield();
+                    }
+                    if (run->n_received >= n_sent) {
+                        run->n_unmatched++;
+                        continue;
+                    }
+
+                    run->latency_ns[run->n_received] =
+                        now - run->send_ts_ns[run->n_received];
+                    run->n_received++;
+                    run->last_recv_ns = now;
+                }
+                buf_len -= n_events * sizeof(struct input_event);
+                memmove(buf, buf + n_events * sizeof(struct input_event),
+                    buf_len);
+            }
+        }
+
+        if (!atomic_load(&run->writer_done))
+            continue;
+
+        /* Wait a bit for the keypresses that are still on their way */
+        if (run->n_received >= atomic_load(&run->n_sent))
+            break;
+        if (drain_start_ns == 0)
+            drain_start_ns = get_time_ns();
+        else if (get_time_ns() - drain_start_ns >= DRAIN_TIMEOUT_MS * 1000000ULL)
+            break;
+    }
+
+    return NULL;
+}
+
+/* Every frame presses or releases cross, which always counts as activity */
+static u32 fill_button_frame(struct input_event *buf, u64 frame_index)
+{
+    buf[0] = (struct input_event) {
+        .type = EV_KEY, .code = BTN_SOUTH, .value = frame_index % 2 == 0
+    };
+    buf[1] = (struct input_event) {
+        .type = EV_SYN, .code = SYN_REPORT, .value = 0
+    };
+    return 2;
+}
+
+/* A bit of noise on all the axes, so that the kernel doesn't drop
+ * any of the events as duplicates */
+static u32 fill_motion_frame(struct input_event *buf, u64 frame_index)
+{
+    static const u16 codes[] = {
+        ABS_RX, ABS_RY, ABS_RZ, /* Gyroscope */
+        ABS_X, ABS_Y, ABS_Z, /* Accelerometer */
+    };
+    for (u32 i = 0; i < u_arr_size(codes); i++) {
+        buf[i] = (struct input_event) {
+            .type = EV_ABS, .code = codes[i],
+            .value = (i32)((frame_index * 7 + i * 13) % 64) - 32,
+        };
+    }
+    buf[u_arr_size(codes)] = (struct input_event) {
+        .type = EV_SYN, .code = SYN_REPORT, .value = 0
+    };
+    return u_arr_size(codes) + 1;
+}
+
+/* Returns 0 on success, 1 if the fd is full and -1 on failure */
+static i64 write_events(i32 fd, const struct input_event *events, u32 n)
+{
+    const i64 size = n * sizeof(struct input_event);
+    i64 ret = 0;
+    do {
+        ret = write(fd, events, size);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1 && errno == EAGAIN)
+        return 1;
+    else if (ret != size)
+        return -1;
+
+    return 0;
+}
+
+static u64 get_time_ns(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(u64 deadline_ns)
+{
+    const struct timespec ts = {
+        .tv_sec = deadline_ns / 1000000000ULL,
+        .tv_nsec = deadline_ns % 1000000000ULL,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static i32 compare_u64(const void *a, const void *b)
+{
+    const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+/* The nearest-rank percentile `p` of the `n` sorted values in `sorted` */
+static u64 percentile(const u64 *sorted, u64 n, u32 p)
+{
+    if (n == 0)
+        return 0;
+
+    const u64 rank = (n * p + 99) / 100;
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static void remove_dir(const char *dir, u32 n_controllers)
+{
+    char path[u_FILEPATH_MAX];
+    for (u32 i = 0; i < n_controllers; i++) {
+        (void) snprintf(path, sizeof(path), "%s/in/event%u", dir, i);
+        (void) unlink(path);
+    }
+    (void) snprintf(path, sizeof(path), "%s/in", dir);
+    (void) rmdir(path);
+
+    static const char *const files[] = {
+        "kbd", "daemon.log", CONFIG_FILE_NAME,
+    };
+    for (u32 i = 0; i < u_arr_size(files); i++) {
+        (void) snprintf(path, sizeof(path), "%s/%s", dir, files[i]);
+        (void) unlink(path);
+    }
+    (void) rmdir(dir);
+}
@@ -27,6 +27,75 @@ const struct config_enum_value keycode_possible_values[] = {
 };
 #undef X_
 
+#define X_(name_) { .name = #name_, .value = name_ },
+const struct config_enum_value emit_mode_possible_values[] = {
+    EMIT_MODES_LIST
+};
+#undef X_
+
+#define X_(name_) { .name = #name_, .value = name_ },
+const struct config_enum_value event_loop_backend_possible_values[] = {
+    EVENT_LOOP_BACKENDS_LIST
+};
+#undef X_
+
+#define X_(name_) { .name = #name_, .value = name_ },
+const struct config_enum_value input_source_possible_values[] = {
+    EVDEV_SOURCE_TYPES_LIST
+};
+#undef X_
+
+#define CFG_ENUM_(possible_values_) {                       \
+    .possible_values = possible_values_,                    \
+    .n_possible_values = u_arr_size(possible_values_),      \
+}
+#define CFG_NO_ENUM_ { .possible_values = NULL, .n_possible_values = 0 }
+
+/* X_(key, config type, `union config_value` member, default, enum info) */
+#define CFG_OPTIONS_LIST                                                    \
+    X_(fake_keypress_keycode, CONFIG_TYPE_ENUM, e,                          \
+        FAKE_KEYPRESS_KEYCODE_DEFAULT, CFG_ENUM_(keycode_possible_values))  \
+    X_(log_level, CONFIG_TYPE_ENUM, e,                                      \
+        LOG_LEVEL_DEFAULT, CFG_ENUM_(log_level_possible_values))            \
+    X_(emit_mode, CONFIG_TYPE_ENUM, e,                                      \
+        EMIT_MODE_DEFAULT, CFG_ENUM_(emit_mode_possible_values))            \
+    X_(emit_throttle_ms, CONFIG_TYPE_INT, i,                                \
+        EMIT_THROTTLE_MS_DEFAULT, CFG_NO_ENUM_)                             \
+    X_(idle_timeout_ms, CONFIG_TYPE_INT, i,                                 \
+        IDLE_TIMEOUT_MS_DEFAULT, CFG_NO_ENUM_)                              \
+    X_(emit_deadline_margin_ms, CONFIG_TYPE_INT, i,                         \
+        EMIT_DEADLINE_MARGIN_MS_DEFAULT, CFG_NO_ENUM_)                      \
+    X_(emit_leading_edge_idle_ms, CONFIG_TYPE_INT, i,                       \
+        EMIT_LEADING_EDGE_IDLE_MS_DEFAULT, CFG_NO_ENUM_)                    \
+    X_(kernel_event_mask, CONFIG_TYPE_BOOL, b,                              \
+        KERNEL_EVENT_MASK_DEFAULT, CFG_NO_ENUM_)                            \
+    X_(analog_activity, CONFIG_TYPE_BOOL, b,                                \
+        ANALOG_ACTIVITY_DEFAULT, CFG_NO_ENUM_)                              \
+    X_(analog_deadzone_percent, CONFIG_TYPE_INT, i,                         \
+        ANALOG_DEADZONE_PERCENT_DEFAULT, CFG_NO_ENUM_)                      \
+    X_(analog_hysteresis_percent, CONFIG_TYPE_INT, i,                       \
+        ANALOG_HYSTERESIS_PERCENT_DEFAULT, CFG_NO_ENUM_)                    \
+    X_(analog_recalibrate_ms, CONFIG_TYPE_INT, i,                           \
+        ANALOG_RECALIBRATE_MS_DEFAULT, CFG_NO_ENUM_)                        \
+    X_(event_loop_backend, CONFIG_TYPE_ENUM, e,                             \
+        EVENT_LOOP_BACKEND_DEFAULT,                                         \
+        CFG_ENUM_(event_loop_backend_possible_values))                      \
+    X_(input_source, CONFIG_TYPE_ENUM, e,                                   \
+        INPUT_SOURCE_DEFAULT, CFG_ENUM_(input_source_possible_values))      \
+    X_(input_dir, CONFIG_TYPE_STRING, str,                                  \
+        INPUT_DIR_DEFAULT, CFG_NO_ENUM_)                                    \
+    X_(fake_keyboard_output, CONFIG_TYPE_STRING, str,                       \
+        FAKE_KEYBOARD_OUTPUT_DEFAULT, CFG_NO_ENUM_)                         \
+    X_(stats_socket, CONFIG_TYPE_STRING, str,                               \
+        STATS_SOCKET_DEFAULT, CFG_NO_ENUM_)                                 \
+
+#define X_(key_, ...) CFG_OPT_##key_,
+enum cfg_option_index {
+    CFG_OPTIONS_LIST
+    CFG_N_OPTIONS
+};
+#undef X_
+
 static void assign_values_from_config(struct cfg *o,
     struct config *options);
 
@@ -34,24 +103,16 @@ i32 read_config(struct cfg *o)
 {
     u_check_params(o != NULL);
 
-    static struct config_option options[] = {
-        {
-            .key = "fake_keypress_keycode",
-            .type = CONFIG_TYPE_ENUM,
-            .enum_info = {
-                .possible_values = keycode_possible_values,
-                .n_possible_values = u_arr_size(keycode_possible_values),
-            },
-        },
-        {
-            .key = "log_level",
-            .type = CONFIG_TYPE_ENUM,
-            .enum_info = {
-                .possible_values = log_level_possible_values,
-                .n_possible_values = u_arr_size(log_level_possible_values),
-            },
-        },
+#define X_(key_, type_, member_, default_, enum_info_)   \
+    [CFG_OPT_##key_] = {                                \
+        .key = #key_,                                   \
+        .type = type_,                                  \
+        .enum_info = enum_info_,                        \
+    },
+    static struct config_option options[CFG_N_OPTIONS] = {
+        CFG_OPTIONS_LIST
     };
+#undef X_
     struct config cfg = {
         .options = options,
         .n_options = u_arr_size(options),
@@ -119,37 +180,55 @@ err:
 static void assign_values_from_config(struct cfg *o,
     struct config *options)
 {
-    if (options == NULL) {
-        static const struct cfg default_cfg = {
-            .fake_keypress_keycode = FAKE_KEYPRESS_KEYCODE_DEFAULT,
-            .log_level = LOG_LEVEL_DEFAULT,
-        };
-        memcpy(o, &default_cfg, sizeof(struct cfg));
-        return;
-    }
-
-
-    bool matched_fake_keypress_keycode = false,
-         matched_log_level = false;
-
-    for (u32 i = 0; i < options->n_options; i++) {
-        if (!strncmp("fake_keypress_keycode", options->options[i].key,
-            CONFIG_KEY_MAX_LEN) &&
-            options->options[i].matched)
-        {
-            matched_fake_keypress_keycode = true;
-            o->fake_keypress_keycode = options->options[i].value.e;
-        } else if (!strncmp("log_level", options->options[i].key,
-            CONFIG_KEY_MAX_LEN) &&
-            options->options[i].matched)
-        {
-            matched_log_level = true;
-            o->log_level = options->options[i].value.e;
-        }
-    }
+    s_assert(options == NULL || options->n_options == CFG_N_OPTIONS,
+        "Invalid number of config options (%u)", options->n_options);
+
+    /* Strings can't just be assigned */
+#define CFG_ASSIGN_CONFIG_TYPE_INT(dst_, src_) (dst_ = src_)
+#define CFG_ASSIGN_CONFIG_TYPE_BOOL(dst_, src_) (dst_ = src_)
+#define CFG_ASSIGN_CONFIG_TYPE_ENUM(dst_, src_) (dst_ = src_)
+#define CFG_ASSIGN_CONFIG_TYPE_STRING(dst_, src_) \
+    ((void) snprintf(dst_, sizeof(dst_), "%.*s", (i32)sizeof(dst_) - 1, src_))
+
+#define X_(key_, type_, member_, default_, enum_info_)              \
+    if (options != NULL && options->options[CFG_OPT_##key_].matched)\
+        CFG_ASSIGN_##type_(o->key_,                                 \
+            options->options[CFG_OPT_##key_].value.member_);        \
+    else                                                            \
+        CFG_ASSIGN_##type_(o->key_, default_);                      \
+
+    CFG_OPTIONS_LIST
+#undef X_
+#undef CFG_ASSIGN_CONFIG_TYPE_INT
+#undef CFG_ASSIGN_CONFIG_TYPE_BOOL
+#undef CFG_ASSIGN_CONFIG_TYPE_ENUM
+#undef CFG_ASSIGN_CONFIG_TYPE_STRING
+
+    /* Negative durations make no sense; fall back to the defaults */
+#define CHECK_DURATION_(key_, default_) do {                        \
+    if (o->key_ < 0) {                                              \
+        s_log_warn("Invalid value of " #key_ " (%li), using %li",   \
+            (long)o->key_, (long)default_);                         \
+        o->key_ = default_;                                         \
+    }                                                               \
+} while (0)
+    CHECK_DURATION_(emit_throttle_ms, EMIT_THROTTLE_MS_DEFAULT);
+    CHECK_DURATION_(idle_timeout_ms, IDLE_TIMEOUT_MS_DEFAULT);
+    CHECK_DURATION_(emit_deadline_margin_ms, EMIT_DEADLINE_MARGIN_MS_DEFAULT);
+    CHECK_DURATION_(emit_leading_edge_idle_ms,
+        EMIT_LEADING_EDGE_IDLE_MS_DEFAULT);
+    CHECK_DURATION_(analog_recalibrate_ms, ANALOG_RECALIBRATE_MS_DEFAULT);
+#undef CHECK_DURATION_
 
-    if (!matched_fake_keypress_keycode)
-        o->fake_keypress_keycode = FAKE_KEYPRESS_KEYCODE_DEFAULT;
-    if (!matched_log_level)
-        o->log_level = LOG_LEVEL_DEFAULT;
+#define CHECK_PERCENT_(key_, default_) do {                         \
+    if (o->key_ < 0 || o->key_ > 100) {                             \
+        s_log_warn("Invalid value of " #key_ " (%li), using %li",   \
+            (long)o->key_, (long)default_);                         \
+        o->key_ = default_;                                         \
+    }                                                               \
+} while (0)
+    CHECK_PERCENT_(analog_deadzone_percent, ANALOG_DEADZONE_PERCENT_DEFAULT);
+    CHECK_PERCENT_(analog_hysteresis_percent,
+        ANALOG_HYSTERESIS_PERCENT_DEFAULT);
+#undef CHECK_PERCENT_
 }
@@ -3,7 +3,11 @@
 
 #include <core/log.h>
 #include <core/int.h>
+#include <core/util.h>
 #include <linux/input-event-codes.h>
+#include "scheduler.h"
+#include "event-loop.h"
+#include "evdev-source.h"
 
 struct cfg {
 #define FAKE_KEYPRESS_KEYCODE_DEFAULT (KEY_F21)
@@ -11,6 +15,51 @@ struct cfg {
 
 #define LOG_LEVEL_DEFAULT (LOG_DEBUG)
     enum s_log_level log_level;
+
+#define EMIT_MODE_DEFAULT (EMIT_MODE_THROTTLE)
+    enum emit_mode emit_mode;
+
+#define EMIT_THROTTLE_MS_DEFAULT 1000
+    i64 emit_throttle_ms;
+
+#define IDLE_TIMEOUT_MS_DEFAULT 60000
+    i64 idle_timeout_ms;
+
+#define EMIT_DEADLINE_MARGIN_MS_DEFAULT 5000
+    i64 emit_deadline_margin_ms;
+
+#define EMIT_LEADING_EDGE_IDLE_MS_DEFAULT 2000
+    i64 emit_leading_edge_idle_ms;
+
+#define KERNEL_EVENT_MASK_DEFAULT true
+    bool kernel_event_mask;
+
+#define ANALOG_ACTIVITY_DEFAULT true
+    bool analog_activity;
+
+#define ANALOG_DEADZONE_PERCENT_DEFAULT 10
+    i64 analog_deadzone_percent;
+
+#define ANALOG_HYSTERESIS_PERCENT_DEFAULT 3
+    i64 analog_hysteresis_percent;
+
+#define ANALOG_RECALIBRATE_MS_DEFAULT 10000
+    i64 analog_recalibrate_ms;
+
+#define EVENT_LOOP_BACKEND_DEFAULT (EVENT_LOOP_BACKEND_EPOLL)
+    enum event_loop_backend event_loop_backend;
+
+#define INPUT_SOURCE_DEFAULT (EVDEV_SOURCE_KERNEL)
+    enum evdev_source_type input_source;
+
+#define INPUT_DIR_DEFAULT EVDEV_SOURCE_DEFAULT_ROOT_DIR
+    filepath_t input_dir;
+
+#define FAKE_KEYBOARD_OUTPUT_DEFAULT "" /* uinput */
+    filepath_t fake_keyboard_output;
+
+#define STATS_SOCKET_DEFAULT "" /* disabled */
+    filepath_t stats_socket;
 };
 
 i32 read_config(struct cfg *o);
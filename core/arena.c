@@ -0,0 +1,90 @@
+#include "arena.h"
+#include "int.h"
+#include "log.h"
+#include "util.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODULE_NAME "arena"
+
+static void update_high_water(struct arena *a);
+
+i32 arena_init(struct arena *o, u64 size)
+{
+    u_check_params(o != NULL && size > 0);
+    memset(o, 0, sizeof(struct arena));
+
+    /* Large blocks come straight from mmap, so the pages
+     * that are never used don't take up any memory */
+    o->mem = calloc(1, size);
+    if (o->mem == NULL) {
+        s_log_error("Failed to allocate an arena of %lu bytes",
+            (unsigned long)size);
+        return 1;
+    }
+    o->size = size;
+
+    return 0;
+}
+
+void * arena_alloc(struct arena *a, u64 size, u64 alignment)
+{
+    u_check_params(a != NULL && a->mem != NULL &&
+        alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    const uintptr_t base = (uintptr_t)a->mem;
+    const uintptr_t start = (base + a->used + alignment - 1) & ~(alignment - 1);
+    if (start - base > a->size || size > a->size - (start - base))
+        return NULL;
+
+    a->used = start - base + size;
+    update_high_water(a);
+    return (void *)start;
+}
+
+char * arena_printf(struct arena *a, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    char *ret = arena_vprintf(a, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+char * arena_vprintf(struct arena *a, const char *fmt, va_list args)
+{
+    u_check_params(a != NULL && a->mem != NULL && fmt != NULL);
+
+    char *const start = (char *)a->mem + a->used;
+    const u64 space = a->size - a->used;
+    const i32 len = vsnprintf(start, space, fmt, args);
+    if (len < 0 || (u64)len >= space) {
+        /* Leave the previous text terminated */
+        if (space > 0)
+            *start = '\0';
+        return NULL;
+    }
+
+    /* The NUL terminator isn't counted, so that it's overwritten
+     * by the next string */
+    a->used += len;
+    update_high_water(a);
+    return start;
+}
+
+void arena_destroy(struct arena *a)
+{
+    if (a == NULL)
+        return;
+
+    u_nfree(&a->mem);
+    memset(a, 0, sizeof(struct arena));
+}
+
+static void update_high_water(struct arena *a)
+{
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+}
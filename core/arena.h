@@ -0,0 +1,65 @@
+#ifndef U_ARENA_H_
+#define U_ARENA_H_
+#include "static-tests.h"
+
+#include "int.h"
+#include <stdarg.h>
+
+/* A fixed-size bump allocator.
+ *
+ * All of its memory is allocated up front by `arena_init`, and it never
+ * grows. Allocations can't be freed one by one - instead, everything
+ * allocated after an `arena_mark` is released at once with `arena_rewind`
+ * (or everything with `arena_reset`).
+ *
+ * The memory is zeroed when the arena is created, but not when it's
+ * rewound, so whatever is allocated from it should be initialized
+ * by its owner. */
+struct arena {
+    u8 *mem;
+    u64 size;
+    u64 used;
+
+    /* The most that was ever used, for sizing the arena */
+    u64 high_water;
+};
+
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+/* Allocates the `size` bytes of the arena `o`.
+ * Returns 0 on success and non-zero on failure. */
+i32 arena_init(struct arena *o, u64 size);
+
+/* Returns `size` bytes aligned to `alignment` (a power of 2),
+ * or NULL if they don't fit in the arena */
+void * arena_alloc(struct arena *a, u64 size, u64 alignment);
+
+/* Appends the formatted string to the text at the top of the arena,
+ * overwriting the NUL terminator of the previous `arena_printf`,
+ * so that consecutive calls build one contiguous string.
+ * Returns the start of the new text, or NULL (leaving the arena unchanged)
+ * if it doesn't fit. */
+char * arena_printf(struct arena *a, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+char * arena_vprintf(struct arena *a, const char *fmt, va_list args);
+
+static inline u64 arena_mark(const struct arena *a)
+{
+    return a->used;
+}
+
+/* Releases everything allocated since `mark` was taken */
+static inline void arena_rewind(struct arena *a, u64 mark)
+{
+    a->used = mark;
+}
+
+static inline void arena_reset(struct arena *a)
+{
+    a->used = 0;
+}
+
+/* Frees the arena's memory. Everything allocated from it becomes invalid. */
+void arena_destroy(struct arena *a);
+
+#endif /* U_ARENA_H_ */
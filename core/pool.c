@@ -0,0 +1,51 @@
+#include "pool.h"
+#include "arena.h"
+#include "int.h"
+#include "log.h"
+#include "util.h"
+#include <string.h>
+
+#define MODULE_NAME "pool"
+
+i32 pool_init(struct pool *o, struct arena *arena,
+    u32 item_size, u32 item_align, u32 capacity)
+{
+    u_check_params(o != NULL && arena != NULL && item_size > 0 &&
+        capacity > 0 && item_size % item_align == 0);
+    memset(o, 0, sizeof(struct pool));
+
+    o->items = arena_alloc(arena, (u64)item_size * capacity, item_align);
+    o->free = arena_alloc(arena, capacity * sizeof(u32), _Alignof(u32));
+    if (o->items == NULL || o->free == NULL) {
+        s_log_error("The arena is too small for a pool of %u items", capacity);
+        return 1;
+    }
+    o->item_size = item_size;
+    o->capacity = capacity;
+
+    /* Hand out the lowest indices first */
+    for (u32 i = 0; i < capacity; i++)
+        o->free[i] = capacity - 1 - i;
+    o->n_free = capacity;
+
+    return 0;
+}
+
+i32 pool_alloc_index(struct pool *p)
+{
+    u_check_params(p != NULL && p->items != NULL);
+
+    if (p->n_free == 0)
+        return -1;
+
+    return p->free[--p->n_free];
+}
+
+void pool_free_index(struct pool *p, u32 index)
+{
+    u_check_params(p != NULL && p->items != NULL);
+    s_assert(index < p->capacity && p->n_free < p->capacity,
+        "Item %u doesn't belong to the pool", index);
+
+    p->free[p->n_free++] = index;
+}
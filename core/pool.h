@@ -0,0 +1,72 @@
+#ifndef U_POOL_H_
+#define U_POOL_H_
+#include "static-tests.h"
+
+#include "int.h"
+#include "arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A fixed number of fixed-size items, allocated and freed in O(1).
+ *
+ * The items live in one array (taken from an arena), so they can also
+ * be addressed by their index, which stays the same for as long as
+ * the item is allocated. Freed items are reused last in, first out,
+ * starting with the lowest indices. The contents of a freed item
+ * are left untouched (there's no intrusive free list). */
+struct pool {
+    u8 *items;
+    u32 item_size;
+    u32 capacity;
+
+    /* A stack of the indices of the free items */
+    u32 *free;
+    u32 n_free;
+};
+
+/* Takes the memory for `capacity` items of `item_size` bytes,
+ * each aligned to `item_align`, from `arena`.
+ * Returns 0 on success and non-zero on failure. */
+i32 pool_init(struct pool *o, struct arena *arena,
+    u32 item_size, u32 item_align, u32 capacity);
+
+/* Returns the index of a free item (which isn't zeroed),
+ * or -1 if there are none left */
+i32 pool_alloc_index(struct pool *p);
+
+/* Returns the item with the index `index` to the pool */
+void pool_free_index(struct pool *p, u32 index);
+
+static inline void * pool_at(const struct pool *p, u32 index)
+{
+    return p->items + (u64)index * p->item_size;
+}
+
+static inline u32 pool_index_of(const struct pool *p, const void *item)
+{
+    return ((const u8 *)item - p->items) / p->item_size;
+}
+
+/* Returns a free item (which isn't zeroed), or NULL if there are none left */
+static inline void * pool_alloc(struct pool *p)
+{
+    const i32 index = pool_alloc_index(p);
+    return index == -1 ? NULL : pool_at(p, index);
+}
+
+static inline void pool_free(struct pool *p, void *item)
+{
+    pool_free_index(p, pool_index_of(p, item));
+}
+
+static inline u32 pool_n_used(const struct pool *p)
+{
+    return p->capacity - p->n_free;
+}
+
+static inline bool pool_is_full(const struct pool *p)
+{
+    return p->n_free == 0;
+}
+
+#endif /* U_POOL_H_ */
@@ -0,0 +1,192 @@
+#include "device-registry.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+
+#define MODULE_NAME "device-registry"
+
+static u32 hash_devnum(dev_t devnum);
+static u32 find_bucket(const struct device_registry *r, dev_t devnum);
+static void unhash(struct device_registry *r, u32 bucket);
+
+i32 device_registry_init(struct device_registry *o, struct arena *arena)
+{
+    u_check_params(o != NULL && arena != NULL);
+    memset(o, 0, sizeof(struct device_registry));
+
+    if (pool_init(&o->slots, arena, sizeof(struct device),
+            DEVICE_REGISTRY_CACHE_LINE_SIZE, DEVICE_REGISTRY_MAX_DEVICES))
+        goto err;
+    o->devices = (struct device *)o->slots.items;
+    o->infos = arena_alloc(arena,
+        DEVICE_REGISTRY_MAX_DEVICES * sizeof(struct device_info),
+        _Alignof(struct device_info));
+    if (o->infos == NULL)
+        goto err;
+
+    /* The generations start at 0 */
+    memset(o->devices, 0, DEVICE_REGISTRY_MAX_DEVICES * sizeof(struct device));
+
+    return 0;
+
+err:
+    s_log_error("Failed to allocate the device registry");
+    memset(o, 0, sizeof(struct device_registry));
+    return 1;
+}
+
+struct device * device_registry_add(struct device_registry *r, dev_t devnum)
+{
+    u_check_params(r != NULL);
+
+    u32 bucket = 0;
+    if (devnum != EVDEV_DEVNUM_NONE) {
+        bucket = find_bucket(r, devnum);
+        if (r->hash[bucket] != 0) {
+            s_log_debug("Device %lu:%lu is already registered",
+                (unsigned long)major(devnum), (unsigned long)minor(devnum));
+            return NULL;
+        }
+    }
+    const i32 slot = pool_alloc_index(&r->slots);
+    if (slot == -1) {
+        s_log_error("Can't register more than %u devices",
+            DEVICE_REGISTRY_MAX_DEVICES);
+        return NULL;
+    }
+
+    struct device *dev = &r->devices[slot];
+    const u32 generation = dev->generation;
+    memset(dev, 0, sizeof(struct device));
+    dev->generation = generation;
+    dev->slot = slot;
+    dev->used_index = r->n_used;
+    r->used[r->n_used++] = slot;
+
+    struct device_info *info = &r->infos[slot];
+    memset(info, 0, sizeof(struct device_info));
+    info->devnum = devnum;
+
+    if (devnum != EVDEV_DEVNUM_NONE)
+        r->hash[bucket] = slot + 1;
+
+    return dev;
+}
+
+struct device * device_registry_find(const struct device_registry *r,
+    dev_t devnum)
+{
+    u_check_params(r != NULL);
+    if (devnum == EVDEV_DEVNUM_NONE)
+        return NULL;
+
+    const u32 bucket = find_bucket(r, devnum);
+    return r->hash[bucket] ? &r->devices[r->hash[bucket] - 1] : NULL;
+}
+
+void device_registry_remove(struct device_registry *r, struct device *dev)
+{
+    u_check_params(r != NULL && dev != NULL);
+    s_assert(dev->slot < DEVICE_REGISTRY_MAX_DEVICES
+        && dev->used_index < r->n_used
+        && r->used[dev->used_index] == dev->slot,
+        "Device record %p is not registered", dev);
+
+    const dev_t devnum = r->infos[dev->slot].devnum;
+    if (devnum != EVDEV_DEVNUM_NONE)
+        unhash(r, find_bucket(r, devnum));
+
+    /* Swap with the last device instead of shifting the whole array */
+    const u16 last_slot = r->used[--r->n_used];
+    r->used[dev->used_index] = last_slot;
+    r->devices[last_slot].used_index = dev->used_index;
+
+    dev->src.fd = -1;
+    dev->generation++;
+    r->pending_free[r->n_pending_free++] = dev->slot;
+}
+
+void device_registry_collect(struct device_registry *r)
+{
+    u_check_params(r != NULL);
+
+    while (r->n_pending_free > 0)
+        pool_free_index(&r->slots, r->pending_free[--r->n_pending_free]);
+}
+
+void device_registry_destroy(struct device_registry *r)
+{
+    if (r == NULL)
+        return;
+
+    if (r->n_used > 0)
+        s_log_warn("Destroying the registry with %u device(s) left", r->n_used);
+
+    memset(r, 0, sizeof(struct device_registry));
+}
+
+struct device * device_registry_lookup(const struct device_registry *r,
+    struct device_id id)
+{
+    u_check_params(r != NULL);
+    if (id.slot >= DEVICE_REGISTRY_MAX_DEVICES)
+        return NULL;
+
+    struct device *dev = &r->devices[id.slot];
+    if (dev->generation != id.generation || dev->used_index >= r->n_used ||
+        r->used[dev->used_index] != id.slot)
+    {
+        return NULL;
+    }
+
+    return dev;
+}
+
+static u32 hash_devnum(dev_t devnum)
+{
+    /* Fibonacci hashing - the device numbers of event devices
+     * differ mostly in the lowest bits of the minor */
+    const u64 h = (u64)devnum * 0x9e3779b97f4a7c15ULL;
+    return h >> (64 - __builtin_ctz(DEVICE_REGISTRY_HASH_SIZE));
+}
+
+/* Returns the bucket that holds `devnum`,
+ * or the empty one where it would be inserted */
+static u32 find_bucket(const struct device_registry *r, dev_t devnum)
+{
+    u32 bucket = hash_devnum(devnum);
+    while (r->hash[bucket] != 0 &&
+        r->infos[r->hash[bucket] - 1].devnum != devnum)
+    {
+        bucket = (bucket + 1) & (DEVICE_REGISTRY_HASH_SIZE - 1);
+    }
+
+    return bucket;
+}
+
+/* Empties `bucket`, moving back the entries after it that would
+ * otherwise become unreachable (so that no tombstones are needed) */
+static void unhash(struct device_registry *r, u32 bucket)
+{
+    const u32 mask = DEVICE_REGISTRY_HASH_SIZE - 1;
+
+    r->hash[bucket] = 0;
+    u32 next = (bucket + 1) & mask;
+    while (r->hash[next] != 0) {
+        const u32 home = hash_devnum(r->infos[r->hash[next] - 1].devnum);
+
+        /* Whether `home` is cyclically outside of (bucket, next] */
+        const bool movable = bucket <= next ?
+            (home <= bucket || home > next) :
+            (home <= bucket && home > next);
+        if (movable) {
+            r->hash[bucket] = r->hash[next];
+            r->hash[next] = 0;
+            bucket = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
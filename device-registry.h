@@ -0,0 +1,161 @@
+#ifndef DEVICE_REGISTRY_H_
+#define DEVICE_REGISTRY_H_
+
+#include "evdev.h"
+#include "evdev-source.h"
+#include "stats.h"
+#include "analog.h"
+#include "event-loop.h"
+#include <core/int.h>
+#include <core/util.h>
+#include <core/arena.h>
+#include <core/pool.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* All the devices that the daemon is reading from, in a slot map
+ * keyed by their device number.
+ *
+ * Every device gets a slot that stays the same for as long as it's
+ * registered. Its data is split in two:
+ *  - `struct device`, the hot record, with everything that's needed
+ *    for handling its events (one cache line per device),
+ *  - `struct device_info`, the cold metadata (path, name, statistics,
+ *    the state of the analog axes),
+ * both stored in fixed arrays indexed by the slot, taken from an arena
+ * when the registry is created (the hot records are a `struct pool`).
+ *
+ * Adding, looking up and removing a device are all O(1).
+ * A removed device's slot is only reused after `device_registry_collect`,
+ * so that the sources that have already been returned by the event loop
+ * in the same batch stay valid (with `src.fd` set to -1).
+ * A slot's generation changes every time it's freed,
+ * so a stale `struct device_id` can be told apart from a new device. */
+
+#define DEVICE_REGISTRY_MAX_DEVICES 64
+#define DEVICE_REGISTRY_HASH_SIZE (DEVICE_REGISTRY_MAX_DEVICES * 2)
+static_assert((DEVICE_REGISTRY_HASH_SIZE & (DEVICE_REGISTRY_HASH_SIZE - 1)) == 0,
+    "The hash table size must be a power of 2");
+
+#define DEVICE_REGISTRY_CACHE_LINE_SIZE 64
+
+struct device {
+    /* `src.data` points back to this struct */
+    _Alignas(DEVICE_REGISTRY_CACHE_LINE_SIZE) struct event_loop_source src;
+
+    /* When the first activity event that hasn't been reported yet
+     * was read, or 0 if there's none */
+    u64 activity_read_ns;
+
+    u32 generation;
+    u16 slot;
+
+    /* The index of this device in `struct device_registry.used` */
+    u16 used_index;
+
+    /* The id of this device in the recording, if there is one */
+    u32 recorder_id;
+
+    /* Whether the events are timestamped with `CLOCK_MONOTONIC` */
+    bool kernel_timestamps;
+};
+static_assert(sizeof(struct device) == DEVICE_REGISTRY_CACHE_LINE_SIZE,
+    "The hot device record must fit into a single cache line");
+
+struct device_info {
+    dev_t devnum;
+    struct evdev evdev;
+    struct stats_device stats;
+    struct analog_detector analog;
+};
+
+/* Identifies a device even after it's removed and its slot reused */
+struct device_id {
+    u32 slot;
+    u32 generation;
+};
+
+/* How much of the arena passed to `device_registry_init` is used */
+#define DEVICE_REGISTRY_ARENA_SIZE (DEVICE_REGISTRY_MAX_DEVICES *           \
+    (sizeof(struct device) + sizeof(struct device_info) + sizeof(u32))      \
+    + DEVICE_REGISTRY_CACHE_LINE_SIZE + _Alignof(struct device_info)        \
+    + _Alignof(u32))
+
+struct device_registry {
+    /* The slots, with `devices` being the items of the pool */
+    struct pool slots;
+    struct device *devices; /* [DEVICE_REGISTRY_MAX_DEVICES] */
+    struct device_info *infos; /* [DEVICE_REGISTRY_MAX_DEVICES] */
+
+    /* The slots in use, in no particular order */
+    u16 used[DEVICE_REGISTRY_MAX_DEVICES];
+    u32 n_used;
+
+    /* Freed, but not reusable until `device_registry_collect` */
+    u16 pending_free[DEVICE_REGISTRY_MAX_DEVICES];
+    u32 n_pending_free;
+
+    /* Open addressing (linear probing) from the device number
+     * to the slot + 1, with 0 meaning an empty bucket */
+    u16 hash[DEVICE_REGISTRY_HASH_SIZE];
+};
+
+/* Takes all the memory the registry will ever need
+ * (`DEVICE_REGISTRY_ARENA_SIZE`) from `arena`.
+ * Returns 0 on success and non-zero on failure. */
+i32 device_registry_init(struct device_registry *o, struct arena *arena);
+
+/* Registers a new device with the device number `devnum` (which may be
+ * `EVDEV_DEVNUM_NONE`, in which case it can't be looked up).
+ * Returns its (zeroed) hot record, whose `struct device_info` has only
+ * `devnum` set, or NULL if the registry is full or `devnum`
+ * is already registered. */
+struct device * device_registry_add(struct device_registry *r, dev_t devnum);
+
+/* Returns the device with the number `devnum`, or NULL if there's none */
+struct device * device_registry_find(const struct device_registry *r,
+    dev_t devnum);
+
+/* Unregisters `dev` and sets its `src.fd` to -1.
+ * Doesn't close anything - that's up to the caller. */
+void device_registry_remove(struct device_registry *r, struct device *dev);
+
+/* Makes the slots of all the removed devices reusable.
+ * Must only be called once no pointers to them are left
+ * (e.g. after every batch of ready event loop sources). */
+void device_registry_collect(struct device_registry *r);
+
+/* Releases the registry itself (the devices should already be removed).
+ * Its memory belongs to the arena. */
+void device_registry_destroy(struct device_registry *r);
+
+static inline struct device_info * device_registry_info(
+    const struct device_registry *r, const struct device *dev)
+{
+    return &r->infos[dev->slot];
+}
+
+static inline u32 device_registry_count(const struct device_registry *r)
+{
+    return r->n_used;
+}
+
+/* Returns the `i`th registered device (in no particular order).
+ * Removing a device changes the order of the rest. */
+static inline struct device * device_registry_at(
+    const struct device_registry *r, u32 i)
+{
+    return &r->devices[r->used[i]];
+}
+
+static inline struct device_id device_registry_get_id(const struct device *dev)
+{
+    return (struct device_id) { dev->slot, dev->generation };
+}
+
+/* Returns the device `id`, or NULL if it has been removed since */
+struct device * device_registry_lookup(const struct device_registry *r,
+    struct device_id id);
+
+#endif /* DEVICE_REGISTRY_H_ */
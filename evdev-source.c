@@ -0,0 +1,345 @@
+#define _GNU_SOURCE
+#include "evdev.h"
+#include "evdev-source.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/math.h>
+#include <core/vector.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/major.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "evdev-source"
+
+#ifdef CGD_CONFIG_PLATFORM_LINUX_EVDEV_PS4_CONTROLLER_SUPPORT
+#define EMULATED_TYPE_DEFAULT EVDEV_TYPE_PS4_CONTROLLER
+#else
+#define EMULATED_TYPE_DEFAULT EVDEV_TYPE_KEYBOARD
+#endif /* CGD_CONFIG_PLATFORM_LINUX_EVDEV_PS4_CONTROLLER_SUPPORT */
+
+#define MAX_REGISTERED_FDS 16
+#define REGISTERED_FD_REL_PATH_MAX_LEN 64
+
+/* See drivers/input/evdev.c: the first event devices get the minors
+ * starting at 64, and the rest get dynamic minors equal to their N */
+#define EVDEV_MINOR_BASE 64
+#define EVDEV_MINORS 32
+
+/* Recorded files are replayed through pipes of at most this size */
+#define REPLAY_MAX_PIPE_SIZE (1 << 20)
+#define REPLAY_COPY_BUF_N_EVENTS 128
+
+struct registered_fd {
+    char rel_path[REGISTERED_FD_REL_PATH_MAX_LEN];
+    i32 fd;
+    enum evdev_type type;
+    char name[MAX_EVDEV_NAME_LEN];
+};
+
+static struct evdev_source g_source = {
+    .type = EVDEV_SOURCE_KERNEL,
+    .root_dir = EVDEV_SOURCE_DEFAULT_ROOT_DIR,
+    .sysfs_dir = EVDEV_SOURCE_DEFAULT_SYSFS_DIR,
+    .emulated_type = EMULATED_TYPE_DEFAULT,
+};
+
+static struct registered_fd g_registered_fds[MAX_REGISTERED_FDS];
+static u32 g_n_registered_fds = 0;
+
+static const struct registered_fd * find_registered_fd(const char *rel_path);
+static i32 dev_input_event_scandir_filter(const struct dirent *dirent);
+static i32 open_replay_file(const char *path);
+
+void evdev_source_set(const struct evdev_source *src)
+{
+    if (src == NULL) {
+        g_source = (struct evdev_source) {
+            .type = EVDEV_SOURCE_KERNEL,
+            .root_dir = EVDEV_SOURCE_DEFAULT_ROOT_DIR,
+            .sysfs_dir = EVDEV_SOURCE_DEFAULT_SYSFS_DIR,
+            .emulated_type = EMULATED_TYPE_DEFAULT,
+        };
+        return;
+    }
+
+    u_check_params(src->type >= 0 && src->type < EVDEV_SOURCE_N_TYPES &&
+        src->emulated_type > EVDEV_TYPE_UNKNOWN &&
+        src->emulated_type < EVDEV_N_TYPES);
+
+    g_source = *src;
+    g_source.root_dir[u_FILEPATH_MAX] = '\0';
+    if (g_source.root_dir[0] == '\0' && g_source.type == EVDEV_SOURCE_KERNEL) {
+        strncpy(g_source.root_dir, EVDEV_SOURCE_DEFAULT_ROOT_DIR,
+            u_FILEPATH_MAX);
+    }
+    g_source.sysfs_dir[u_FILEPATH_MAX] = '\0';
+    if (g_source.sysfs_dir[0] == '\0' && evdev_source_is_default()) {
+        strncpy(g_source.sysfs_dir, EVDEV_SOURCE_DEFAULT_SYSFS_DIR,
+            u_FILEPATH_MAX);
+    }
+
+    if (g_source.root_dir[0] == '\0') {
+        s_log_info("Only loading the registered emulated devices");
+    } else if (!evdev_source_is_default()) {
+        s_log_info("Loading %s devices from \"%s\"",
+            g_source.type == EVDEV_SOURCE_EMULATED ? "emulated" : "event",
+            g_source.root_dir);
+    }
+}
+
+const struct evdev_source * evdev_source_get(void)
+{
+    return &g_source;
+}
+
+bool evdev_source_is_default(void)
+{
+    return g_source.type == EVDEV_SOURCE_KERNEL &&
+        !strcmp(g_source.root_dir, EVDEV_SOURCE_DEFAULT_ROOT_DIR);
+}
+
+i32 evdev_source_add_fd(const char *rel_path, i32 fd,
+    enum evdev_type type, const char *name)
+{
+    u_check_params(rel_path != NULL && fd >= 0 &&
+        type > EVDEV_TYPE_UNKNOWN && type < EVDEV_N_TYPES);
+
+    if (g_n_registered_fds >= MAX_REGISTERED_FDS) {
+        s_log_error("Can't register more than %u fds", MAX_REGISTERED_FDS);
+        return 1;
+    } else if (strlen(rel_path) >= REGISTERED_FD_REL_PATH_MAX_LEN) {
+        s_log_error("The path \"%s\" is too long", rel_path);
+        return 1;
+    } else if (find_registered_fd(rel_path) != NULL) {
+        s_log_error("The path \"%s\" is already registered", rel_path);
+        return 1;
+    }
+
+    struct registered_fd *r = &g_registered_fds[g_n_registered_fds++];
+    memset(r, 0, sizeof(struct registered_fd));
+    strncpy(r->rel_path, rel_path, REGISTERED_FD_REL_PATH_MAX_LEN - 1);
+    r->fd = fd;
+    r->type = type;
+    strncpy(r->name, name != NULL ? name : rel_path, MAX_EVDEV_NAME_LEN - 1);
+
+    return 0;
+}
+
+void evdev_source_clear_fds(void)
+{
+    memset(g_registered_fds, 0, sizeof(g_registered_fds));
+    g_n_registered_fds = 0;
+}
+
+VECTOR(char *) evdev_source_list_devices(void)
+{
+    struct dirent **namelist = NULL;
+    i32 n_dirents = 0;
+    if (g_source.root_dir[0] != '\0') {
+        n_dirents = scandir(g_source.root_dir, &namelist,
+            dev_input_event_scandir_filter, alphasort);
+    }
+    if (n_dirents == -1) {
+        s_log_error("Failed to scan dir \"%s\" for input devices: %s",
+            g_source.root_dir, strerror(errno));
+        return NULL;
+    }
+
+    VECTOR(char *) v = vector_new(char *);
+    for (i32 i = 0; i < n_dirents; i++) {
+        char *name = strdup(namelist[i]->d_name);
+        s_assert(name != NULL, "Failed to duplicate string");
+        vector_push_back(v, name);
+        u_nfree(&namelist[i]);
+    }
+    if (namelist != NULL)
+        u_nfree(&namelist);
+
+    for (u32 i = 0; i < g_n_registered_fds; i++) {
+        char *name = strdup(g_registered_fds[i].rel_path);
+        s_assert(name != NULL, "Failed to duplicate string");
+        vector_push_back(v, name);
+    }
+
+    return v;
+}
+
+i32 evdev_source_open(const char *rel_path, char *o_path)
+{
+    u_check_params(rel_path != NULL && o_path != NULL);
+
+    if (snprintf(o_path, u_FILEPATH_MAX, "%s/%s",
+            g_source.root_dir[0] ? g_source.root_dir : "<emulated>", rel_path)
+        >= u_FILEPATH_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    const struct registered_fd *r = find_registered_fd(rel_path);
+    if (r != NULL) {
+        const i32 fd = fcntl(r->fd, F_DUPFD_CLOEXEC, 0);
+        if (fd == -1)
+            return -1;
+
+        /* Note that this also affects the original fd,
+         * since both share the same file description */
+        const i32 flags = fcntl(fd, F_GETFL);
+        if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+            const i32 errno_save = errno;
+            close(fd);
+            errno = errno_save;
+            return -1;
+        }
+
+        return fd;
+    }
+
+    if (g_source.type == EVDEV_SOURCE_EMULATED) {
+        struct stat st;
+        if (stat(o_path, &st))
+            return -1;
+
+        /* Regular files can't be polled */
+        if (S_ISREG(st.st_mode))
+            return open_replay_file(o_path);
+    }
+
+    /* FIFOs are opened for writing as well, so that they don't hang up
+     * whenever there's no writer on the other side */
+    return open(o_path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+}
+
+dev_t evdev_source_get_devnum(const char *rel_path, i32 fd)
+{
+    u_check_params(rel_path != NULL);
+
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISCHR(st.st_mode))
+        return st.st_rdev;
+
+    if (strncmp(rel_path, "event", u_strlen("event")))
+        return EVDEV_DEVNUM_NONE;
+    const char *n_str = rel_path + u_strlen("event");
+    char *end = NULL;
+    errno = 0;
+    const unsigned long n = strtoul(n_str, &end, 10);
+    if (end == n_str || *end != '\0' || errno != 0 || n > UINT32_MAX)
+        return EVDEV_DEVNUM_NONE;
+
+    if (g_source.type == EVDEV_SOURCE_EMULATED)
+        return makedev(0, n);
+
+    return makedev(INPUT_MAJOR, n < EVDEV_MINORS ? EVDEV_MINOR_BASE + n : n);
+}
+
+void evdev_source_get_emulated_info(const char *rel_path,
+    char *o_name, enum evdev_type *o_type)
+{
+    u_check_params(rel_path != NULL && o_name != NULL && o_type != NULL);
+
+    const struct registered_fd *r = find_registered_fd(rel_path);
+    if (r != NULL) {
+        strncpy(o_name, r->name, MAX_EVDEV_NAME_LEN - 1);
+        *o_type = r->type;
+    } else {
+        strncpy(o_name, rel_path, MAX_EVDEV_NAME_LEN - 1);
+        *o_type = g_source.emulated_type;
+    }
+}
+
+static const struct registered_fd * find_registered_fd(const char *rel_path)
+{
+    for (u32 i = 0; i < g_n_registered_fds; i++) {
+        if (!strcmp(g_registered_fds[i].rel_path, rel_path))
+            return &g_registered_fds[i];
+    }
+
+    return NULL;
+}
+
+static i32 dev_input_event_scandir_filter(const struct dirent *dirent)
+{
+    return !strncmp(dirent->d_name, "event", u_strlen("event"));
+}
+
+/* Copies the recorded events from `path` into a new pipe
+ * (with the write end closed), and returns its read end.
+ * The pipe is enlarged as much as possible to fit the whole recording;
+ * any events that don't fit are dropped. */
+static i32 open_replay_file(const char *path)
+{
+    i32 file_fd = -1;
+    i32 pipe_fds[2] = { -1, -1 };
+    i32 errno_save = 0;
+
+    file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (file_fd == -1)
+        goto err;
+
+    if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC))
+        goto err;
+
+    struct stat st;
+    if (fstat(file_fd, &st) == 0 && st.st_size > 0) {
+        const i64 size = u_min(st.st_size, REPLAY_MAX_PIPE_SIZE);
+        (void) fcntl(pipe_fds[1], F_SETPIPE_SZ, (i32)size);
+    }
+
+    /* Only copy whole events, so that the reader never sees a partial one */
+    i64 capacity = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+    if (capacity == -1)
+        goto err;
+    capacity -= capacity % sizeof(struct input_event);
+
+    struct input_event buf[REPLAY_COPY_BUF_N_EVENTS];
+    i64 total = 0, n_read = 0;
+    while (total < capacity) {
+        const i64 max_read = u_min((i64)sizeof(buf), capacity - total);
+        n_read = read(file_fd, buf, max_read);
+        if (n_read == -1 && errno == EINTR)
+            continue;
+        else if (n_read == -1)
+            goto err;
+        else if (n_read == 0)
+            break;
+
+        /* The chunks are no larger than PIPE_BUF, so they're written
+         * atomically. Because of how the pipe's pages are filled,
+         * it might get full a bit before reaching its full capacity. */
+        n_read -= n_read % sizeof(struct input_event);
+        const i64 n_written = write(pipe_fds[1], buf, n_read);
+        if (n_written == -1 && errno == EAGAIN) {
+            (void) lseek(file_fd, -n_read, SEEK_CUR);
+            break;
+        } else if (n_written != n_read) {
+            goto err;
+        }
+        total += n_read;
+    }
+    if (read(file_fd, buf, 1) == 1) {
+        s_log_warn("The recording \"%s\" is too large, "
+            "only the first %li bytes will be replayed", path, (long)total);
+    }
+
+    close(file_fd);
+    close(pipe_fds[1]);
+    return pipe_fds[0];
+
+err:
+    errno_save = errno;
+    if (file_fd != -1) close(file_fd);
+    if (pipe_fds[0] != -1) close(pipe_fds[0]);
+    if (pipe_fds[1] != -1) close(pipe_fds[1]);
+    errno = errno_save;
+    return -1;
+}
@@ -0,0 +1,115 @@
+#ifndef EVDEV_SOURCE_H_
+#define EVDEV_SOURCE_H_
+
+#include "evdev.h"
+#include <core/int.h>
+#include <core/util.h>
+#include <core/vector.h>
+#include <sys/types.h>
+
+/* Where `evdev_find_and_load_devices`, `evdev_load` and the monitor
+ * get their devices from.
+ *
+ * By default, these are the real event devices in /dev/input.
+ * The root directory can be changed (e.g. to a temporary directory
+ * populated by a test harness), and with `EVDEV_SOURCE_EMULATED`
+ * the "devices" don't have to be event devices at all:
+ *  - FIFOs, from which the raw `struct input_event`s are read,
+ *  - regular files with recorded raw `struct input_event`s, which are
+ *    replayed once (the device "disconnects" once they're all read),
+ *  - already opened fds registered with `evdev_source_add_fd`
+ *    (e.g. one end of a socketpair or a pipe).
+ *
+ * Emulated devices don't support any ioctls, so their type
+ * is not probed, but set to `emulated_type` instead.
+ *
+ * The type of real event devices is probed through sysfs first
+ * (see `sysfs_dir`), so that the devices that don't match
+ * are never opened at all. */
+
+#define EVDEV_SOURCE_TYPES_LIST     \
+    X_(EVDEV_SOURCE_KERNEL)         \
+    X_(EVDEV_SOURCE_EMULATED)       \
+
+#define X_(name) name,
+enum evdev_source_type {
+    EVDEV_SOURCE_TYPES_LIST
+    EVDEV_SOURCE_N_TYPES
+};
+#undef X_
+
+#define EVDEV_SOURCE_DEFAULT_ROOT_DIR "/dev/input"
+#define EVDEV_SOURCE_DEFAULT_SYSFS_DIR "/sys/class/input"
+
+struct evdev_source {
+    enum evdev_source_type type;
+
+    /* The directory that is scanned for devices named "event*".
+     * If it's empty, only the fds registered with `evdev_source_add_fd`
+     * are available (only with `EVDEV_SOURCE_EMULATED`). */
+    filepath_t root_dir;
+
+    /* The directory with the sysfs entries of the devices in `root_dir`
+     * ("<sysfs_dir>/eventN/device/capabilities/..." etc.).
+     * If it's empty, it defaults to `EVDEV_SOURCE_DEFAULT_SYSFS_DIR`
+     * for the default source, and the devices are probed
+     * with ioctls otherwise. Not used with `EVDEV_SOURCE_EMULATED`. */
+    filepath_t sysfs_dir;
+
+    /* The type of all emulated devices */
+    enum evdev_type emulated_type;
+};
+
+/* Makes `src` the source of all devices loaded from now on.
+ * NULL restores the default (real devices in /dev/input). */
+void evdev_source_set(const struct evdev_source *src);
+
+/* Returns the current device source */
+const struct evdev_source * evdev_source_get(void);
+
+/* Returns true if the current source is the default one, i.e.
+ * the kernel's uevents can be used to monitor it. */
+bool evdev_source_is_default(void);
+
+/* Registers `fd` as an emulated device available under `rel_path`
+ * (which should start with "event"), with the name `name`
+ * and type `type`. Loading the device duplicates `fd`;
+ * the caller keeps the ownership of the original.
+ * Returns 0 on success and non-zero on failure. */
+i32 evdev_source_add_fd(const char *rel_path, i32 fd,
+    enum evdev_type type, const char *name);
+
+/* Unregisters all fds added with `evdev_source_add_fd` */
+void evdev_source_clear_fds(void);
+
+/* Used internally by `evdev_find_and_load_devices`.
+ * Returns the (malloced) relative paths of all the devices
+ * that are available in the current source - first the ones found
+ * in `root_dir` (sorted), then the registered fds - or NULL on failure. */
+VECTOR(char *) evdev_source_list_devices(void);
+
+/* Used internally by `evdev_load`.
+ * Opens the device `rel_path`, writing its full path to `o_path`
+ * (which must be at least `u_FILEPATH_MAX` bytes long).
+ * Returns the fd on success and -1 on failure (with errno set). */
+i32 evdev_source_open(const char *rel_path, char *o_path);
+
+/* The device number of a device that doesn't have one */
+#define EVDEV_DEVNUM_NONE ((dev_t)-1)
+
+/* Returns the device number of the device `rel_path` ("eventN").
+ * If `fd` (which may be -1, e.g. if the device is already gone)
+ * is a character device, that's its `st_rdev`. Otherwise, it's derived
+ * from N the same way the kernel assigns them to event devices
+ * (or, for emulated devices, just N with a major of 0).
+ * Returns `EVDEV_DEVNUM_NONE` if `rel_path` isn't named "eventN". */
+dev_t evdev_source_get_devnum(const char *rel_path, i32 fd);
+
+/* Used internally by `evdev_load` for emulated devices
+ * (for which the kernel can't be asked).
+ * Writes the name (`MAX_EVDEV_NAME_LEN` bytes at most) and type
+ * of the device `rel_path` to `o_name` and `o_type`. */
+void evdev_source_get_emulated_info(const char *rel_path,
+    char *o_name, enum evdev_type *o_type);
+
+#endif /* EVDEV_SOURCE_H_ */
@@ -8,53 +8,80 @@
 #include <core/math.h>
 #include <core/vector.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <linux/input.h>
 #include <linux/input-event-codes.h>
 #include "key-codes.h"
+#include "evdev-source.h"
 
 #define MODULE_NAME "evdev"
 
-#define DEVINPUT_DIR "/dev/input"
-
-static i32 dev_input_event_scandir_filter(const struct dirent *dirent);
-
-static i32 ev_cap_check(i32 fd, const char *path, enum evdev_type type);
-static i32 ev_bit_check(const u64 bits[], u32 n_bits, const i32 *checks);
+/* Large enough for the longest capability bitmap ("key") */
+#define SYSFS_READ_BUF_SIZE 1024
+#define SYSFS_MAX_CAP_WORDS (KEY_CNT / 32)
+
+/* The event types whose codes are in `union evdev_caps`
+ * X_(type, member, number of codes, file in ".../device/capabilities/") */
+#define EVDEV_CAPS_TYPES_LIST           \
+    X_(EV_KEY, key, KEY_CNT, "key")     \
+    X_(EV_REL, rel, REL_CNT, "rel")     \
+    X_(EV_ABS, abs, ABS_CNT, "abs")     \
+
+#define EVDEV_UNKNOWN_EV_LIST(X, w)
+#define EVDEV_UNKNOWN_KEY_LIST(X, w)
+#define EVDEV_UNKNOWN_REL_LIST(X, w)
+#define EVDEV_UNKNOWN_ABS_LIST(X, w)
+
+/* The capabilities required by each type */
+#define X_(name) [EVDEV_TYPE_##name] = EVDEV_CAPS_INIT_(name),
+static const union evdev_caps evdev_type_caps[EVDEV_N_TYPES] = {
+    EVDEV_TYPES_LIST
+};
+#undef X_
+
+#define test_bit(bits, bit) (((bits)[(bit) / 64] >> ((bit) % 64)) & 1)
+
+static enum evdev_type match_caps(const union evdev_caps *caps,
+    enum evdev_type_mask type_mask);
+static i32 ioctl_get_caps(i32 fd, const char *path, union evdev_caps *o);
+
+static i32 sysfs_probe(const char *rel_path, enum evdev_type_mask type_mask,
+    struct evdev *out);
+static i32 sysfs_get_caps(const char *dev_dir, union evdev_caps *o);
+static i32 sysfs_read_cap(const char *dev_dir, const char *cap_name,
+    u64 *o_bits, u32 n_bits);
+static i32 sysfs_read_file(const char *path, char *buf, u32 buf_size);
 
 VECTOR(struct evdev)
 evdev_find_and_load_devices(enum evdev_type_mask type_mask)
 {
     VECTOR(struct evdev) v = NULL;
-    struct dirent **namelist = NULL;
-    i32 dir_fd = -1;
-    i32 n_dirents = 0;
+    VECTOR(char *) names = NULL;
+    u32 n_dirents = 0;
 
     v = vector_new(struct evdev);
 
-    /* Obtain a directory listing of "/dev/input/event*" */
-    dir_fd = open(DEVINPUT_DIR, O_RDONLY | O_CLOEXEC);
-    if (dir_fd == -1)
-        goto_error("Failed to open %s: %s", DEVINPUT_DIR, strerror(errno));
-
-    n_dirents = scandir(DEVINPUT_DIR, &namelist,
-        dev_input_event_scandir_filter, alphasort);
-    if (n_dirents == -1) {
-        goto_error("Failed to scan dir \"%s\" for input devices: %s",
-            DEVINPUT_DIR, strerror(errno));
-    } else if (n_dirents == 0) {
-        goto_error("0 devices were found in \"%s\"", DEVINPUT_DIR);
+    /* Obtain a listing of "/dev/input/event*" */
+    names = evdev_source_list_devices();
+    if (names == NULL)
+        goto err;
+
+    n_dirents = vector_size(names);
+    if (n_dirents == 0) {
+        goto_error("0 devices were found in \"%s\"",
+            evdev_source_get()->root_dir);
     }
 
     u32 n_failed = 0;
-    for (i32 i = 0; i < n_dirents; i++) {
+    for (u32 i = 0; i < n_dirents; i++) {
         struct evdev tmp;
-        i32 r = evdev_load(namelist[i]->d_name, &tmp, type_mask);
+        i32 r = evdev_load(names[i], &tmp, type_mask);
 
         if (r < 0) { /* Opening failed */
             n_failed++;
@@ -81,22 +108,18 @@ evdev_find_and_load_devices(enum evdev_type_mask type_mask)
     }
 
     /* Cleanup */
-    for (i32 i = 0; i < n_dirents; i++)
-        u_nfree(&namelist[i]);
-
-    u_nfree(&namelist);
-    close(dir_fd);
+    for (u32 i = 0; i < n_dirents; i++)
+        u_nfree(&names[i]);
+    vector_destroy(&names);
 
     return v;
 
 err:
-    if (namelist != NULL && n_dirents > -1) {
-        for (i32 i = 0; i < n_dirents; i++) {
-            u_nfree(&namelist[i]);
-        }
-        u_nfree(&namelist);
+    if (names != NULL) {
+        for (u32 i = 0; i < vector_size(names); i++)
+            u_nfree(&names[i]);
+        vector_destroy(&names);
     }
-    if (dir_fd != -1) close(dir_fd);
     if (v != NULL) {
         for (u32 i = 0; i < vector_size(v); i++) {
             if (v[i].fd != -1) close(v[i].fd);
@@ -117,14 +140,25 @@ i32 evdev_load(const char *rel_path, struct evdev *out,
     u_check_params(rel_path != NULL && out != NULL);
     memset(out, 0, sizeof(struct evdev));
     out->initialized_ = true;
+    out->fd = -1;
     i32 err_ret = -1;
 
-    strncpy(out->path, DEVINPUT_DIR "/", u_FILEPATH_MAX);
-    strncat(out->path, rel_path,
-        u_FILEPATH_MAX - strlen(out->path) - 1);
+    /* Real devices are probed through sysfs first,
+     * so that the ones that don't match are never even opened */
+    bool probed = false;
+    if (evdev_source_get()->type == EVDEV_SOURCE_KERNEL &&
+        evdev_source_get()->sysfs_dir[0] != '\0')
+    {
+        const i32 r = sysfs_probe(rel_path, type_mask, out);
+        if (r > 0) {
+            err_ret = 1;
+            goto err;
+        }
+        probed = r == 0;
+    }
 
     /* Open the device */
-    out->fd = open(out->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    out->fd = evdev_source_open(rel_path, out->path);
     if (out->fd == -1) {
         /* Don't spam the user with 'Permission denied' errors
          *
@@ -133,14 +167,28 @@ i32 evdev_load(const char *rel_path, struct evdev *out,
          * when they get a full screen of error messages
          */
         if (errno == EACCES || errno == EPERM) {
-            s_log_debug("Could not open device /dev/input/%s: errno %i (%s)",
-                rel_path, errno, strerror(errno));
+            s_log_debug("Could not open device %s: errno %i (%s)",
+                out->path, errno, strerror(errno));
             goto err;
         }
         goto_error("%s: Failed to open %s: %s",
             __func__, out->path, strerror(errno));
     }
 
+    /* Emulated devices can't be probed */
+    if (evdev_source_get()->type == EVDEV_SOURCE_EMULATED) {
+        evdev_source_get_emulated_info(rel_path, out->name, &out->type);
+        if (!(type_mask & (1 << out->type))) {
+            err_ret = 1;
+            goto err;
+        }
+        return 0;
+    }
+
+    /* The name and type are already known */
+    if (probed)
+        return 0;
+
     /* Get device name */
     if (ioctl(out->fd, EVIOCGNAME(MAX_EVDEV_NAME_LEN - 1), out->name) < 0) {
         s_log_warn("Failed to get name for event device %s: %s",
@@ -148,15 +196,12 @@ i32 evdev_load(const char *rel_path, struct evdev *out,
     }
 
     /* Silently fail if device type doesn't match */
-    out->type = EVDEV_TYPE_UNKNOWN;
-    for (u32 i = 1; i < EVDEV_N_TYPES; i++) {
-        if ((type_mask & (1 << i)) &&
-            !ev_cap_check(out->fd, out->path, i))
-        {
-            out->type = i;
-            break;
-        }
+    union evdev_caps caps;
+    if (ioctl_get_caps(out->fd, out->path, &caps)) {
+        err_ret = 1;
+        goto err;
     }
+    out->type = match_caps(&caps, type_mask);
     if (out->type == EVDEV_TYPE_UNKNOWN) {
         err_ret = 1;
         goto err;
@@ -186,6 +231,12 @@ void evdev_list_destroy(VECTOR(struct evdev) *evdev_list_p)
     s_log_debug("Destroyed %u device(s)", n_devs);
 }
 
+i32 evdev_set_clock_monotonic(i32 fd)
+{
+    i32 clock_id = CLOCK_MONOTONIC;
+    return ioctl(fd, EVIOCSCLOCKID, &clock_id) != 0;
+}
+
 void evdev_destroy(struct evdev *e)
 {
     if (e == NULL || !e->initialized_) return;
@@ -201,64 +252,167 @@ void evdev_destroy(struct evdev *e)
     e->initialized_ = false;
 }
 
-static i32 dev_input_event_scandir_filter(const struct dirent *dirent)
+/* Returns 0 if the device `rel_path` matches one of the types in `type_mask`
+ * (which is written to `out` along with its name),
+ * a positive value if it doesn't, and a negative value
+ * if it couldn't be probed through sysfs at all */
+static i32 sysfs_probe(const char *rel_path, enum evdev_type_mask type_mask,
+    struct evdev *out)
 {
-    return !strncmp(dirent->d_name, "event", u_strlen("event"));
+    char dev_dir[u_FILEPATH_MAX];
+    if (snprintf(dev_dir, u_FILEPATH_MAX, "%s/%s/device",
+            evdev_source_get()->sysfs_dir, rel_path) >= u_FILEPATH_MAX)
+        return -1;
+
+    union evdev_caps caps;
+    if (sysfs_get_caps(dev_dir, &caps))
+        return -1;
+
+    const enum evdev_type type = match_caps(&caps, type_mask);
+    if (type == EVDEV_TYPE_UNKNOWN) {
+        s_log_debug("Skipping %s/%s (no matching capabilities)",
+            evdev_source_get()->root_dir, rel_path);
+        return 1;
+    }
+
+    char path[u_FILEPATH_MAX];
+    char name[MAX_EVDEV_NAME_LEN] = { 0 };
+    if (snprintf(path, u_FILEPATH_MAX, "%s/name", dev_dir) < u_FILEPATH_MAX &&
+        sysfs_read_file(path, name, MAX_EVDEV_NAME_LEN) == 0)
+    {
+        name[strcspn(name, "\n")] = '\0';
+        memcpy(out->name, name, MAX_EVDEV_NAME_LEN);
+    }
+    out->type = type;
+
+    return 0;
 }
 
-static i32 ev_cap_check(i32 fd, const char *path, enum evdev_type type)
+/* Reads the capabilities of the device `dev_dir` from sysfs into `o`.
+ * Returns 0 on success and non-zero on failure. */
+static i32 sysfs_get_caps(const char *dev_dir, union evdev_caps *o)
 {
-    u64 ev_bits[u_nbits(EV_MAX)];
-    if (ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits) < 0) {
-        s_log_error("Failed to get supported events from %s: %s",
-            path, strerror(errno));
+    memset(o, 0, sizeof(union evdev_caps));
+    if (sysfs_read_cap(dev_dir, "ev", o->ev, EV_CNT))
+        return 1;
+
+    /* The codes of the event types that aren't supported are all 0 anyway */
+#define X_(type_, member_, n_codes_, file_)                                 \
+    if (test_bit(o->ev, type_) &&                                           \
+        sysfs_read_cap(dev_dir, file_, o->member_, n_codes_))               \
         return 1;
+    EVDEV_CAPS_TYPES_LIST
+#undef X_
+
+    return 0;
+}
+
+/* Reads the capability bitmap `cap_name` from `dev_dir` into `o_bits`.
+ * The kernel writes it as hex `unsigned long`s separated by spaces,
+ * most significant first, with the leading zero ones omitted.
+ * Returns 0 on success and non-zero on failure. */
+static i32 sysfs_read_cap(const char *dev_dir, const char *cap_name,
+    u64 *o_bits, u32 n_bits)
+{
+    char path[u_FILEPATH_MAX];
+    char buf[SYSFS_READ_BUF_SIZE];
+    if (snprintf(path, u_FILEPATH_MAX, "%s/capabilities/%s",
+            dev_dir, cap_name) >= u_FILEPATH_MAX)
+        return 1;
+    if (sysfs_read_file(path, buf, SYSFS_READ_BUF_SIZE))
+        return 1;
+
+    unsigned long words[SYSFS_MAX_CAP_WORDS];
+    u32 n_words = 0;
+    const char *p = buf;
+    char *end = NULL;
+    while (n_words < SYSFS_MAX_CAP_WORDS) {
+        const unsigned long w = strtoul(p, &end, 16);
+        if (end == p)
+            break;
+        words[n_words++] = w;
+        p = end;
     }
+    if (n_words == 0)
+        return 1;
 
-    u32 i = 0;
-    const i32 *ev_checks = evdev_type_checks[type][0];
-    while (i < EV_max_n_checks_ && ev_checks[i] != EV_check_end_) {
-        const i32 curr_ev_bit = ev_checks[i];
-        s_assert(curr_ev_bit > 0 && curr_ev_bit < EV_CNT,
-            "Invalid EV_* value (%i)", curr_ev_bit);
-        const u32 curr_max_val = ev_max_vals[curr_ev_bit];
-
-        u64 bits[sizeof(union ev_bits_max_size__)];
-        if (ioctl(fd, EVIOCGBIT(curr_ev_bit, curr_max_val), bits) < 0) {
-            s_log_error("Failed to get event bits from %s: %s",
-                path, strerror(errno));
-            return 1;
+    const u32 bits_per_word = sizeof(unsigned long) * 8;
+    memset(o_bits, 0, u_nbits(n_bits) * sizeof(u64));
+    for (u32 i = 0; i < n_words; i++) {
+        const unsigned long w = words[n_words - 1 - i];
+        for (u32 b = 0; b < bits_per_word; b++) {
+            const u32 bit = i * bits_per_word + b;
+            if (bit < n_bits && (w >> b) & 1)
+                o_bits[bit / 64] |= 1ULL << (bit % 64);
         }
+    }
 
-        const i32 *curr_checks = evdev_type_checks[type][curr_ev_bit];
-        if (ev_bit_check(bits, curr_max_val, curr_checks)) {
-            //s_log_error("EV bit %i check failed", curr_ev_bit);
-            return 1;
-        }
+    return 0;
+}
 
-        i++;
-    }
+/* Reads (at most `buf_size - 1` bytes of) the file `path` into `buf`,
+ * and null-terminates it. Returns 0 on success and non-zero on failure. */
+static i32 sysfs_read_file(const char *path, char *buf, u32 buf_size)
+{
+    const i32 fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 1;
 
+    i64 n_read = 0;
+    while (n_read = read(fd, buf, buf_size - 1), n_read == -1 && errno == EINTR)
+        ;
+    close(fd);
+    if (n_read < 0)
+        return 1;
+
+    buf[n_read] = '\0';
     return 0;
 }
 
-static i32 ev_bit_check(const u64 bits[], u32 n_bits, const i32 *checks)
+/* Returns the first of the types in `type_mask` whose required capabilities
+ * are all in `caps`, or `EVDEV_TYPE_UNKNOWN` if there's none */
+static enum evdev_type match_caps(const union evdev_caps *caps,
+    enum evdev_type_mask type_mask)
 {
-    i32 ret = 0;
+    for (u32 i = 1; i < EVDEV_N_TYPES; i++) {
+        if (!(type_mask & (1 << i)))
+            continue;
 
-    u32 i = 0;
-    while (i < EV_max_n_checks_ && checks[i] != EV_check_end_) {
-        const u32 arr_index = checks[i] / 64;
-        if (arr_index >= n_bits) continue;
+        /* Only 15 words, so the compiler unrolls this into straight-line code */
+        const union evdev_caps *required = &evdev_type_caps[i];
+        u64 missing = 0;
+        for (u32 w = 0; w < EVDEV_CAPS_N_WORDS; w++)
+            missing |= required->words[w] & ~caps->words[w];
 
-        const u64 mask = 1ULL << (u64)(checks[i] % 64);
-        if (!(bits[checks[i] / 64] & mask)) {
-            //s_log_error("Bit %#x not present", checks[i]);
-            ret++;
-        }
+        if (missing == 0)
+            return i;
+    }
+
+    return EVDEV_TYPE_UNKNOWN;
+}
+
+/* Gets the capabilities of the device `fd` with `EVIOCGBIT`,
+ * once for every event type in `union evdev_caps`.
+ * Returns 0 on success and non-zero on failure. */
+static i32 ioctl_get_caps(i32 fd, const char *path, union evdev_caps *o)
+{
+    memset(o, 0, sizeof(union evdev_caps));
+    if (ioctl(fd, EVIOCGBIT(0, sizeof(o->ev)), o->ev) < 0) {
+        s_log_error("Failed to get supported events from %s: %s",
+            path, strerror(errno));
+        return 1;
+    }
 
-        i++;
+#define X_(type_, member_, n_codes_, file_)                                 \
+    if (test_bit(o->ev, type_) &&                                           \
+        ioctl(fd, EVIOCGBIT(type_, sizeof(o->member_)), o->member_) < 0)    \
+    {                                                                       \
+        s_log_error("Failed to get event bits from %s: %s",                 \
+            path, strerror(errno));                                         \
+        return 1;                                                           \
     }
+    EVDEV_CAPS_TYPES_LIST
+#undef X_
 
-    return ret;
+    return 0;
 }
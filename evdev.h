@@ -41,129 +41,111 @@ enum evdev_type_mask {
 static_assert(sizeof(enum evdev_type_mask) <= sizeof(u32),
     "The size of the evdev mask enum must be within the size of a u32.");
 
-#define EV_check_end_ (-1)
-#define EV_max_n_checks_ 256
+/* The capabilities of a device that are needed to tell its type,
+ * packed into a single bitmap, so that checking whether a device
+ * has all the capabilities required by a type is just an AND
+ * and a compare of each word. */
+#define EVDEV_CAPS_N_WORDS                                      \
+    (u_nbits(EV_CNT) + u_nbits(KEY_CNT) + u_nbits(REL_CNT) + u_nbits(ABS_CNT))
+union evdev_caps {
+    struct {
+        u64 ev[u_nbits(EV_CNT)]; /* The supported event types */
+        u64 key[u_nbits(KEY_CNT)];
+        u64 rel[u_nbits(REL_CNT)];
+        u64 abs[u_nbits(ABS_CNT)];
+    };
+    u64 words[EVDEV_CAPS_N_WORDS];
+};
+static_assert(sizeof(union evdev_caps) == EVDEV_CAPS_N_WORDS * sizeof(u64),
+    "The capability bitmaps must be packed");
 
 #ifdef P_INTERNAL_GUARD__
-static const i32
-evdev_type_checks[EVDEV_N_TYPES][EV_CNT][EV_max_n_checks_] = {
-    [EVDEV_TYPE_KEYBOARD] = {
-        [0] = {
-            EV_KEY, EV_check_end_
-        },
-        [EV_KEY] = {
-            KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8, KEY_9,
-            KEY_0, KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H,
-            KEY_J, KEY_L, KEY_M, KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S,
-            KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z,
-            KEY_UP, KEY_DOWN, KEY_LEFT, KEY_RIGHT,
-            KEY_SPACE, KEY_ESC, KEY_ENTER, KEY_BACKSPACE, KEY_TAB, KEY_F21,
-            EV_check_end_
-        }
-    },
-    [EVDEV_TYPE_MOUSE] = {
-        [0] = {
-            EV_KEY, EV_REL, EV_check_end_
-        },
-        [EV_KEY] = {
-            BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, EV_check_end_
-        },
-        [EV_REL] = {
-            REL_X, REL_Y, REL_WHEEL, EV_check_end_
-        },
-    },
+
+/* The capabilities required by each device type.
+ * Every list is X(code, word) - see `EVDEV_CAPS_INIT_`. */
+#define EVDEV_KEYBOARD_EV_LIST(X, w) X(EV_KEY, w)
+#define EVDEV_KEYBOARD_KEY_LIST(X, w)                                       \
+    X(KEY_1, w) X(KEY_2, w) X(KEY_3, w) X(KEY_4, w) X(KEY_5, w)             \
+    X(KEY_6, w) X(KEY_7, w) X(KEY_8, w) X(KEY_9, w) X(KEY_0, w)             \
+    X(KEY_A, w) X(KEY_B, w) X(KEY_C, w) X(KEY_D, w) X(KEY_E, w)             \
+    X(KEY_F, w) X(KEY_G, w) X(KEY_H, w) X(KEY_J, w) X(KEY_L, w)             \
+    X(KEY_M, w) X(KEY_N, w) X(KEY_O, w) X(KEY_P, w) X(KEY_Q, w)             \
+    X(KEY_R, w) X(KEY_S, w) X(KEY_T, w) X(KEY_U, w) X(KEY_V, w)             \
+    X(KEY_W, w) X(KEY_X, w) X(KEY_Y, w) X(KEY_Z, w)                         \
+    X(KEY_UP, w) X(KEY_DOWN, w) X(KEY_LEFT, w) X(KEY_RIGHT, w)              \
+    X(KEY_SPACE, w) X(KEY_ESC, w) X(KEY_ENTER, w) X(KEY_BACKSPACE, w)       \
+    X(KEY_TAB, w) X(KEY_F21, w)
+#define EVDEV_KEYBOARD_REL_LIST(X, w)
+#define EVDEV_KEYBOARD_ABS_LIST(X, w)
+
+#define EVDEV_MOUSE_EV_LIST(X, w) X(EV_KEY, w) X(EV_REL, w)
+#define EVDEV_MOUSE_KEY_LIST(X, w) X(BTN_LEFT, w) X(BTN_RIGHT, w) X(BTN_MIDDLE, w)
+#define EVDEV_MOUSE_REL_LIST(X, w) X(REL_X, w) X(REL_Y, w) X(REL_WHEEL, w)
+#define EVDEV_MOUSE_ABS_LIST(X, w)
+
 #ifdef CGD_CONFIG_PLATFORM_LINUX_EVDEV_PS4_CONTROLLER_SUPPORT
-    [EVDEV_TYPE_PS4_CONTROLLER] = {
-        [0] = {
-            EV_KEY, EV_ABS, EV_check_end_
-        },
-        [EV_KEY] = {
-            /* Cross, circle, square, triangle */
-            BTN_SOUTH, BTN_EAST, BTN_WEST, BTN_NORTH,
-
-            /* L1, R1, L2, R2 */
-            BTN_TL, BTN_TR, BTN_TL2, BTN_TR2,
-
-            /* L3, R3 */
-            BTN_THUMBL, BTN_THUMBR,
-
-            BTN_SELECT, /* Share */
-            BTN_START, /* Options */
-            BTN_MODE, /* PS (home) button */
-
-            EV_check_end_
-        },
-        [EV_ABS] = {
-            ABS_X, ABS_Y, /* Left stick movement */
-            ABS_RX, ABS_RY, /* Right stick movement */
-            ABS_Z, ABS_RZ, /* L2 and R2 pressure (0 - 255) */
-
-            /* D-pad (arrows on the left) */
-            ABS_HAT0X, /* -1 for left, 1 for right and 0 for neutral (both) */
-            ABS_HAT0Y, /* Same here but -1 for up and 1 for down */
-
-            EV_check_end_
-        },
-    },
-    [EVDEV_TYPE_PS4_CONTROLLER_TOUCHPAD] = {
-        [0] = {
-            EV_KEY, EV_ABS, EV_check_end_
-        },
-        [EV_KEY] = {
-            /* Touchpad press */
-            BTN_TOOL_FINGER, BTN_TOOL_DOUBLETAP,
-            BTN_TOUCH,
-            BTN_LEFT,
-            EV_check_end_
-        },
-        [EV_ABS] = {
-            ABS_MT_POSITION_X, ABS_MT_POSITION_Y, /* Finger movement */
-            ABS_MT_TRACKING_ID, /* Touch ID */
-            EV_check_end_
-        },
-    },
-    [EVDEV_TYPE_PS4_CONTROLLER_MOTION_SENSORS] = {
-        [0] = {
-            EV_ABS, EV_check_end_
-        },
-        [EV_ABS] = {
-            ABS_X, ABS_Y, ABS_Z, /* Accelerometer */
-            ABS_RX, ABS_RY, ABS_RZ, /* Gyroscope */
-            EV_check_end_
-        },
-    },
+#define EVDEV_PS4_CONTROLLER_EV_LIST(X, w) X(EV_KEY, w) X(EV_ABS, w)
+#define EVDEV_PS4_CONTROLLER_KEY_LIST(X, w)                                 \
+    /* Cross, circle, square, triangle */                                   \
+    X(BTN_SOUTH, w) X(BTN_EAST, w) X(BTN_WEST, w) X(BTN_NORTH, w)           \
+    /* L1, R1, L2, R2 */                                                    \
+    X(BTN_TL, w) X(BTN_TR, w) X(BTN_TL2, w) X(BTN_TR2, w)                   \
+    /* L3, R3 */                                                            \
+    X(BTN_THUMBL, w) X(BTN_THUMBR, w)                                       \
+    X(BTN_SELECT, w) /* Share */                                            \
+    X(BTN_START, w) /* Options */                                           \
+    X(BTN_MODE, w) /* PS (home) button */
+#define EVDEV_PS4_CONTROLLER_REL_LIST(X, w)
+#define EVDEV_PS4_CONTROLLER_ABS_LIST(X, w)                                 \
+    X(ABS_X, w) X(ABS_Y, w) /* Left stick movement */                       \
+    X(ABS_RX, w) X(ABS_RY, w) /* Right stick movement */                    \
+    X(ABS_Z, w) X(ABS_RZ, w) /* L2 and R2 pressure (0 - 255) */             \
+    /* D-pad: -1 for left/up, 1 for right/down and 0 for neutral */         \
+    X(ABS_HAT0X, w) X(ABS_HAT0Y, w)
+
+#define EVDEV_PS4_CONTROLLER_TOUCHPAD_EV_LIST(X, w) X(EV_KEY, w) X(EV_ABS, w)
+#define EVDEV_PS4_CONTROLLER_TOUCHPAD_KEY_LIST(X, w)                        \
+    /* Touchpad press */                                                    \
+    X(BTN_TOOL_FINGER, w) X(BTN_TOOL_DOUBLETAP, w)                          \
+    X(BTN_TOUCH, w) X(BTN_LEFT, w)
+#define EVDEV_PS4_CONTROLLER_TOUCHPAD_REL_LIST(X, w)
+#define EVDEV_PS4_CONTROLLER_TOUCHPAD_ABS_LIST(X, w)                        \
+    X(ABS_MT_POSITION_X, w) X(ABS_MT_POSITION_Y, w) /* Finger movement */   \
+    X(ABS_MT_TRACKING_ID, w) /* Touch ID */
+
+#define EVDEV_PS4_CONTROLLER_MOTION_SENSORS_EV_LIST(X, w) X(EV_ABS, w)
+#define EVDEV_PS4_CONTROLLER_MOTION_SENSORS_KEY_LIST(X, w)
+#define EVDEV_PS4_CONTROLLER_MOTION_SENSORS_REL_LIST(X, w)
+#define EVDEV_PS4_CONTROLLER_MOTION_SENSORS_ABS_LIST(X, w)                  \
+    X(ABS_X, w) X(ABS_Y, w) X(ABS_Z, w) /* Accelerometer */                 \
+    X(ABS_RX, w) X(ABS_RY, w) X(ABS_RZ, w) /* Gyroscope */
 #endif /* CGD_CONFIG_PLATFORM_LINUX_EVDEV_PS4_CONTROLLER_SUPPORT */
-};
 
-static const u32 ev_max_vals[EV_CNT] = {
-    [EV_SYN] = SYN_MAX,
-    [EV_KEY] = KEY_MAX,
-    [EV_REL] = REL_MAX,
-    [EV_ABS] = ABS_MAX,
-    [EV_MSC] = MSC_MAX,
-    [EV_SW] = SW_MAX,
-    [EV_LED] = LED_MAX,
-    [EV_SND] = SND_MAX,
-    [EV_REP] = REP_MAX,
-    [EV_FF] = FF_MAX,
-    [EV_PWR] = 0,
-    [EV_FF_STATUS] = FF_STATUS_MAX,
-    [EV_MAX] = 0,
-};
-union ev_bits_max_size__ {
-    u64 syn[u_nbits(SYN_CNT)];
-    u64 key[u_nbits(KEY_CNT)];
-    u64 rel[u_nbits(REL_CNT)];
-    u64 abs[u_nbits(ABS_CNT)];
-    u64 msc[u_nbits(MSC_CNT)];
-    u64 sw[u_nbits(SW_CNT)];
-    u64 led[u_nbits(LED_CNT)];
-    u64 snd[u_nbits(SND_CNT)];
-    u64 rep[u_nbits(REP_CNT)];
-    u64 ff[u_nbits(FF_CNT)];
-    u64 pwr[1];
-    u64 ff_status[u_nbits(FF_STATUS_MAX + 1)];
-};
+/* Expands to the `word`-th 64-bit word of the bitmap of all codes in `list`
+ * (a constant expression, so the masks are built at compile time) */
+#define EVDEV_CAPS_BIT_(code, word) \
+    | ((code) / 64 == (word) ? 1ULL << ((code) % 64) : 0ULL)
+#define EVDEV_CAPS_WORD_(list, word) (0ULL list(EVDEV_CAPS_BIT_, word))
+
+#define EVDEV_CAPS_WORDS_1_(list) { EVDEV_CAPS_WORD_(list, 0) }
+#define EVDEV_CAPS_WORDS_12_(list) {                                        \
+    EVDEV_CAPS_WORD_(list, 0), EVDEV_CAPS_WORD_(list, 1),                   \
+    EVDEV_CAPS_WORD_(list, 2), EVDEV_CAPS_WORD_(list, 3),                   \
+    EVDEV_CAPS_WORD_(list, 4), EVDEV_CAPS_WORD_(list, 5),                   \
+    EVDEV_CAPS_WORD_(list, 6), EVDEV_CAPS_WORD_(list, 7),                   \
+    EVDEV_CAPS_WORD_(list, 8), EVDEV_CAPS_WORD_(list, 9),                   \
+    EVDEV_CAPS_WORD_(list, 10), EVDEV_CAPS_WORD_(list, 11),                 \
+}
+static_assert(u_nbits(EV_CNT) == 1 && u_nbits(KEY_CNT) == 12 &&
+    u_nbits(REL_CNT) == 1 && u_nbits(ABS_CNT) == 1,
+    "EVDEV_CAPS_INIT_ must be updated for the new event code counts");
+
+#define EVDEV_CAPS_INIT_(type) {                                            \
+    .ev = EVDEV_CAPS_WORDS_1_(EVDEV_##type##_EV_LIST),                      \
+    .key = EVDEV_CAPS_WORDS_12_(EVDEV_##type##_KEY_LIST),                   \
+    .rel = EVDEV_CAPS_WORDS_1_(EVDEV_##type##_REL_LIST),                    \
+    .abs = EVDEV_CAPS_WORDS_1_(EVDEV_##type##_ABS_LIST),                    \
+}
 
 #define X_(name) "EVDEV_" #name,
 static const char *const evdev_type_strings[] = {
@@ -200,6 +182,13 @@ i32 evdev_load(const char *rel_path, struct evdev *out,
  * of `*evdev_list_p` to `NULL`. */
 void evdev_list_destroy(VECTOR(struct evdev) *evdev_list_p);
 
+/* Makes the kernel timestamp the events of the device `fd`
+ * with `CLOCK_MONOTONIC` (instead of `CLOCK_REALTIME`),
+ * so that they can be compared with `p_time_get_ticks_ns()`.
+ * Returns 0 on success and non-zero on failure
+ * (e.g. if `fd` isn't a real event device). */
+i32 evdev_set_clock_monotonic(i32 fd);
+
 /* Frees resources associated with just the evdev `e`. */
 void evdev_destroy(struct evdev *e);
 
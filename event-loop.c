@@ -0,0 +1,604 @@
+#define _GNU_SOURCE
+#include "event-loop.h"
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+#include "io-uring.h"
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+#include "stats.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define MODULE_NAME "event-loop"
+
+static i32 write_all(i32 fd, const void *buf, u32 size);
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+static i32 uring_init(struct event_loop *loop);
+static i32 uring_add(struct event_loop *loop, struct event_loop_source *src,
+    u32 events);
+static void uring_remove(struct event_loop *loop,
+    struct event_loop_source *src);
+static i32 uring_wait(struct event_loop *loop, i32 timeout_ms);
+static i32 uring_write(struct event_loop *loop, i32 fd,
+    const void *buf, u32 size);
+static void uring_destroy(struct event_loop *loop);
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+i32 event_loop_init(struct event_loop *o, enum event_loop_backend backend)
+{
+    u_check_params(o != NULL && backend >= 0 && backend < EVENT_LOOP_N_BACKENDS);
+    memset(o, 0, sizeof(struct event_loop));
+    o->epoll_fd = -1;
+    o->backend = EVENT_LOOP_BACKEND_EPOLL;
+
+    if (backend == EVENT_LOOP_BACKEND_IO_URING) {
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+        if (uring_init(o) == 0) {
+            o->backend = EVENT_LOOP_BACKEND_IO_URING;
+            s_log_debug("Initialized the event loop with io_uring");
+            return 0;
+        }
+        s_log_warn("io_uring is not available, falling back to epoll");
+#else
+        s_log_warn("io_uring support was not compiled in, "
+            "falling back to epoll");
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+    }
+
+    o->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (o->epoll_fd == -1) {
+        s_log_error("Failed to create the epoll instance: %s",
+            strerror(errno));
+        return 1;
+    }
+
+    s_log_debug("Initialized the event loop with epoll fd %i", o->epoll_fd);
+    return 0;
+}
+
+i32 event_loop_add(struct event_loop *loop, struct event_loop_source *src,
+    u32 events)
+{
+    u_check_params(loop != NULL && src != NULL && src->fd >= 0);
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->backend == EVENT_LOOP_BACKEND_IO_URING) {
+        if (uring_add(loop, src, events))
+            return 1;
+
+        loop->n_sources++;
+        return 0;
+    }
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = src,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, src->fd, &ev)) {
+        s_log_error("Failed to add fd %i to the event loop: %s",
+            src->fd, strerror(errno));
+        return 1;
+    }
+
+    loop->n_sources++;
+    return 0;
+}
+
+i32 event_loop_modify(struct event_loop *loop, struct event_loop_source *src,
+    u32 events)
+{
+    u_check_params(loop != NULL && src != NULL && src->fd >= 0);
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->backend == EVENT_LOOP_BACKEND_IO_URING) {
+        uring_remove(loop, src);
+        return uring_add(loop, src, events);
+    }
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    struct epoll_event ev = {
+        .events = events,
+        .data.ptr = src,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, src->fd, &ev)) {
+        s_log_error("Failed to modify fd %i in the event loop: %s",
+            src->fd, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+void event_loop_remove(struct event_loop *loop,
+    struct event_loop_source *src)
+{
+    u_check_params(loop != NULL && src != NULL);
+    if (src->fd < 0)
+        return;
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->backend == EVENT_LOOP_BACKEND_IO_URING) {
+        uring_remove(loop, src);
+        loop->n_sources--;
+        return;
+    }
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    /* Closing the fd would also remove it from the epoll set
+     * (unless it was duplicated), but be explicit about it */
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, src->fd, NULL)) {
+        s_log_error("Failed to remove fd %i from the event loop: %s",
+            src->fd, strerror(errno));
+    }
+
+    loop->n_sources--;
+}
+
+i32 event_loop_wait(struct event_loop *loop, i32 timeout_ms)
+{
+    u_check_params(loop != NULL);
+
+    loop->n_ready_ = 0;
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->backend == EVENT_LOOP_BACKEND_IO_URING)
+        return uring_wait(loop, timeout_ms);
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    i32 ret = epoll_wait(loop->epoll_fd, loop->epoll_events_,
+        EVENT_LOOP_MAX_READY, timeout_ms);
+    if (ret == -1) {
+        if (errno == EINTR)
+            return 0;
+
+        s_log_error("Failed to wait for events: %s", strerror(errno));
+        return -1;
+    }
+
+    for (i32 i = 0; i < ret; i++) {
+        loop->ready_[i] = (struct event_loop_ready) {
+            .src = loop->epoll_events_[i].data.ptr,
+            .events = loop->epoll_events_[i].events,
+        };
+    }
+    loop->n_ready_ = ret;
+    return ret;
+}
+
+const struct event_loop_ready * event_loop_get_ready(struct event_loop *loop,
+    u32 index)
+{
+    u_check_params(loop != NULL && index < loop->n_ready_);
+
+    return &loop->ready_[index];
+}
+
+i32 event_loop_write(struct event_loop *loop, i32 fd,
+    const void *buf, u32 size)
+{
+    u_check_params(loop != NULL && fd >= 0 && buf != NULL);
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->backend == EVENT_LOOP_BACKEND_IO_URING)
+        return uring_write(loop, fd, buf, size);
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    return write_all(fd, buf, size);
+}
+
+i32 event_loop_create_signal_fd(const sigset_t *sigset)
+{
+    u_check_params(sigset != NULL);
+
+    if (sigprocmask(SIG_BLOCK, sigset, NULL)) {
+        s_log_error("Failed to block the signals: %s", strerror(errno));
+        return -1;
+    }
+
+    i32 fd = signalfd(-1, sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1) {
+        s_log_error("Failed to create the signalfd: %s", strerror(errno));
+        (void) sigprocmask(SIG_UNBLOCK, sigset, NULL);
+        return -1;
+    }
+
+    return fd;
+}
+
+void event_loop_destroy(struct event_loop *loop)
+{
+    if (loop == NULL)
+        return;
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+    if (loop->uring_ != NULL)
+        uring_destroy(loop);
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
+
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+    loop->n_sources = 0;
+    loop->n_ready_ = 0;
+}
+
+static i32 write_all(i32 fd, const void *buf, u32 size)
+{
+    ssize_t ret = 0;
+    do {
+        ret = write(fd, buf, size);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1) {
+        s_log_error("Failed to write to fd %i: %s", fd, strerror(errno));
+        return 1;
+    } else if ((u32)ret != size) {
+        s_log_error("Short write to fd %i (%li/%u bytes)",
+            fd, (long)ret, size);
+        return 1;
+    }
+
+    return 0;
+}
+
+#ifdef CGD_CONFIG_IO_URING_SUPPORT
+
+#define URING_N_ENTRIES 256
+#define URING_MAX_SLOTS 64
+#define URING_N_WRITE_BUFS 8
+#define URING_WRITE_BUF_SIZE 4096
+
+/* The `user_data` of every request encodes what it was for:
+ * bits 56-63 - the kind of request,
+ * bits 32-55 - the generation of the slot (to detect stale completions),
+ * bits 0-31  - the slot (or write buffer) index */
+enum uring_req_kind {
+    URING_REQ_PRIMARY = 1, /* A poll, or the read for F_READ sources */
+    URING_REQ_LINK_POLL, /* The poll that precedes a read */
+    URING_REQ_WRITE,
+    URING_REQ_TIMEOUT,
+    URING_REQ_CANCEL,
+};
+#define uring_user_data(kind, gen, index) \
+    (((u64)(kind) << 56) | (((u64)(gen) & 0xffffff) << 32) | (u64)(index))
+#define uring_user_data_kind(ud) ((enum uring_req_kind)((ud) >> 56))
+#define uring_user_data_gen(ud) ((u32)(((ud) >> 32) & 0xffffff))
+#define uring_user_data_index(ud) ((u32)((ud) & 0xffffffff))
+
+struct uring_slot {
+    struct event_loop_source *src; /* NULL if free or being cancelled */
+    u32 poll_events;
+    u32 gen;
+    bool used;
+    bool in_flight;
+    bool arm_queued;
+};
+
+struct event_loop_uring {
+    struct io_uring_ring ring;
+
+    struct uring_slot slots[URING_MAX_SLOTS];
+
+    /* Slots whose requests have to be (re-)submitted */
+    u32 arm_queue[URING_MAX_SLOTS];
+    u32 n_arm_queue;
+
+    bool write_buf_in_flight[URING_N_WRITE_BUFS];
+    u8 write_bufs[URING_N_WRITE_BUFS][URING_WRITE_BUF_SIZE];
+
+    struct __kernel_timespec timeout;
+
+    /* Registered as fixed buffers, if possible */
+    u8 read_bufs[URING_MAX_SLOTS][EVENT_LOOP_READ_BUF_SIZE];
+};
+
+static void uring_queue_arm(struct event_loop_uring *u, u32 slot_index);
+static void uring_arm(struct event_loop_uring *u, u32 slot_index);
+static void uring_handle_cqe(struct event_loop *loop,
+    const struct io_uring_cqe *cqe);
+
+static i32 uring_init(struct event_loop *loop)
+{
+    struct event_loop_uring *u = calloc(1, sizeof(struct event_loop_uring));
+    s_assert(u != NULL, "calloc() failed for io_uring state");
+
+    if (io_uring_ring_init(&u->ring, URING_N_ENTRIES)) {
+        u_nfree(&u);
+        return 1;
+    }
+
+    struct iovec iovs[URING_MAX_SLOTS];
+    for (u32 i = 0; i < URING_MAX_SLOTS; i++) {
+        iovs[i].iov_base = u->read_bufs[i];
+        iovs[i].iov_len = EVENT_LOOP_READ_BUF_SIZE;
+    }
+    if (io_uring_ring_register_buffers(&u->ring, iovs, URING_MAX_SLOTS)) {
+        s_log_debug("Fixed buffers unavailable, using regular reads");
+    }
+
+    loop->uring_ = u;
+    return 0;
+}
+
+static i32 uring_add(struct event_loop *loop, struct event_loop_source *src,
+    u32 events)
+{
+    struct event_loop_uring *u = loop->uring_;
+
+    u32 i = 0;
+    while (i < URING_MAX_SLOTS && u->slots[i].used)
+        i++;
+    if (i == URING_MAX_SLOTS) {
+        s_log_error("Failed to add fd %i to the event loop: "
+            "all %u io_uring slots are in use", src->fd, URING_MAX_SLOTS);
+        return 1;
+    }
+
+    struct uring_slot *slot = &u->slots[i];
+    slot->used = true;
+    slot->src = src;
+    slot->poll_events = events;
+    slot->gen++;
+    src->backend_slot_ = i;
+
+    uring_queue_arm(u, i);
+    return 0;
+}
+
+static void uring_remove(struct event_loop *loop,
+    struct event_loop_source *src)
+{
+    struct event_loop_uring *u = loop->uring_;
+    const u32 i = src->backend_slot_;
+    s_assert(i < URING_MAX_SLOTS && u->slots[i].src == src,
+        "Source with fd %i is not registered", src->fd);
+
+    struct uring_slot *slot = &u->slots[i];
+    slot->src = NULL;
+    if (!slot->in_flight) {
+        slot->used = false;
+        return;
+    }
+
+    /* The slot can only be reused once the in-flight requests complete.
+     * Cancelling the poll also cancels the read linked to it. */
+    const enum uring_req_kind kinds[] = {
+        URING_REQ_LINK_POLL, URING_REQ_PRIMARY
+    };
+    for (u32 k = 0; k < u_arr_size(kinds); k++) {
+        struct io_uring_sqe *sqe = io_uring_ring_get_sqe(&u->ring);
+        if (sqe == NULL) {
+            s_log_error("Failed to cancel the requests for fd %i", src->fd);
+            return;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(kinds[k], slot->gen, i);
+        sqe->user_data = uring_user_data(URING_REQ_CANCEL, 0, 0);
+    }
+}
+
+static i32 uring_wait(struct event_loop *loop, i32 timeout_ms)
+{
+    struct event_loop_uring *u = loop->uring_;
+
+    for (u32 i = 0; i < u->n_arm_queue; i++) {
+        u->slots[u->arm_queue[i]].arm_queued = false;
+        uring_arm(u, u->arm_queue[i]);
+    }
+    u->n_arm_queue = 0;
+
+    /* Don't block if there are some completions left over
+     * from the last call */
+    u32 min_complete = 1;
+    if (timeout_ms == 0 || io_uring_ring_peek_cqe(&u->ring) != NULL) {
+        min_complete = 0;
+    } else if (timeout_ms > 0) {
+        struct io_uring_sqe *sqe = io_uring_ring_get_sqe(&u->ring);
+        if (sqe != NULL) {
+            u->timeout.tv_sec = timeout_ms / 1000;
+            u->timeout.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (u64)(uintptr_t)&u->timeout;
+            sqe->len = 1;
+            sqe->off = 1; /* Complete on the first other completion */
+            sqe->user_data = uring_user_data(URING_REQ_TIMEOUT, 0, 0);
+        }
+    }
+
+    if (io_uring_ring_submit_and_wait(&u->ring, min_complete))
+        return -1;
+
+    struct io_uring_cqe *cqe = NULL;
+    while (loop->n_ready_ < EVENT_LOOP_MAX_READY &&
+        (cqe = io_uring_ring_peek_cqe(&u->ring), cqe != NULL))
+    {
+        uring_handle_cqe(loop, cqe);
+        io_uring_ring_cqe_seen(&u->ring);
+    }
+
+    return loop->n_ready_;
+}
+
+static i32 uring_write(struct event_loop *loop, i32 fd,
+    const void *buf, u32 size)
+{
+    struct event_loop_uring *u = loop->uring_;
+
+    u32 i = 0;
+    while (i < URING_N_WRITE_BUFS && u->write_buf_in_flight[i])
+        i++;
+
+    struct io_uring_sqe *sqe = NULL;
+    if (i == URING_N_WRITE_BUFS || size > URING_WRITE_BUF_SIZE ||
+        (sqe = io_uring_ring_get_sqe(&u->ring), sqe == NULL))
+    {
+        /* Can't queue it - just do it synchronously */
+        return write_all(fd, buf, size);
+    }
+
+    memcpy(u->write_bufs[i], buf, size);
+    u->write_buf_in_flight[i] = true;
+
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (u64)(uintptr_t)u->write_bufs[i];
+    sqe->len = size;
+    sqe->off = (u64)-1; /* The fd is not seekable */
+    sqe->user_data = uring_user_data(URING_REQ_WRITE, 0, i);
+
+    return 0;
+}
+
+static void uring_destroy(struct event_loop *loop)
+{
+    struct event_loop_uring *u = loop->uring_;
+
+    /* Closing the ring cancels all the in-flight requests */
+    io_uring_ring_destroy(&u->ring);
+    u_nfree(&loop->uring_);
+}
+
+static void uring_queue_arm(struct event_loop_uring *u, u32 slot_index)
+{
+    if (u->slots[slot_index].arm_queued)
+        return;
+
+    s_assert(u->n_arm_queue < URING_MAX_SLOTS, "The arm queue is full");
+    u->arm_queue[u->n_arm_queue++] = slot_index;
+    u->slots[slot_index].arm_queued = true;
+}
+
+static void uring_arm(struct event_loop_uring *u, u32 slot_index)
+{
+    struct uring_slot *slot = &u->slots[slot_index];
+    if (slot->src == NULL || slot->in_flight)
+        return;
+
+    struct io_uring_sqe *poll_sqe = io_uring_ring_get_sqe(&u->ring);
+    if (poll_sqe == NULL)
+        goto err;
+    poll_sqe->opcode = IORING_OP_POLL_ADD;
+    poll_sqe->fd = slot->src->fd;
+    poll_sqe->poll32_events = slot->poll_events;
+
+    if (!(slot->src->flags & EVENT_LOOP_SOURCE_F_READ)) {
+        poll_sqe->user_data =
+            uring_user_data(URING_REQ_PRIMARY, slot->gen, slot_index);
+        slot->in_flight = true;
+        return;
+    }
+
+    /* The fds are non-blocking, so a read submitted on its own
+     * would just fail with EAGAIN. Link it to a poll instead,
+     * so that it only runs once there's something to read. */
+    poll_sqe->flags = IOSQE_IO_LINK;
+    poll_sqe->user_data =
+        uring_user_data(URING_REQ_LINK_POLL, slot->gen, slot_index);
+
+    struct io_uring_sqe *read_sqe = io_uring_ring_get_sqe(&u->ring);
+    if (read_sqe == NULL)
+        goto err;
+    read_sqe->fd = slot->src->fd;
+    read_sqe->addr = (u64)(uintptr_t)u->read_bufs[slot_index];
+    read_sqe->len = EVENT_LOOP_READ_BUF_SIZE;
+    if (u->ring.buffers_registered) {
+        read_sqe->opcode = IORING_OP_READ_FIXED;
+        read_sqe->buf_index = slot_index;
+    } else {
+        read_sqe->opcode = IORING_OP_READ;
+    }
+    read_sqe->user_data =
+        uring_user_data(URING_REQ_PRIMARY, slot->gen, slot_index);
+    slot->in_flight = true;
+    return;
+
+err:
+    s_log_error("The io_uring submission queue is full, "
+        "can't arm the request for fd %i", slot->src->fd);
+}
+
+static void uring_handle_cqe(struct event_loop *loop,
+    const struct io_uring_cqe *cqe)
+{
+    struct event_loop_uring *u = loop->uring_;
+    const u64 ud = cqe->user_data;
+    const u32 index = uring_user_data_index(ud);
+
+    switch (uring_user_data_kind(ud)) {
+    case URING_REQ_WRITE:
+        s_assert(index < URING_N_WRITE_BUFS, "Invalid write buffer %u", index);
+        u->write_buf_in_flight[index] = false;
+        if (cqe->res < 0) {
+            s_log_error("Failed to write to the fake keyboard: %s",
+                strerror(-cqe->res));
+            stats_add_global(STATS_WRITE_FAILURES, 1);
+        }
+        return;
+    case URING_REQ_PRIMARY:
+        break;
+    case URING_REQ_LINK_POLL: /* The result is passed on to the read */
+    case URING_REQ_TIMEOUT:
+    case URING_REQ_CANCEL:
+    default:
+        return;
+    }
+
+    s_assert(index < URING_MAX_SLOTS, "Invalid slot index %u", index);
+    struct uring_slot *slot = &u->slots[index];
+    if (!slot->used || slot->gen != uring_user_data_gen(ud))
+        return; /* Stale completion */
+
+    slot->in_flight = false;
+    if (slot->src == NULL) {
+        /* The source was removed, and this was the last request */
+        slot->used = false;
+        return;
+    }
+
+    struct event_loop_ready *ready = &loop->ready_[loop->n_ready_];
+    *ready = (struct event_loop_ready) { .src = slot->src };
+
+    if (!(slot->src->flags & EVENT_LOOP_SOURCE_F_READ)) {
+        ready->events = cqe->res < 0 ? EPOLLERR : (u32)cqe->res;
+        if (cqe->res < 0 || !(ready->events & (EPOLLERR | EPOLLHUP)))
+            uring_queue_arm(u, index);
+        loop->n_ready_++;
+        return;
+    }
+
+    if (cqe->res > 0) {
+        ready->events = EPOLLIN;
+        ready->data = u->read_bufs[index];
+        ready->n_bytes = cqe->res;
+    } else if (cqe->res == -EAGAIN || cqe->res == -EINTR ||
+        cqe->res == -ECANCELED)
+    {
+        /* Spurious wakeup, try again */
+        uring_queue_arm(u, index);
+        return;
+    } else if (cqe->res == 0 || cqe->res == -ENODEV) {
+        ready->events = EPOLLHUP;
+    } else {
+        ready->events = EPOLLERR;
+    }
+
+    /* Don't re-arm the read before the data is handled by the user;
+     * that happens on the next `event_loop_wait` call */
+    if (cqe->res > 0)
+        uring_queue_arm(u, index);
+    loop->n_ready_++;
+}
+
+#endif /* CGD_CONFIG_IO_URING_SUPPORT */
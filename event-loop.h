@@ -0,0 +1,141 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <core/int.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <sys/epoll.h>
+
+/* A thin wrapper around epoll (or io_uring).
+ *
+ * Every registered file descriptor is represented by a
+ * `struct event_loop_source`, which is usually embedded in whatever
+ * record it belongs to (e.g. a device), so that when the fd becomes ready
+ * the owner can be retrieved directly, without searching for it.
+ *
+ * This means that the cost of a single wakeup only depends on the number
+ * of ready fds, and not on the number of registered ones.
+ *
+ * With the io_uring backend, sources flagged with `EVENT_LOOP_SOURCE_F_READ`
+ * always have a read in flight, so that the data is already there
+ * when the source is reported as ready, and `event_loop_write`s are submitted
+ * through the same ring. Everything that has to be done in a single
+ * iteration of the loop then costs only one `io_uring_enter` syscall. */
+
+#define EVENT_LOOP_BACKENDS_LIST        \
+    X_(EVENT_LOOP_BACKEND_EPOLL)        \
+    X_(EVENT_LOOP_BACKEND_IO_URING)     \
+
+#define X_(name) name,
+enum event_loop_backend {
+    EVENT_LOOP_BACKENDS_LIST
+    EVENT_LOOP_N_BACKENDS
+};
+#undef X_
+
+enum event_loop_source_type {
+    EVENT_LOOP_SOURCE_MONITOR,
+    EVENT_LOOP_SOURCE_DEVICE,
+    EVENT_LOOP_SOURCE_SIGNAL,
+    EVENT_LOOP_SOURCE_TIMER,
+    EVENT_LOOP_SOURCE_REPLAY,
+    EVENT_LOOP_SOURCE_STATS,
+};
+
+/* Allow the backend to read the data from the source by itself
+ * (at most `EVENT_LOOP_READ_BUF_SIZE` bytes at once).
+ * The data is then passed in `struct event_loop_ready`. */
+#define EVENT_LOOP_SOURCE_F_READ (1U << 0)
+
+#define EVENT_LOOP_READ_BUF_SIZE 1536
+
+struct event_loop_source {
+    i32 fd;
+    enum event_loop_source_type type;
+    u32 flags; /* EVENT_LOOP_SOURCE_F_* */
+    void *data; /* Owned by the user */
+
+    u32 backend_slot_;
+};
+
+struct event_loop_ready {
+    struct event_loop_source *src;
+    u32 events; /* EPOLLIN, EPOLLERR, EPOLLHUP etc. */
+
+    /* The data that was already read from `src` by the backend.
+     * Only valid until the next `event_loop_wait` call.
+     * If `data` is NULL, the user has to read from `src` by themselves. */
+    const void *data;
+    u32 n_bytes;
+};
+
+/* The maximal number of ready sources returned by a single
+ * `event_loop_wait` call. Any remaining ones will be returned
+ * by the next call. */
+#define EVENT_LOOP_MAX_READY 64
+
+struct event_loop {
+    enum event_loop_backend backend;
+    i32 epoll_fd;
+    u32 n_sources;
+
+    u32 n_ready_;
+    struct event_loop_ready ready_[EVENT_LOOP_MAX_READY];
+    struct epoll_event epoll_events_[EVENT_LOOP_MAX_READY];
+
+    struct event_loop_uring *uring_;
+};
+
+/* Initializes the event loop `o`, preferrably with the backend `backend`.
+ * If it's not available (e.g. io_uring isn't supported by the kernel
+ * or the daemon was built without it), epoll is used instead.
+ * Returns 0 on success and non-zero on failure. */
+i32 event_loop_init(struct event_loop *o, enum event_loop_backend backend);
+
+/* Registers `src` in `loop` for the epoll events `events` (`EPOLLIN` etc.)
+ * `EPOLLERR` and `EPOLLHUP` are always reported.
+ * `src` must stay valid until it's removed with `event_loop_remove`.
+ * Returns 0 on success and non-zero on failure. */
+i32 event_loop_add(struct event_loop *loop, struct event_loop_source *src,
+    u32 events);
+
+/* Changes the events that `src` is registered for in `loop`.
+ * Returns 0 on success and non-zero on failure. */
+i32 event_loop_modify(struct event_loop *loop, struct event_loop_source *src,
+    u32 events);
+
+/* Unregisters `src` from `loop`.
+ * Note that `src` may still be returned by `event_loop_get_ready`
+ * until the next call to `event_loop_wait`. */
+void event_loop_remove(struct event_loop *loop,
+    struct event_loop_source *src);
+
+/* Blocks for at most `timeout_ms` milliseconds (-1 means indefinitely)
+ * until at least one of the registered sources becomes ready.
+ *
+ * Returns the number of ready sources (which may be 0 if the wait
+ * timed out or was interrupted by a signal),
+ * or -1 if an error occured. */
+i32 event_loop_wait(struct event_loop *loop, i32 timeout_ms);
+
+/* Returns the `index`-th ready source from the last `event_loop_wait` call */
+const struct event_loop_ready * event_loop_get_ready(struct event_loop *loop,
+    u32 index);
+
+/* Writes `size` bytes from `buf` to `fd`.
+ * With the io_uring backend the write is only queued, and submitted
+ * (together with everything else) by the next `event_loop_wait` call.
+ * Returns 0 on success and non-zero on failure. */
+i32 event_loop_write(struct event_loop *loop, i32 fd,
+    const void *buf, u32 size);
+
+/* Creates a signalfd for the signals in `sigset` and blocks their
+ * normal delivery, so that they can be handled as a regular event source.
+ * Returns the fd on success and -1 on failure. */
+i32 event_loop_create_signal_fd(const sigset_t *sigset);
+
+/* Destroys the event loop `loop`.
+ * The registered sources' fds are not closed. */
+void event_loop_destroy(struct event_loop *loop);
+
+#endif /* EVENT_LOOP_H_ */
@@ -0,0 +1,103 @@
+#include "histogram.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/arena.h>
+
+#define MODULE_NAME "histogram"
+
+#define LOAD_(counter_) atomic_load_explicit(&(counter_), memory_order_relaxed)
+
+/* The percentiles written by `histogram_write` */
+#define HISTOGRAM_PERCENTILES_LIST  \
+    X_(50, "p50")                   \
+    X_(90, "p90")                   \
+    X_(99, "p99")                   \
+    X_(99.9, "p999")                \
+
+u64 histogram_bucket_lower_bound(u32 index)
+{
+    u_check_params(index < HISTOGRAM_N_BUCKETS);
+
+    if (index < HISTOGRAM_N_SUB_BUCKETS)
+        return index;
+
+    const u32 shift = index / HISTOGRAM_N_SUB_BUCKETS - 1;
+    const u64 sub_bucket = index % HISTOGRAM_N_SUB_BUCKETS;
+    return (HISTOGRAM_N_SUB_BUCKETS + sub_bucket) << shift;
+}
+
+u64 histogram_bucket_upper_bound(u32 index)
+{
+    u_check_params(index < HISTOGRAM_N_BUCKETS);
+
+    if (index == HISTOGRAM_N_BUCKETS - 1)
+        return HISTOGRAM_MAX_VALUE;
+
+    return histogram_bucket_lower_bound(index + 1) - 1;
+}
+
+u64 histogram_percentile(const struct histogram *h, f64 percentile)
+{
+    u_check_params(h != NULL && percentile >= 0.0 && percentile <= 100.0);
+
+    const u64 count = LOAD_(h->count);
+    if (count == 0)
+        return 0;
+
+    /* The rank of the value we're looking for (at least 1) */
+    u64 rank = (u64)(percentile / 100.0 * count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    u64 n = 0;
+    for (u32 i = 0; i < HISTOGRAM_N_BUCKETS; i++) {
+        n += LOAD_(h->buckets[i]);
+        if (n >= rank) {
+            /* Never report more than what was actually recorded */
+            const u64 upper = histogram_bucket_upper_bound(i);
+            const u64 max = LOAD_(h->max);
+            return upper < max ? upper : max;
+        }
+    }
+
+    /* A concurrent reader might see `count` ahead of the buckets */
+    return LOAD_(h->max);
+}
+
+void histogram_reset(struct histogram *h)
+{
+    u_check_params(h != NULL);
+
+    for (u32 i = 0; i < HISTOGRAM_N_BUCKETS; i++)
+        atomic_store_explicit(&h->buckets[i], 0, memory_order_relaxed);
+    atomic_store_explicit(&h->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->max, 0, memory_order_relaxed);
+}
+
+i32 histogram_write(struct arena *out, const char *prefix,
+    const struct histogram *h)
+{
+    u_check_params(out != NULL && prefix != NULL && h != NULL);
+
+#define PRINT_(...) do {                                \
+    if (arena_printf(out, __VA_ARGS__) == NULL)         \
+        return 1;                                       \
+} while (0)
+
+    const u64 count = LOAD_(h->count);
+    PRINT_("%s.count %lu\n", prefix, (unsigned long)count);
+    PRINT_("%s.mean %lu\n", prefix,
+        (unsigned long)(count ? LOAD_(h->sum) / count : 0));
+#define X_(percentile_, name_) \
+    PRINT_("%s." name_ " %lu\n", prefix, \
+        (unsigned long)histogram_percentile(h, percentile_));
+    HISTOGRAM_PERCENTILES_LIST
+#undef X_
+    PRINT_("%s.max %lu\n", prefix, (unsigned long)LOAD_(h->max));
+
+#undef PRINT_
+
+    return 0;
+}
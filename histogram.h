@@ -0,0 +1,83 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <core/int.h>
+#include <core/arena.h>
+#include <stdatomic.h>
+
+/* A fixed-size log-linear histogram (in the style of HdrHistogram),
+ * for latencies in nanoseconds.
+ *
+ * Values below `HISTOGRAM_N_SUB_BUCKETS` get a bucket each.
+ * Every power of two above that, [2^m, 2^(m + 1)), is split into
+ * `HISTOGRAM_N_SUB_BUCKETS` equally wide buckets, so any recorded value
+ * is known to within 1/16 (6.25%) of itself. Values above
+ * `HISTOGRAM_MAX_VALUE` (~18 minutes) are clamped.
+ *
+ * Like the counters in `stats.h`, a histogram may only be written
+ * by a single thread, but can be read from anywhere. */
+
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_N_SUB_BUCKETS (1U << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_MAX_MAGNITUDE 39
+#define HISTOGRAM_MAX_VALUE ((1ULL << (HISTOGRAM_MAX_MAGNITUDE + 1)) - 1)
+#define HISTOGRAM_N_BUCKETS \
+    ((HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS + 2) \
+        * HISTOGRAM_N_SUB_BUCKETS)
+
+struct histogram {
+    _Atomic u64 buckets[HISTOGRAM_N_BUCKETS];
+    _Atomic u64 count;
+    _Atomic u64 sum;
+    _Atomic u64 max;
+};
+
+/* Returns the index of the bucket that `value` falls into */
+static inline u32 histogram_bucket_index(u64 value)
+{
+    if (value > HISTOGRAM_MAX_VALUE)
+        value = HISTOGRAM_MAX_VALUE;
+    if (value < HISTOGRAM_N_SUB_BUCKETS)
+        return value;
+
+    const u32 magnitude = 63 - __builtin_clzll(value);
+    const u32 shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS;
+    const u32 sub_bucket = (value >> shift) & (HISTOGRAM_N_SUB_BUCKETS - 1);
+    return (shift + 1) * HISTOGRAM_N_SUB_BUCKETS + sub_bucket;
+}
+
+static inline void histogram_record(struct histogram *h, u64 value)
+{
+#define INC_(counter_, n_) atomic_store_explicit(&(counter_),               \
+    atomic_load_explicit(&(counter_), memory_order_relaxed) + (n_),         \
+    memory_order_relaxed)
+
+    INC_(h->buckets[histogram_bucket_index(value)], 1);
+    INC_(h->count, 1);
+    INC_(h->sum, value);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+
+#undef INC_
+}
+
+/* Returns the lowest value that falls into the bucket `index` */
+u64 histogram_bucket_lower_bound(u32 index);
+
+/* Returns the highest value that falls into the bucket `index` */
+u64 histogram_bucket_upper_bound(u32 index);
+
+/* Returns the (upper bound of the bucket of the) value below which
+ * `percentile` percent of the recorded values fall, or 0 if it's empty */
+u64 histogram_percentile(const struct histogram *h, f64 percentile);
+
+/* Clears all the recorded values */
+void histogram_reset(struct histogram *h);
+
+/* Appends the count, mean, a few percentiles and the maximum of `h`
+ * to the text in `out` (see `arena_printf`), as "<prefix>.name value" lines.
+ * Returns non-zero if they don't fit. */
+i32 histogram_write(struct arena *out, const char *prefix,
+    const struct histogram *h);
+
+#endif /* HISTOGRAM_H_ */
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include "io-uring.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define MODULE_NAME "io-uring"
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+static i32 sys_io_uring_setup(u32 entries, struct io_uring_params *p);
+static i32 sys_io_uring_enter(i32 fd, u32 to_submit, u32 min_complete,
+    u32 flags);
+static i32 sys_io_uring_register(i32 fd, u32 opcode, const void *arg,
+    u32 nr_args);
+
+i32 io_uring_ring_init(struct io_uring_ring *o, u32 n_entries)
+{
+    u_check_params(o != NULL && n_entries > 0);
+    memset(o, 0, sizeof(struct io_uring_ring));
+    o->sq_ring_ = o->cq_ring_ = o->sqes_ = MAP_FAILED;
+
+    struct io_uring_params p = { 0 };
+    o->fd = sys_io_uring_setup(n_entries, &p);
+    if (o->fd < 0) {
+        s_log_debug("io_uring_setup() failed: %s", strerror(errno));
+        o->fd = -1;
+        return 1;
+    }
+    o->n_entries = p.sq_entries;
+
+    o->sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(u32);
+    o->cq_ring_size_ = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (o->cq_ring_size_ > o->sq_ring_size_)
+            o->sq_ring_size_ = o->cq_ring_size_;
+        o->cq_ring_size_ = o->sq_ring_size_;
+    }
+
+    o->sq_ring_ = mmap(NULL, o->sq_ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, o->fd, IORING_OFF_SQ_RING);
+    if (o->sq_ring_ == MAP_FAILED)
+        goto_error("Failed to map the submission ring: %s", strerror(errno));
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        o->cq_ring_ = o->sq_ring_;
+    } else {
+        o->cq_ring_ = mmap(NULL, o->cq_ring_size_, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, o->fd, IORING_OFF_CQ_RING);
+        if (o->cq_ring_ == MAP_FAILED)
+            goto_error("Failed to map the completion ring: %s",
+                strerror(errno));
+    }
+
+    o->sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    o->sqes_ = mmap(NULL, o->sqes_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, o->fd, IORING_OFF_SQES);
+    if (o->sqes_ == MAP_FAILED)
+        goto_error("Failed to map the SQE array: %s", strerror(errno));
+
+    u8 *sq = o->sq_ring_, *cq = o->cq_ring_;
+    o->sq_head_ = (u32 *)(sq + p.sq_off.head);
+    o->sq_tail_ = (u32 *)(sq + p.sq_off.tail);
+    o->sq_mask_ = (u32 *)(sq + p.sq_off.ring_mask);
+    o->sq_array_ = (u32 *)(sq + p.sq_off.array);
+    o->cq_head_ = (u32 *)(cq + p.cq_off.head);
+    o->cq_tail_ = (u32 *)(cq + p.cq_off.tail);
+    o->cq_mask_ = (u32 *)(cq + p.cq_off.ring_mask);
+    o->cqes_ = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    o->sqe_local_tail_ = *o->sq_tail_;
+
+    s_log_debug("Set up an io_uring with fd %i (%u entries)",
+        o->fd, o->n_entries);
+    return 0;
+
+err:
+    io_uring_ring_destroy(o);
+    return 1;
+}
+
+struct io_uring_sqe * io_uring_ring_get_sqe(struct io_uring_ring *ring)
+{
+    u_check_params(ring != NULL && ring->fd != -1);
+
+    u32 head = load_acquire(ring->sq_head_);
+    if (ring->sqe_local_tail_ - head >= ring->n_entries) {
+        /* The queue is full - flush it without waiting for anything */
+        if (io_uring_ring_submit_and_wait(ring, 0))
+            return NULL;
+        head = load_acquire(ring->sq_head_);
+        if (ring->sqe_local_tail_ - head >= ring->n_entries)
+            return NULL;
+    }
+
+    const u32 index = ring->sqe_local_tail_ & *ring->sq_mask_;
+    struct io_uring_sqe *sqe = &ring->sqes_[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array_[index] = index;
+    ring->sqe_local_tail_++;
+
+    return sqe;
+}
+
+i32 io_uring_ring_submit_and_wait(struct io_uring_ring *ring,
+    u32 min_complete)
+{
+    u_check_params(ring != NULL && ring->fd != -1);
+
+    const u32 to_submit = ring->sqe_local_tail_ - *ring->sq_tail_;
+    store_release(ring->sq_tail_, ring->sqe_local_tail_);
+
+    if (to_submit == 0 && min_complete == 0)
+        return 0;
+
+    const u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (sys_io_uring_enter(ring->fd, to_submit, min_complete, flags) < 0) {
+        if (errno == EINTR)
+            return 0;
+
+        s_log_error("io_uring_enter() failed: %s", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+struct io_uring_cqe * io_uring_ring_peek_cqe(struct io_uring_ring *ring)
+{
+    u_check_params(ring != NULL && ring->fd != -1);
+
+    const u32 head = *ring->cq_head_;
+    if (head == load_acquire(ring->cq_tail_))
+        return NULL;
+
+    return &ring->cqes_[head & *ring->cq_mask_];
+}
+
+void io_uring_ring_cqe_seen(struct io_uring_ring *ring)
+{
+    u_check_params(ring != NULL && ring->fd != -1);
+    store_release(ring->cq_head_, *ring->cq_head_ + 1);
+}
+
+i32 io_uring_ring_register_buffers(struct io_uring_ring *ring,
+    const struct iovec *iovs, u32 n)
+{
+    u_check_params(ring != NULL && ring->fd != -1 && iovs != NULL);
+
+    if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, n)) {
+        s_log_debug("Failed to register %u fixed buffers: %s",
+            n, strerror(errno));
+        return 1;
+    }
+
+    ring->buffers_registered = true;
+    return 0;
+}
+
+void io_uring_ring_destroy(struct io_uring_ring *ring)
+{
+    if (ring == NULL)
+        return;
+
+    if (ring->sqes_ != MAP_FAILED && ring->sqes_ != NULL)
+        munmap(ring->sqes_, ring->sqes_size_);
+    if (ring->cq_ring_ != MAP_FAILED && ring->cq_ring_ != NULL &&
+        ring->cq_ring_ != ring->sq_ring_)
+    {
+        munmap(ring->cq_ring_, ring->cq_ring_size_);
+    }
+    if (ring->sq_ring_ != MAP_FAILED && ring->sq_ring_ != NULL)
+        munmap(ring->sq_ring_, ring->sq_ring_size_);
+    ring->sqes_ = NULL;
+    ring->cq_ring_ = ring->sq_ring_ = NULL;
+
+    /* Closing the ring also unregisters the buffers
+     * and cancels all in-flight requests */
+    if (ring->fd != -1) {
+        close(ring->fd);
+        ring->fd = -1;
+    }
+    ring->buffers_registered = false;
+}
+
+static i32 sys_io_uring_setup(u32 entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static i32 sys_io_uring_enter(i32 fd, u32 to_submit, u32 min_complete,
+    u32 flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+        NULL, 0);
+}
+
+static i32 sys_io_uring_register(i32 fd, u32 opcode, const void *arg,
+    u32 nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
@@ -0,0 +1,67 @@
+#ifndef IO_URING_H_
+#define IO_URING_H_
+
+#include <core/int.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* A minimal io_uring wrapper built directly on top of the raw syscalls,
+ * so that the daemon doesn't need to depend on liburing.
+ *
+ * Only the things used by the event loop are implemented;
+ * the ring is meant to be used by a single thread. */
+
+struct io_uring_ring {
+    i32 fd;
+    u32 n_entries;
+
+    /* Submission queue */
+    void *sq_ring_;
+    u64 sq_ring_size_;
+    u32 *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+    struct io_uring_sqe *sqes_;
+    u64 sqes_size_;
+    u32 sqe_local_tail_; /* SQEs that were filled in, but not yet submitted */
+
+    /* Completion queue */
+    void *cq_ring_;
+    u64 cq_ring_size_;
+    u32 *cq_head_, *cq_tail_, *cq_mask_;
+    struct io_uring_cqe *cqes_;
+
+    bool buffers_registered;
+};
+
+/* Sets up a new ring with (at least) `n_entries` submission queue entries.
+ * Returns 0 on success and non-zero on failure (e.g. if io_uring
+ * is not supported by the kernel or disabled by the system's policy). */
+i32 io_uring_ring_init(struct io_uring_ring *o, u32 n_entries);
+
+/* Returns a zeroed-out SQE that will be submitted with the next
+ * `io_uring_ring_submit_and_wait` call, or NULL if the submission queue
+ * is full (and couldn't be flushed). */
+struct io_uring_sqe * io_uring_ring_get_sqe(struct io_uring_ring *ring);
+
+/* Submits all pending SQEs and waits until at least `min_complete`
+ * completions are available, with a single `io_uring_enter` syscall.
+ * Returns 0 on success (also if interrupted by a signal)
+ * and non-zero on failure. */
+i32 io_uring_ring_submit_and_wait(struct io_uring_ring *ring,
+    u32 min_complete);
+
+/* Returns the next available completion or NULL if there are none.
+ * The CQE must be released with `io_uring_ring_cqe_seen` after use. */
+struct io_uring_cqe * io_uring_ring_peek_cqe(struct io_uring_ring *ring);
+void io_uring_ring_cqe_seen(struct io_uring_ring *ring);
+
+/* Registers the `n` buffers described by `iovs` as fixed buffers
+ * (for use with `IORING_OP_READ_FIXED`).
+ * Returns 0 on success and non-zero on failure. */
+i32 io_uring_ring_register_buffers(struct io_uring_ring *ring,
+    const struct iovec *iovs, u32 n);
+
+/* Unmaps and closes the ring. */
+void io_uring_ring_destroy(struct io_uring_ring *ring);
+
+#endif /* IO_URING_H_ */
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include "evdev.h"
 #include "jsdev.h"
+#include "evdev-source.h"
 #include <core/int.h>
 #include <core/log.h>
 #include <core/util.h>
@@ -16,10 +17,8 @@
 
 #define MODULE_NAME "jsdev"
 
-#define DEV_INPUT_DIR "/dev/input"
-
 static i32 get_evdev_from_js(const char *js_rel_path,
-    char *o_evdev_path, u32 evdev_path_buf_size);
+    char *o_evdev_rel_path, u32 evdev_path_buf_size);
 
 i32 joystick_dev_load(struct joystick_dev *jsdev,
     const char *rel_path, bool grab_evdev)
@@ -28,8 +27,9 @@ i32 joystick_dev_load(struct joystick_dev *jsdev,
     memset(jsdev, 0, sizeof(struct joystick_dev));
     jsdev->initialized_ = true;
 
-    (void) snprintf(jsdev->path, u_FILEPATH_MAX,
-        "%s/%s", DEV_INPUT_DIR, rel_path);
+    if (snprintf(jsdev->path, u_FILEPATH_MAX, "%s/%s",
+            evdev_source_get()->root_dir, rel_path) >= u_FILEPATH_MAX)
+        goto_error("The path to the joystick device %s is too long", rel_path);
     jsdev->fd = open(jsdev->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
     if (jsdev->fd == -1)
         goto_error("Failed to open device %s: %s",
@@ -43,18 +43,14 @@ i32 joystick_dev_load(struct joystick_dev *jsdev,
 #endif /* CGD_BUILDTYPE_RELEASE */
 
     /* Load the evdev that feeds into this joystick device */
-    char evdev_path[u_FILEPATH_MAX] = { 0 };
-    if (get_evdev_from_js(rel_path, evdev_path, u_FILEPATH_MAX))
+    char evdev_rel_path[u_FILEPATH_MAX] = { 0 };
+    if (get_evdev_from_js(rel_path, evdev_rel_path, u_FILEPATH_MAX))
         goto_error("Failed to determine the path to the joystick device's "
             "\"%s\" (%s) corresponsing evdev", jsdev->name, jsdev->path);
 
-    s_assert(!strncmp(evdev_path, "/dev/input/", u_strlen("/dev/input/")),
-        "Invalid event device path \"%s\"", evdev_path);
-    if (evdev_load(evdev_path + u_strlen("/dev/input/"),
-        &jsdev->evdev, EVDEV_MASK_AUTO))
-    {
+    if (evdev_load(evdev_rel_path, &jsdev->evdev, EVDEV_MASK_AUTO)) {
         goto_error("Failed to load the joystick's (\"%s\" - %s) "
-            "event device (%s)", jsdev->name, jsdev->path, evdev_path);
+            "event device (%s)", jsdev->name, jsdev->path, evdev_rel_path);
     }
 
     if (grab_evdev) {
@@ -173,9 +169,9 @@ void joystick_dev_destroy(struct joystick_dev *jsdev)
 }
 
 static i32 get_evdev_from_js(const char *js_rel_path,
-    char *o_evdev_path, u32 evdev_path_buf_size)
+    char *o_evdev_rel_path, u32 evdev_path_buf_size)
 {
-    memset(o_evdev_path, 0, u_FILEPATH_MAX);
+    memset(o_evdev_rel_path, 0, u_FILEPATH_MAX);
 
     char sysfs_path[u_FILEPATH_MAX] = { 0 };
     (void) snprintf(sysfs_path, u_FILEPATH_MAX,
@@ -191,15 +187,15 @@ static i32 get_evdev_from_js(const char *js_rel_path,
     struct dirent *entry = NULL;
     while (entry = readdir(dir), entry != NULL) {
         if (!strncmp(entry->d_name, "event", u_strlen("event"))) {
-            i32 ret = snprintf(o_evdev_path, evdev_path_buf_size,
-                "/dev/input/%s", entry->d_name);
+            i32 ret = snprintf(o_evdev_rel_path, evdev_path_buf_size,
+                "%s", entry->d_name);
             s_assert(ret != -1,
-                "snprintf(o_evdev_path, %u, /dev/input/%%s, %s) failed",
+                "snprintf(o_evdev_rel_path, %u, %%s, %s) failed",
                 evdev_path_buf_size, entry->d_name);
             if ((u32)ret > evdev_path_buf_size) {
                 s_log_error("snprintf output truncated");
             }
-            o_evdev_path[evdev_path_buf_size - 1] = '\0';
+            o_evdev_rel_path[evdev_path_buf_size - 1] = '\0';
             closedir(dir);
             return 0;
         }
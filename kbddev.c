@@ -2,6 +2,7 @@
 #define KBDDEV_INTERNAL_GUARD__
 #include "kbddev.h"
 #undef KBDDEV_INTERNAL_GUARD__
+#include "stats.h"
 #include <core/int.h>
 #include <core/log.h>
 #include <core/util.h>
@@ -11,6 +12,7 @@
 #include <stdbool.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
@@ -21,6 +23,11 @@
 #define UINPUT_DEV_PATH "/dev/uinput"
 #define UINPUT_DEV_FALLBACK_PATH "/dev/input/uinput"
 
+/* uinput timestamps the injected events by itself,
+ * so every pulse is exactly the same and they can all share one frame */
+#define PULSE_FRAME_LEN KBDDEV_PULSE_N_EVENTS
+#define MAX_PULSES_PER_WRITE 64
+
 i32 kbddev_init(kbddev_t *kbddev_p, u16 fake_keypress_keycode)
 {
     u_check_params(kbddev_p != NULL);
@@ -28,6 +35,7 @@ i32 kbddev_init(kbddev_t *kbddev_p, u16 fake_keypress_keycode)
     /* Open the uinput device */
     struct kbddev ret = {
         .fd = -1,
+        .keycode = fake_keypress_keycode,
         .dev_created__ = false,
         .destroyed__ = false
     };
@@ -82,6 +90,98 @@ err:
     return 1;
 }
 
+i32 kbddev_init_file(kbddev_t *kbddev_p, const char *path,
+    u16 fake_keypress_keycode)
+{
+    u_check_params(kbddev_p != NULL && path != NULL);
+
+    struct kbddev ret = {
+        .fd = -1,
+        .keycode = fake_keypress_keycode,
+        .dev_created__ = false,
+        .destroyed__ = false
+    };
+
+    /* O_RDWR so that opening a FIFO doesn't fail (or block)
+     * when nobody is reading from it yet */
+    ret.fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC,
+        0644);
+    if (ret.fd == -1) {
+        s_log_error("Failed to open the fake keyboard output \"%s\": %s",
+            path, strerror(errno));
+        kbddev_destroy(&ret);
+        *kbddev_p = ret;
+        return 1;
+    }
+
+    s_log_info("Writing the fake keypresses to \"%s\" instead of uinput",
+        path);
+    *kbddev_p = ret;
+    return 0;
+}
+
+i32 kbddev_send_pulses(kbddev_t *kbddev_p, u32 n_pulses)
+{
+    u_check_params(kbddev_p != NULL && kbddev_p->fd != -1);
+
+    const struct input_event frame[PULSE_FRAME_LEN] = {
+        { .type = EV_KEY, .code = kbddev_p->keycode, .value = 1 },
+        { .type = EV_KEY, .code = kbddev_p->keycode, .value = 0 },
+        { .type = EV_SYN, .code = SYN_REPORT, .value = 0 },
+    };
+    struct iovec iov[MAX_PULSES_PER_WRITE];
+
+    while (n_pulses > 0) {
+        const u32 n = n_pulses > MAX_PULSES_PER_WRITE ?
+            MAX_PULSES_PER_WRITE : n_pulses;
+        for (u32 i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)frame;
+            iov[i].iov_len = sizeof(frame);
+        }
+
+        ssize_t ret = 0;
+        do {
+            ret = writev(kbddev_p->fd, iov, n);
+            stats_add_global(STATS_WRITE_SYSCALLS, 1);
+        } while (ret == -1 && errno == EINTR);
+
+        if (ret == -1) {
+            s_log_error("Failed to write fake events to fd %i: %s",
+                kbddev_p->fd, strerror(errno));
+            stats_add_global(STATS_WRITE_FAILURES, 1);
+            return 1;
+        } else if ((size_t)ret != n * sizeof(frame)) {
+            s_log_error("Short write to fd %i (%li/%lu bytes)",
+                kbddev_p->fd, (long)ret, n * sizeof(frame));
+            stats_add_global(STATS_WRITE_FAILURES, 1);
+            return 1;
+        }
+
+        n_pulses -= n;
+    }
+
+    return 0;
+}
+
+void kbddev_fill_pulses(const kbddev_t *kbddev_p, struct input_event *buf,
+    u32 n_pulses)
+{
+    u_check_params(kbddev_p != NULL && buf != NULL);
+
+    for (u32 i = 0; i < n_pulses; i++) {
+        struct input_event *frame = &buf[i * PULSE_FRAME_LEN];
+        frame[0] = (struct input_event) {
+            .type = EV_KEY, .code = kbddev_p->keycode, .value = 1
+        };
+        frame[1] = (struct input_event) {
+            .type = EV_KEY, .code = kbddev_p->keycode, .value = 0
+        };
+        frame[2] = (struct input_event) {
+            .type = EV_SYN, .code = SYN_REPORT, .value = 0
+        };
+    }
+}
+
 void kbddev_destroy(kbddev_t *kbddev_p)
 {
     if (kbddev_p == NULL || kbddev_p->destroyed__)
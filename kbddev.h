@@ -8,9 +8,11 @@ extern "C" {
 #include <core/int.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <linux/input.h>
 
 typedef struct kbddev {
     i32 fd; /* The actual event device fd */
+    u16 keycode; /* The key code of the fake keypresses */
 
     /* Internal stuff; don't play around with it */
     bool dev_created__; bool destroyed__;
@@ -23,6 +25,28 @@ static_assert(sizeof(kbddev_t) <= 8,
  * Returns 0 on success and non-zero on failure. */
 i32 kbddev_init(kbddev_t *kbddev_p, u16 fake_keypress_keycode);
 
+/* Initializes a "fake keyboard" in `*kbddev_p` that just writes
+ * the raw `struct input_event`s of the fake keypresses to the file
+ * (or FIFO, etc) at `path`, without creating a uinput device.
+ * Returns 0 on success and non-zero on failure. */
+i32 kbddev_init_file(kbddev_t *kbddev_p, const char *path,
+    u16 fake_keypress_keycode);
+
+/* Sends `n_pulses` fake keypresses (press + release + SYN_REPORT each)
+ * to the fake keyboard device `kbddev_p`, all with a single syscall.
+ * Returns 0 on success and non-zero on failure. */
+i32 kbddev_send_pulses(kbddev_t *kbddev_p, u32 n_pulses);
+
+/* The number of `struct input_event`s that make up a single fake keypress */
+#define KBDDEV_PULSE_N_EVENTS 3
+
+/* Fills `buf` (which must have space for at least
+ * `n_pulses * KBDDEV_PULSE_N_EVENTS` events) with `n_pulses` fake keypresses,
+ * for when they have to be written to the device by someone else
+ * (e.g. queued in the event loop). */
+void kbddev_fill_pulses(const kbddev_t *kbddev_p, struct input_event *buf,
+    u32 n_pulses);
+
 /* Destroys the fake keyboard device pointed to by `kbddev_p`. */
 void kbddev_destroy(kbddev_t *kbddev_p);
 
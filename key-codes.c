@@ -1,12 +1,11 @@
 #include "key-codes.h"
-#define P_INTERNAL_GUARD__
 #include "evdev.h"
-#undef P_INTERNAL_GUARD__
 #include <core/log.h>
 #include <core/util.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <linux/input-event-codes.h>
 
 #define MODULE_NAME "evdev"
@@ -16,22 +15,34 @@
 static const char *const ev_type_strings[EV_CNT] = {
     EV_TYPE_LIST
 };
-static const char * ev_strings[EV_CNT][sizeof(union ev_bits_max_size__) * 8] = {
-    [EV_SYN] = { EV_SYN_LIST },
-    [EV_KEY] = { EV_KEY_LIST },
-    [EV_REL] = { EV_REL_LIST },
-    [EV_ABS] = { EV_ABS_LIST },
-    [EV_MSC] = { EV_MSC_LIST },
-    [EV_SW]  = { EV_SW_LIST  },
-    [EV_LED] = { EV_LED_LIST },
-    [EV_SND] = { EV_SND_LIST },
-    [EV_REP] = { EV_REP_LIST },
-    [EV_FF] =  { ""          },
-    [EV_PWR] = { ""          },
-    [EV_FF_STATUS] = { ""    },
-};
+
+/* Each table is only as large as the number of codes of its type */
+static const char *const syn_strings[SYN_CNT] = { EV_SYN_LIST };
+static const char *const key_strings[KEY_CNT] = { EV_KEY_LIST };
+static const char *const rel_strings[REL_CNT] = { EV_REL_LIST };
+static const char *const abs_strings[ABS_CNT] = { EV_ABS_LIST };
+static const char *const msc_strings[MSC_CNT] = { EV_MSC_LIST };
+static const char *const sw_strings[SW_CNT] = { EV_SW_LIST };
+static const char *const led_strings[LED_CNT] = { EV_LED_LIST };
+static const char *const snd_strings[SND_CNT] = { EV_SND_LIST };
+static const char *const rep_strings[REP_CNT] = { EV_REP_LIST };
 #undef X_
 
+static const struct {
+    const char *const *strings;
+    u32 n_codes;
+} ev_code_strings[EV_CNT] = {
+    [EV_SYN] = { syn_strings, SYN_CNT },
+    [EV_KEY] = { key_strings, KEY_CNT },
+    [EV_REL] = { rel_strings, REL_CNT },
+    [EV_ABS] = { abs_strings, ABS_CNT },
+    [EV_MSC] = { msc_strings, MSC_CNT },
+    [EV_SW]  = { sw_strings, SW_CNT },
+    [EV_LED] = { led_strings, LED_CNT },
+    [EV_SND] = { snd_strings, SND_CNT },
+    [EV_REP] = { rep_strings, REP_CNT },
+};
+
 void evdev_print_caps(i32 fd)
 {
     u64 ev_bits[u_nbits(EV_MAX)];
@@ -57,16 +68,19 @@ void evdev_print_caps(i32 fd)
             continue;
         }
 
-        u64 bits[sizeof(union ev_bits_max_size__)];
-        if (ioctl(fd, EVIOCGBIT(i, ev_max_vals[i]), bits) < 0) {
+        const u32 n_codes = ev_code_strings[i].n_codes;
+        u64 bits[u_nbits(KEY_CNT)] = { 0 };
+        if (ioctl(fd, EVIOCGBIT(i, u_nbits(n_codes) * sizeof(u64)), bits) < 0) {
             s_log_error("Failed to get event bits from fd %i for %s: %s",
                 fd, ev_type_strings[i], strerror(errno));
             return;
         }
 
-        for (u32 j = 0; j < ev_max_vals[i]; j++) {
-            if (bits[j / 64] & (1ULL << (u64)(j % 64)))
-                printf("-- %s (%#x)\n", ev_strings[i][j], j);
+        for (u32 j = 0; j < n_codes; j++) {
+            if (bits[j / 64] & (1ULL << (u64)(j % 64))) {
+                const char *str = ev_code_strings[i].strings[j];
+                printf("-- %s (%#x)\n", str ? str : "?", j);
+            }
         }
         printf("\n");
     }
@@ -1,360 +1,793 @@
 #define _GNU_SOURCE
-#include "cfg.h"
 #define P_INTERNAL_GUARD__
 #include "evdev.h"
 #undef P_INTERNAL_GUARD__
+#include "cfg.h"
 #include "kbddev.h"
 #include "monitor.h"
+#include "ptime.h"
+#include "scheduler.h"
+#include "event-loop.h"
+#include "activity.h"
+#include "analog.h"
+#include "evdev-source.h"
+#include "recording.h"
+#include "replay.h"
+#include "stats.h"
+#include "device-registry.h"
 #include <core/int.h>
 #include <core/log.h>
 #include <core/util.h>
+#include <core/arena.h>
 #include <core/vector.h>
 #include <core/buildtype.h>
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdatomic.h>
 #include <signal.h>
-#include <poll.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <linux/input.h>
 #include <linux/input-event-codes.h>
 
 #define MODULE_NAME "main"
 
-static i32 init_signal_handler(void);
-static void signal_handler(i32 sig_num);
-static atomic_flag running = ATOMIC_FLAG_INIT;
+/* The maximal number of events read from a device with a single syscall */
+#define DEVICE_READ_BATCH_SIZE 64
+
+/* The maximal number of fake keypresses queued in the event loop
+ * with a single write */
+#define PULSES_PER_QUEUED_WRITE 32
+
+/* The most text that a dump of the statistics can take */
+#define STATS_TEXT_MAX_SIZE (STATS_TEXT_GLOBAL_MAX_SIZE + \
+    DEVICE_REGISTRY_MAX_DEVICES * STATS_TEXT_DEVICE_MAX_SIZE)
+
+#define MAIN_ARENA_SIZE (DEVICE_REGISTRY_ARENA_SIZE + STATS_TEXT_MAX_SIZE)
+
+struct main_ctx {
+    struct cfg cfg;
+    kbddev_t fake_keyboard;
+    struct evdev_monitor mon;
+    struct emit_scheduler sched;
+
+    struct event_loop loop;
+    struct event_loop_source mon_src;
+    struct event_loop_source sched_src;
+    struct event_loop_source signal_src;
+
+    /* Everything that's needed after startup is allocated from here up front
+     * (the device registry), and the text of the statistics is formatted
+     * above that, so that nothing is allocated while the daemon is running */
+    struct arena arena;
+    bool arena_initialized;
+
+    /* Devices removed while handling a batch of ready sources
+     * may still appear later in the same batch, so their slots
+     * are only reused once the whole batch is handled */
+    struct device_registry devices;
+    bool devices_initialized;
+
+    /* Reused for all device reads */
+    struct input_event read_buf[DEVICE_READ_BATCH_SIZE];
+
+    /* Used to build the fake keypresses that are queued in the event loop */
+    struct input_event pulse_buf[PULSES_PER_QUEUED_WRITE * KBDDEV_PULSE_N_EVENTS];
+
+    /* `--record` */
+    struct recorder recorder;
+    bool recording;
+
+    /* `--replay` */
+    struct replay replay;
+    struct event_loop_source replay_src;
+    bool replaying;
+
+    /* `stats_socket` */
+    struct stats_server stats_server;
+    bool serving_stats;
+
+    bool running;
+};
+
+struct cmdline_args {
+    const char *record_path;
+    const char *replay_path;
+    bool replay_realtime;
+};
+
+static i32 parse_cmdline_args(i32 argc, char **argv,
+    struct cmdline_args *o);
+
+static i32 init_signal_fd(void);
+static i32 handle_signal_event(struct main_ctx *ctx);
+
+static i32 handle_monitor_event(struct main_ctx *ctx);
 
-static i32 handle_monitor_event(struct evdev_monitor *mon,
-    VECTOR(struct evdev) *devices, VECTOR(struct pollfd) *poll_fds);
+static i32 add_device(struct main_ctx *ctx, const struct evdev *evdev);
+static void remove_device(struct main_ctx *ctx, struct device *dev);
 
-static i32 handle_device_event(struct evdev *dev, i32 kbddev_fd,
-    u16 fake_keypress_keycode);
-static i32 write_fake_event(i32 fd, u16 key_code);
+static i32 handle_device_event(struct main_ctx *ctx, struct device *dev,
+    u32 *o_n_activity_events);
+static u32 process_device_events(struct main_ctx *ctx, struct device *dev,
+    const struct input_event *events, u32 n_events);
+static void handle_device_disconnect(struct main_ctx *ctx,
+    struct device *dev, u32 events);
 
-#define pollfd_disconnected(pollfd) \
-    (pollfd.revents & POLLERR       \
-    || pollfd.revents & POLLHUP     \
-    || pollfd.revents & POLLNVAL)
+static void send_pulses(struct main_ctx *ctx, u32 n_pulses);
 
-static void handle_fd_disconnect(VECTOR(struct evdev) *devices,
-    VECTOR(struct pollfd) *poll_fds, u32 device_index);
+static char * format_stats(struct main_ctx *ctx, u64 *o_size);
+static void handle_stats_event(struct main_ctx *ctx,
+    struct event_loop_source *src);
+static void record_emit_latency(struct main_ctx *ctx, bool emitted);
+static void log_stats(struct main_ctx *ctx);
 
 static const char *buildtype = NULL;
 
 int main(int argc, char **argv)
 {
-    (void) argc;
-    (void) argv;
     if (buildtype == NULL) buildtype = get_cgd_buildtype__();
 
     i32 ret = EXIT_FAILURE;
+    struct main_ctx ctx = {
+        .fake_keyboard = { .fd = -1, .destroyed__ = true },
+        .mon = { .fd = -1, .destroyed__ = true },
+        .sched = { .timer_fd = -1 },
+        .loop = { .epoll_fd = -1 },
+        .signal_src = { .fd = -1 },
+        .replay = { .timer_fd = -1 },
+    };
+    struct cmdline_args args = { 0 };
+    VECTOR(struct evdev) initial_devices = NULL;
+
     s_configure_log(LOG_INFO, stdout, stderr);
 
-    struct cfg cfg = { 0 };
-    if (read_config(&cfg)) /* On failure, default values will be used */
+    if (parse_cmdline_args(argc, argv, &args))
+        return EXIT_FAILURE;
+
+    if (read_config(&ctx.cfg)) /* On failure, default values will be used */
         s_log_warn("Couldn't read the config properly");
-    s_set_log_level(cfg.log_level);
+    s_set_log_level(ctx.cfg.log_level);
+
+    struct evdev_source source = {
+        .type = ctx.cfg.input_source,
+        .emulated_type = EVDEV_TYPE_PS4_CONTROLLER,
+    };
+    memcpy(source.root_dir, ctx.cfg.input_dir, sizeof(filepath_t));
+    if (args.replay_path != NULL) {
+        /* Only the devices from the recording */
+        source.type = EVDEV_SOURCE_EMULATED;
+        source.root_dir[0] = '\0';
+    }
+    evdev_source_set(&source);
+
+    if (args.replay_path != NULL) {
+        if (replay_init(&ctx.replay, args.replay_path, args.replay_realtime))
+            goto_error("Failed to start the replay. Stop.");
+        ctx.replaying = true;
+    }
+    if (args.record_path != NULL) {
+        if (recorder_init(&ctx.recorder, args.record_path))
+            goto_error("Failed to start the recording. Stop.");
+        ctx.recording = true;
+    }
 
-    if (init_signal_handler())
+    if (event_loop_init(&ctx.loop, ctx.cfg.event_loop_backend))
+        goto_error("Failed to initialize the event loop. Stop.");
+
+    ctx.signal_src = (struct event_loop_source) {
+        .fd = init_signal_fd(),
+        .type = EVENT_LOOP_SOURCE_SIGNAL,
+    };
+    if (ctx.signal_src.fd == -1)
         goto_error("Failed to initialize the signal handler. Stop.");
+    if (event_loop_add(&ctx.loop, &ctx.signal_src, EPOLLIN))
+        goto_error("Failed to register the signal fd. Stop.");
+
+    if (ctx.cfg.stats_socket[0] != '\0') {
+        if (stats_server_init(&ctx.stats_server, ctx.cfg.stats_socket,
+                &ctx.loop))
+            goto_error("Failed to create the stats socket. Stop.");
+        ctx.serving_stats = true;
+    }
 
-    kbddev_t fake_keyboard = { 0 };
-    if (kbddev_init(&fake_keyboard, cfg.fake_keypress_keycode))
+    if (ctx.cfg.fake_keyboard_output[0] != '\0') {
+        if (kbddev_init_file(&ctx.fake_keyboard, ctx.cfg.fake_keyboard_output,
+                ctx.cfg.fake_keypress_keycode))
+            goto_error("Couldn't open the fake keyboard output. Stop.");
+    } else if (kbddev_init(&ctx.fake_keyboard, ctx.cfg.fake_keypress_keycode)) {
         goto_error("Couldn't initialize the fake keyboard device. Stop.");
+    }
 
-    VECTOR(struct evdev) devices =
-        evdev_find_and_load_devices(EVDEV_MASK_PS4_CONTROLLER);
-    if (devices == NULL)
+    if (emit_scheduler_init(&ctx.sched, ctx.cfg.emit_mode,
+            ctx.cfg.emit_throttle_ms, ctx.cfg.idle_timeout_ms,
+            ctx.cfg.emit_deadline_margin_ms, ctx.cfg.emit_leading_edge_idle_ms))
+        goto_error("Failed to initialize the emit scheduler. Stop.");
+    if (ctx.sched.timer_fd != -1) {
+        ctx.sched_src = (struct event_loop_source) {
+            .fd = ctx.sched.timer_fd,
+            .type = EVENT_LOOP_SOURCE_TIMER,
+        };
+        if (event_loop_add(&ctx.loop, &ctx.sched_src, EPOLLIN))
+            goto_error("Failed to register the scheduler timer. Stop.");
+    }
+
+    if (arena_init(&ctx.arena, MAIN_ARENA_SIZE))
+        goto_error("Failed to allocate the memory. Stop.");
+    ctx.arena_initialized = true;
+
+    if (device_registry_init(&ctx.devices, &ctx.arena))
+        goto_error("Failed to initialize the device registry. Stop.");
+    ctx.devices_initialized = true;
+
+    initial_devices = evdev_find_and_load_devices(EVDEV_MASK_PS4_CONTROLLER);
+    if (initial_devices == NULL)
         goto_error("Error while loading active event devices. Stop.");
-    s_log_info("Loaded %u event device(s)", vector_size(devices));
+    for (u32 i = 0; i < vector_size(initial_devices); i++) {
+        if (add_device(&ctx, &initial_devices[i]))
+            evdev_destroy(&initial_devices[i]);
+    }
+    /* The evdevs are now owned by `ctx.devices` */
+    vector_destroy(&initial_devices);
+    s_log_info("Loaded %u event device(s)",
+        device_registry_count(&ctx.devices));
 
-    struct evdev_monitor mon = { 0 };
-    if (evdev_monitor_init(&mon))
+    if (evdev_monitor_init(&ctx.mon))
         goto_error("Failed to initialize the evdev monitor. Stop.");
-
-    VECTOR(struct pollfd) global_poll_fds = vector_new(struct pollfd);
-    vector_reserve(global_poll_fds, 1 + vector_size(devices));
-    /* Init the monitor pollfd */
-    vector_push_back(global_poll_fds, (struct pollfd) {
-        .fd = mon.fd,
-        .events = POLLIN,
-    });
-
-    /* Init the device pollfds */
-    for (u32 i = 0; i < vector_size(devices); i++) {
-        vector_push_back(global_poll_fds, (struct pollfd) {
-            .fd = devices[i].fd,
-            .events = POLLIN,
-        });
+    if (ctx.replaying) {
+        ctx.replay_src = (struct event_loop_source) {
+            .fd = ctx.replay.timer_fd,
+            .type = EVENT_LOOP_SOURCE_REPLAY,
+        };
+        if (event_loop_add(&ctx.loop, &ctx.replay_src, EPOLLIN))
+            goto_error("Failed to register the replay timer. Stop.");
     }
 
-    (void) atomic_flag_test_and_set(&running);
-    while (atomic_flag_test_and_set(&running)) {
-        /* Block until either a monitor or device event occurs */
-        i32 ret = poll(global_poll_fds, vector_size(global_poll_fds), -1);
-        if (ret == -1) {
-            if (errno == EINTR) { /* Interrupted by signal, try again */
-                continue;
-            } else {
-                goto_error("Failed to poll on monitor and devices: %s",
-                    strerror(errno));
+    ctx.mon_src = (struct event_loop_source) {
+        .fd = ctx.mon.fd,
+        .type = EVENT_LOOP_SOURCE_MONITOR,
+    };
+    if (event_loop_add(&ctx.loop, &ctx.mon_src, EPOLLIN))
+        goto_error("Failed to register the monitor fd. Stop.");
+
+    ctx.running = true;
+    while (ctx.running) {
+        /* Block until either a monitor, device, timer or signal event occurs */
+        const i32 n_ready = event_loop_wait(&ctx.loop, -1);
+        if (n_ready < 0)
+            goto_error("Failed to wait for events. Stop.");
+        stats_add_global(STATS_WAKEUPS, 1);
+
+        u32 n_pulses = 0;
+        u32 n_activity_events = 0;
+        for (i32 i = 0; i < n_ready; i++) {
+            const struct event_loop_ready *ready =
+                event_loop_get_ready(&ctx.loop, i);
+            struct event_loop_source *src = ready->src;
+            const u32 events = ready->events;
+
+            switch (src->type) {
+            case EVENT_LOOP_SOURCE_SIGNAL:
+                if (handle_signal_event(&ctx))
+                    goto_error("Failed to handle a signal. Stop.");
+                break;
+            case EVENT_LOOP_SOURCE_MONITOR:
+                if (events & (EPOLLERR | EPOLLHUP)) {
+                    /* Something like this should never happen */
+                    s_log_fatal(MODULE_NAME, __func__,
+                        "Error on the monitor file descriptor");
+                }
+                if (handle_monitor_event(&ctx))
+                    goto_error("Failed to handle monitor event. Stop.");
+                break;
+            case EVENT_LOOP_SOURCE_TIMER:
+                n_pulses += emit_scheduler_on_timer(&ctx.sched,
+                    p_time_get_ticks_ms());
+                break;
+            case EVENT_LOOP_SOURCE_REPLAY:
+                if (replay_step(&ctx.replay))
+                    goto_error("Failed to replay the recording. Stop.");
+                break;
+            case EVENT_LOOP_SOURCE_STATS:
+                handle_stats_event(&ctx, src);
+                break;
+            case EVENT_LOOP_SOURCE_DEVICE: {
+                struct device *dev = src->data;
+                if (dev->src.fd == -1) {
+                    /* Already removed while handling this batch */
+                } else if (ready->data != NULL) {
+                    /* The event loop has already read the events for us */
+                    stats_add(&device_registry_info(&ctx.devices, dev)
+                        ->stats.reads, 1);
+                    stats_add_global(STATS_READ_SYSCALLS, 1);
+                    n_activity_events += process_device_events(&ctx, dev,
+                        ready->data,
+                        ready->n_bytes / sizeof(struct input_event));
+                } else if (events & EPOLLIN) {
+                    /* Read whatever is left even if the device
+                     * has just been disconnected */
+                    (void) handle_device_event(&ctx, dev, &n_activity_events);
+                }
+                if (dev->src.fd != -1 && events & (EPOLLERR | EPOLLHUP))
+                    handle_device_disconnect(&ctx, dev, events);
+                break;
             }
-        }
-
-        i32 n_handled = 0;
-        if (n_handled >= ret) continue;
-
-        /* Check the monitor fd */
-        if (global_poll_fds[0].revents & POLLNVAL) {
-            /* Something like this should never happen */
-            s_log_fatal(MODULE_NAME, __func__,
-                "The monitor device file descriptor became invalid");
-        } else if (global_poll_fds[0].revents & POLLIN) {
-            if (handle_monitor_event(&mon, &devices, &global_poll_fds))
-                goto_error("Failed to handle monitor event. Stop.");
-
-            n_handled++;
-        }
-        if (n_handled >= ret) continue;
-
-        /* Check the device fds */
-        for (u32 i = 1; i < vector_size(global_poll_fds); i++) {
-            if (pollfd_disconnected(global_poll_fds[i])) {
-                handle_fd_disconnect(&devices, &global_poll_fds, i - 1);
-            } else if (global_poll_fds[i].revents & POLLIN) {
-                handle_device_event(&devices[i - 1], fake_keyboard.fd,
-                    cfg.fake_keypress_keycode);
             }
-            n_handled++;
-            if (n_handled >= ret)
-                break;
+        }
+        device_registry_collect(&ctx.devices);
+
+        /* Let the scheduler decide whether the activity is worth reporting */
+        const u32 n_activity_pulses = emit_scheduler_on_activity(&ctx.sched,
+            n_activity_events, p_time_get_ticks_ms());
+        n_pulses += n_activity_pulses;
+        if (n_pulses > 0)
+            send_pulses(&ctx, n_pulses);
+        if (n_activity_events > 0)
+            record_emit_latency(&ctx, n_activity_pulses > 0);
+
+        /* Once everything has been replayed and consumed, we're done */
+        if (ctx.replaying && ctx.replay.finished &&
+            device_registry_count(&ctx.devices) == 0)
+        {
+            const u64 elapsed_us = replay_get_elapsed_us(&ctx.replay);
+            s_log_info("Replay finished: %lu event(s) in %lu us "
+                "(%.0f events/s), %lu fake keypress(es) sent",
+                (unsigned long)ctx.replay.n_events_replayed,
+                (unsigned long)elapsed_us,
+                elapsed_us ? ctx.replay.n_events_replayed * 1e6 / elapsed_us
+                    : 0.0,
+                (unsigned long)stats_get_global(STATS_FAKE_KEYPRESSES));
+            ctx.running = false;
         }
     }
 
     s_log_debug("Exited from the main loop, cleaning up...");
     ret = EXIT_SUCCESS;
 err:
-    atomic_flag_clear(&running);
-    vector_destroy(&global_poll_fds);
-    evdev_monitor_destroy(&mon);
-    evdev_list_destroy(&devices);
-    kbddev_destroy(&fake_keyboard);
+    if (initial_devices != NULL)
+        evdev_list_destroy(&initial_devices);
+    if (ctx.devices_initialized) {
+        while (device_registry_count(&ctx.devices) > 0)
+            remove_device(&ctx, device_registry_at(&ctx.devices, 0));
+        device_registry_destroy(&ctx.devices);
+        ctx.devices_initialized = false;
+    }
+    if (ctx.arena_initialized) {
+        s_log_debug("Used %lu of %lu bytes of the arena",
+            (unsigned long)ctx.arena.high_water, (unsigned long)ctx.arena.size);
+        arena_destroy(&ctx.arena);
+        ctx.arena_initialized = false;
+    }
+    if (ctx.recording) {
+        (void) recorder_destroy(&ctx.recorder);
+        ctx.recording = false;
+    }
+    if (ctx.replaying) {
+        replay_destroy(&ctx.replay);
+        ctx.replaying = false;
+    }
+    evdev_monitor_destroy(&ctx.mon);
+    emit_scheduler_destroy(&ctx.sched);
+    kbddev_destroy(&ctx.fake_keyboard);
+    if (ctx.serving_stats) {
+        stats_server_destroy(&ctx.stats_server);
+        ctx.serving_stats = false;
+    }
+    if (ctx.signal_src.fd != -1) {
+        close(ctx.signal_src.fd);
+        ctx.signal_src.fd = -1;
+    }
+    event_loop_destroy(&ctx.loop);
     s_log_info("Cleanup OK, exiting with code %i", ret);
     return ret;
 }
 
-static i32 init_signal_handler(void)
+static i32 parse_cmdline_args(i32 argc, char **argv,
+    struct cmdline_args *o)
 {
-    struct sigaction sa;
-    sa.sa_handler = signal_handler;
-    sa.sa_flags = 0;
-    sigfillset(&sa.sa_mask);
-    if (sigaction(SIGUSR1, &sa, NULL))
-        goto_error("Failed to register SIGUSR1 handler: %s", strerror(errno));
-    if (sigaction(SIGTERM, &sa, NULL))
-        goto_error("Failed to register SIGTERM handler: %s", strerror(errno));
-    if (sigaction(SIGINT, &sa, NULL))
-        goto_error("Failed to register SIGINT handler: %s", strerror(errno));
+    for (i32 i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            o->record_path = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            o->replay_path = argv[++i];
+        } else if (!strcmp(argv[i], "--realtime")) {
+            o->replay_realtime = true;
+        } else {
+            s_log_error("Invalid argument: \"%s\"", argv[i]);
+            s_log_info("Usage: %s [--record <file>] "
+                "[--replay <file> [--realtime]]", argv[0]);
+            return 1;
+        }
+    }
 
     return 0;
-err:
-    return 1;
 }
 
-static void signal_handler(i32 sig_num)
+static i32 init_signal_fd(void)
 {
-    if (sig_num == SIGUSR1 || sig_num == SIGINT || sig_num == SIGTERM)
-        atomic_flag_clear(&running);
+    sigset_t sigset;
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGUSR1);
+    sigaddset(&sigset, SIGUSR2);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGINT);
+
+    return event_loop_create_signal_fd(&sigset);
+}
+
+static i32 handle_signal_event(struct main_ctx *ctx)
+{
+    struct signalfd_siginfo si;
+    i32 n_bytes_read = 0;
+    while (n_bytes_read = read(ctx->signal_src.fd, &si, sizeof(si)),
+        n_bytes_read == sizeof(si))
+    {
+        switch (si.ssi_signo) {
+        case SIGUSR1: case SIGTERM: case SIGINT:
+            s_log_info("Received signal %u, exiting...", si.ssi_signo);
+            ctx->running = false;
+            break;
+        case SIGUSR2:
+            log_stats(ctx);
+            break;
+        default:
+            s_log_warn("Received unexpected signal %u", si.ssi_signo);
+            break;
+        }
+    }
+
+    if (n_bytes_read == -1 && errno != EAGAIN && errno != EINTR) {
+        s_log_error("Failed to read from the signal fd: %s", strerror(errno));
+        return 1;
+    }
+
+    return 0;
 }
 
-static i32 handle_monitor_event(struct evdev_monitor *mon,
-    VECTOR(struct evdev) *devices, VECTOR(struct pollfd) *poll_fds)
+static i32 handle_monitor_event(struct main_ctx *ctx)
 {
-    VECTOR(char *) created = NULL;
-    VECTOR(char *) deleted = NULL;
-    if (evdev_monitor_read(mon, &created, &deleted))
-        goto_error("Evdev monitor read failed");
-
-    for (u32 i = 0; i < vector_size(created); i++) {
-        struct evdev new_dev = { 0 };
-        if (strncmp(created[i], "event", u_strlen("event"))) {
-            /* Not an evdev */
-        } else if (evdev_load(created[i], &new_dev, EVDEV_MASK_PS4_CONTROLLER))
-            ;//s_log_debug("Failed to load event device %s", created[i]);
-        else {
+    struct evdev_monitor_event ev;
+    i32 ret = 0;
+    while (ret = evdev_monitor_next(&ctx->mon, &ev), ret == 1) {
+        struct device *dev = device_registry_find(&ctx->devices,
+            evdev_source_get_devnum(ev.name, -1));
+
+        if (ev.action == EVDEV_MONITOR_CREATED && dev == NULL) {
+            struct evdev new_dev = { 0 };
+            if (evdev_load(ev.name, &new_dev, EVDEV_MASK_PS4_CONTROLLER))
+                continue;
+
             s_log_info("New device: \"%s\" (%s), type %s",
                 new_dev.name[0] ? new_dev.name : "n/a",
                 new_dev.path, evdev_type_strings[new_dev.type]
             );
-            vector_push_back((*devices), new_dev);
-            vector_push_back((*poll_fds), (struct pollfd) {
-                .fd = new_dev.fd,
-                .events = POLLIN
-            });
+            if (add_device(ctx, &new_dev))
+                evdev_destroy(&new_dev);
+        } else if (ev.action == EVDEV_MONITOR_DELETED && dev != NULL) {
+            /* Devices are usually removed as soon as their fd
+             * reports EPOLLHUP, so this is only a fallback */
+            s_log_info("Removed device: %s", ev.name);
+            remove_device(ctx, dev);
         }
-        u_nfree(&created[i]);
     }
-    vector_destroy(&created);
-
-    for (u32 i = 0; i < vector_size(deleted); i++) {
-        for (u32 j = 0; j < vector_size(*devices); j++) {
-            s_assert(!strncmp((*devices)[j].path,
-                "/dev/input/", u_strlen("/dev/input/")),
-                "Invalid event device path \"%s\"", (*devices)[j].path);
-            if (!strcmp(deleted[i],
-                    (*devices)[j].path + u_strlen("/dev/input/"))
-            ) {
-                s_log_info("Removed device: %s", deleted[i]);
-                evdev_destroy(&((*devices)[j]));
-                vector_erase((*devices), j);
-                /* Skip the first element (the monitor fd) */
-                vector_erase((*poll_fds), j + 1);
-                break;
-            }
-        }
-        u_nfree(&deleted[i]);
+
+    if (ret < 0) {
+        s_log_error("Evdev monitor read failed");
+        return 1;
     }
-    vector_destroy(&deleted);
 
     return 0;
+}
 
-err:
-    if (created != NULL) {
-        for (u32 i = 0; i < vector_size(created); i++)
-            u_nfree(&created[i]);
-        vector_destroy(&created);
+static i32 add_device(struct main_ctx *ctx, const struct evdev *evdev)
+{
+    const char *rel_path = strrchr(evdev->path, '/');
+    rel_path = rel_path != NULL ? rel_path + 1 : evdev->path;
+
+    /* Also catches the devices reported by the monitor
+     * right after they've been found by the initial scan */
+    struct device *dev = device_registry_add(&ctx->devices,
+        evdev_source_get_devnum(rel_path, evdev->fd));
+    if (dev == NULL)
+        return 1;
+    struct device_info *info = device_registry_info(&ctx->devices, dev);
+
+    info->evdev = *evdev;
+    if (ctx->cfg.kernel_event_mask &&
+        activity_set_kernel_event_mask(evdev->fd, ctx->cfg.analog_activity) > 0)
+    {
+        s_log_warn("Failed to install the kernel event mask on %s (\"%s\"), "
+            "falling back to user-space filtering",
+            evdev->path, evdev->name);
     }
-    if (deleted != NULL) {
-        for (u32 i = 0; i < vector_size(deleted); i++)
-            u_nfree(&created[i]);
-        vector_destroy(&created);
+    const struct analog_params analog_params = {
+        .enabled = ctx->cfg.analog_activity,
+        .deadzone_percent = ctx->cfg.analog_deadzone_percent,
+        .hysteresis_percent = ctx->cfg.analog_hysteresis_percent,
+        .recalibrate_ns = ctx->cfg.analog_recalibrate_ms * 1000000,
+    };
+    analog_detector_init(&info->analog, evdev->fd, &analog_params);
+
+    /* Without this, the latency from the kernel can't be measured
+     * (emulated devices don't have kernel timestamps at all) */
+    dev->kernel_timestamps = !evdev_set_clock_monotonic(evdev->fd);
+
+    dev->src = (struct event_loop_source) {
+        .fd = evdev->fd,
+        .type = EVENT_LOOP_SOURCE_DEVICE,
+        .flags = EVENT_LOOP_SOURCE_F_READ,
+        .data = dev,
+    };
+    if (event_loop_add(&ctx->loop, &dev->src, EPOLLIN)) {
+        s_log_error("Failed to register device %s (\"%s\")",
+            evdev->path, evdev->name);
+        /* The caller still owns the evdev */
+        memset(&info->evdev, 0, sizeof(struct evdev));
+        device_registry_remove(&ctx->devices, dev);
+        return 1;
     }
 
-    return 1;
+    if (ctx->recording)
+        dev->recorder_id = recorder_add_device(&ctx->recorder, &info->evdev);
+
+    return 0;
 }
 
-static i32 handle_device_event(struct evdev *dev, i32 kbddev_fd,
-    u16 fake_keypress_keycode)
+static void remove_device(struct main_ctx *ctx, struct device *dev)
 {
-    struct input_event ev;
+    if (ctx->recording)
+        recorder_remove_device(&ctx->recorder, dev->recorder_id);
+
+    event_loop_remove(&ctx->loop, &dev->src);
+    evdev_destroy(&device_registry_info(&ctx->devices, dev)->evdev);
+    device_registry_remove(&ctx->devices, dev);
+}
+
+static i32 handle_device_event(struct main_ctx *ctx, struct device *dev,
+    u32 *o_n_activity_events)
+{
+    struct input_event *buf = ctx->read_buf;
+    struct stats_device *stats = &device_registry_info(&ctx->devices, dev)->stats;
+    const i32 fd = dev->src.fd;
     i32 n_bytes_read = 0;
 
     do {
-        n_bytes_read = read(dev->fd, &ev, sizeof(ev));
+        n_bytes_read = read(fd, buf,
+            DEVICE_READ_BATCH_SIZE * sizeof(struct input_event));
+        stats_add(&stats->reads, 1);
+        stats_add_global(STATS_READ_SYSCALLS, 1);
         if (n_bytes_read == -1 && errno == EINTR) {
             continue; /* Interrupted by signal, try again */
         } else if (n_bytes_read == -1 && errno == EAGAIN) {
             break; /* Non-blocking read would block - no events left */
         } else if (n_bytes_read == -1) {
             s_log_error("Failed to read from fd %i: %s",
-                dev->fd, strerror(errno));
+                fd, strerror(errno));
             return 1;
-        } else if (n_bytes_read == 0) {
-            continue; /* No more events left to read */
-        } else if (n_bytes_read > 0 && n_bytes_read != sizeof(ev)) {
+        } else if (n_bytes_read % sizeof(struct input_event) != 0) {
             s_log_fatal(MODULE_NAME, __func__,
-                "Read %i bytes from event device, expected %i. "
+                "Read %i bytes from event device, "
+                "which is not a multiple of %i. "
                 "The linux input driver is probably broken...",
                 n_bytes_read, sizeof(struct input_event)
             );
-        } else {
-            const bool is_key_press = (ev.type == EV_KEY ||
-                (ev.type == EV_ABS &&
-                    (ev.code == ABS_HAT0X || ev.code == ABS_HAT0Y)
-                )
-            );
-            if (!is_key_press)
-                continue;
-
-            if (write_fake_event(kbddev_fd, fake_keypress_keycode))
-                return 1;
         }
-    } while (n_bytes_read > 0);
+
+        *o_n_activity_events += process_device_events(ctx, dev, buf,
+            n_bytes_read / sizeof(struct input_event));
+
+        /* A short read means that the kernel buffer is drained,
+         * so there's no need for another syscall just to get EAGAIN */
+    } while (n_bytes_read == DEVICE_READ_BATCH_SIZE * sizeof(struct input_event)
+        || (n_bytes_read == -1 && errno == EINTR));
 
     return 0;
 }
 
-static i32 write_fake_event(i32 fd, u16 key_code)
+static u32 process_device_events(struct main_ctx *ctx, struct device *dev,
+    const struct input_event *events, u32 n_events)
 {
-    /* Key down */
-    struct timeval time;
-    (void) gettimeofday(&time, NULL);
-    struct input_event press_ev = {
-        .type = EV_KEY,
-        .code = key_code,
-        .value = 1,
-        .time = time,
-    };
-    if (write(fd, &press_ev, sizeof(struct input_event)) < 0) {
-        s_log_error("Failed to write fake event to fd %i: %s",
-            fd, strerror(errno));
-        return 1;
-    }
+    if (ctx->recording)
+        recorder_write_events(&ctx->recorder, dev->recorder_id,
+            events, n_events);
+
+    /* The events are filtered here even if a kernel event mask
+     * is installed, in case it isn't supported */
+    struct device_info *info = device_registry_info(&ctx->devices, dev);
+    struct stats_device *stats = &info->stats;
+    const u64 now_ns = p_time_get_ticks_ns();
+    u32 n_activity_events = 0;
+    u32 n_syn_dropped = 0;
+    for (u32 i = 0; i < n_events; i++) {
+        const struct input_event *ev = &events[i];
+        if (dev->kernel_timestamps) {
+            const u64 ev_ns = (u64)ev->input_event_sec * 1000000000
+                + (u64)ev->input_event_usec * 1000;
+            if (now_ns > ev_ns) {
+                histogram_record(&stats->kernel_to_read_ns, now_ns - ev_ns);
+                histogram_record(&g_stats.kernel_to_read_ns, now_ns - ev_ns);
+            }
+        }
 
-    /* Key up */
-    (void) gettimeofday(&time, NULL);
-    struct input_event release_ev = {
-        .type = EV_KEY,
-        .code = key_code,
-        .value = 0,
-        .time = time,
-    };
-    if (write(fd, &release_ev, sizeof(struct input_event)) < 0) {
-        s_log_error("Failed to write fake event to fd %i: %s",
-            fd, strerror(errno));
-        return 1;
+        if (activity_is_relevant_event(ev) || (ev->type == EV_ABS &&
+            analog_detector_feed(&info->analog, ev->code, ev->value, now_ns)))
+        {
+            if (dev->activity_read_ns == 0)
+                dev->activity_read_ns = now_ns;
+            n_activity_events++;
+            continue;
+        }
+
+        if (ev->type < EV_CNT)
+            stats_add(&stats->filtered_by_type[ev->type], 1);
+        if (ev->type == EV_SYN && ev->code == SYN_DROPPED)
+            n_syn_dropped++;
     }
 
-    /* SYN report */
-    (void) gettimeofday(&time, NULL);
-    struct input_event syn_ev = {
-        .type = EV_SYN,
-        .code = SYN_REPORT,
-        .value = 0,
-        .time = time,
-    };
-    if (write(fd, &syn_ev, sizeof(struct input_event)) < 0) {
-        s_log_error("Failed to write fake event to fd %i: %s",
-            fd, strerror(errno));
-        return 1;
+    stats_add(&stats->events_read, n_events);
+    stats_add_global(STATS_EVENTS_READ, n_events);
+    stats_add_global(STATS_EVENTS_FILTERED, n_events - n_activity_events);
+    if (n_syn_dropped > 0) {
+        stats_add(&stats->syn_dropped, n_syn_dropped);
+        stats_add_global(STATS_SYN_DROPPED, n_syn_dropped);
     }
 
-    return 0;
+    return n_activity_events;
 }
 
-static void handle_fd_disconnect(VECTOR(struct evdev) *devices,
-    VECTOR(struct pollfd) *poll_fds, u32 device_index)
+static void handle_device_disconnect(struct main_ctx *ctx,
+    struct device *dev, u32 events)
 {
-    /* "di" - device index, "pi" - pollfd index */
-    const u32 di = device_index;
-    const u32 pi = device_index + 1; /* skip the monitor pollfd */
+    const struct evdev *evdev = &device_registry_info(&ctx->devices, dev)->evdev;
 
     /* Some kind of error occured on the fd
      * (this usually happens when the device is normally disconnected,
      * so nothing to worry about really) */
-    s_log_debug("vector_size(poll_fds) = %u", vector_size(*poll_fds));
-    if ((*poll_fds)[pi].revents & POLLERR) {
+    if (events & EPOLLERR) {
         s_log_info("Error on file descriptor %i (device %s - \"%s\"), "
             "disconnecting...",
-            (*poll_fds)[pi].fd, (*devices)[di].path, (*devices)[di].name);
+            dev->src.fd, evdev->path, evdev->name);
     }
     /* The device just disconnected, nothing super unusual */
-    if ((*poll_fds)[pi].revents & POLLHUP) {
+    if (events & EPOLLHUP) {
         s_log_info("File descriptor %i (device %s - \"%s\") disconnected",
-            (*poll_fds)[pi].fd, (*devices)[di].path, (*devices)[di].name);
+            dev->src.fd, evdev->path, evdev->name);
+    }
+
+    remove_device(ctx, dev);
+}
+
+static void send_pulses(struct main_ctx *ctx, u32 n_pulses)
+{
+    stats_add_global(STATS_FAKE_KEYPRESSES, n_pulses);
+
+    if (ctx->loop.backend != EVENT_LOOP_BACKEND_IO_URING) {
+        (void) kbddev_send_pulses(&ctx->fake_keyboard, n_pulses);
+        return;
+    }
+
+    /* Queue the writes, so that they're submitted together
+     * with everything else on the next wait */
+    while (n_pulses > 0) {
+        const u32 n = n_pulses > PULSES_PER_QUEUED_WRITE ?
+            PULSES_PER_QUEUED_WRITE : n_pulses;
+        kbddev_fill_pulses(&ctx->fake_keyboard, ctx->pulse_buf, n);
+        stats_add_global(STATS_WRITE_SYSCALLS, 1);
+        if (event_loop_write(&ctx->loop, ctx->fake_keyboard.fd, ctx->pulse_buf,
+                n * KBDDEV_PULSE_N_EVENTS * sizeof(struct input_event)))
+        {
+            s_log_error("Failed to queue %u fake keypress(es)", n_pulses);
+            stats_add_global(STATS_WRITE_FAILURES, 1);
+            return;
+        }
+        n_pulses -= n;
+    }
+}
+
+/* Returns the text dump of all the statistics, formatted at the top of
+ * `ctx->arena` (which should be rewound once the text is no longer needed),
+ * or NULL on failure */
+static char * format_stats(struct main_ctx *ctx, u64 *o_size)
+{
+    const u64 start = arena_mark(&ctx->arena);
+
+    /* An empty string, for the rest of the text to be appended to */
+    char *text = arena_printf(&ctx->arena, "%s", "");
+    if (text == NULL || stats_write_global(&ctx->arena))
+        goto err;
+    for (u32 i = 0; i < device_registry_count(&ctx->devices); i++) {
+        const struct device *dev = device_registry_at(&ctx->devices, i);
+        const struct device_info *info =
+            device_registry_info(&ctx->devices, dev);
+        if (stats_write_device(&ctx->arena, dev->slot, info->evdev.path,
+                info->evdev.name, &info->stats))
+            goto err;
     }
-    /* The fd is invalid (most likely a race condition/use-after-free) */
-    if ((*poll_fds)[pi].revents & POLLNVAL) {
-        s_log_fatal(MODULE_NAME, __func__,
-            "File descriptor %i (device %s - \"%s\") became invalid",
-            (*poll_fds)[pi].fd, (*devices)[di].path, (*devices)[di].name);
+
+    *o_size = arena_mark(&ctx->arena) - start;
+    return text;
+
+err:
+    s_log_error("Failed to format the statistics: out of memory");
+    arena_rewind(&ctx->arena, start);
+    return NULL;
+}
+
+/* Records the latency from the reads of the activity to the fake keypresses
+ * that were just sent for it (if any). With the io_uring backend,
+ * that's only the time at which the write was queued. */
+static void record_emit_latency(struct main_ctx *ctx, bool emitted)
+{
+    /* Activity that didn't cause a keypress right away (e.g. because of
+     * the rate limit) can't be attributed to a later one, so it's dropped */
+    const u64 now_ns = p_time_get_ticks_ns();
+    for (u32 i = 0; i < device_registry_count(&ctx->devices); i++) {
+        struct device *dev = device_registry_at(&ctx->devices, i);
+        if (dev->activity_read_ns == 0)
+            continue;
+
+        if (emitted) {
+            const u64 latency_ns = now_ns - dev->activity_read_ns;
+            histogram_record(
+                &device_registry_info(&ctx->devices, dev)->stats.read_to_emit_ns,
+                latency_ns);
+            histogram_record(&g_stats.read_to_emit_ns, latency_ns);
+        }
+        dev->activity_read_ns = 0;
     }
+}
 
+static void handle_stats_event(struct main_ctx *ctx,
+    struct event_loop_source *src)
+{
+    static const char ok_msg[] = "OK\n";
+
+    struct stats_client *client = NULL;
+    enum stats_request req = STATS_REQUEST_NONE;
+    while (req = stats_server_handle(&ctx->stats_server, src, &client),
+        req != STATS_REQUEST_NONE)
+    {
+        switch (req) {
+        case STATS_REQUEST_DUMP: {
+            const u64 mark = arena_mark(&ctx->arena);
+            u64 size = 0;
+            const char *text = format_stats(ctx, &size);
+            if (text == NULL)
+                break;
 
-    evdev_destroy(&((*devices)[di]));
-    vector_erase((*devices), di);
-    /* Skip the first element (the monitor fd) */
-    vector_erase((*poll_fds), pi);
+            stats_server_reply(&ctx->stats_server, client, text, size);
+            stats_server_reply(&ctx->stats_server, client, "\n", 1);
+            arena_rewind(&ctx->arena, mark);
+            break;
+        }
+        case STATS_REQUEST_RESET:
+            stats_reset_global();
+            for (u32 i = 0; i < device_registry_count(&ctx->devices); i++) {
+                const struct device *dev = device_registry_at(&ctx->devices, i);
+                stats_reset_device(
+                    &device_registry_info(&ctx->devices, dev)->stats);
+            }
+            stats_server_reply(&ctx->stats_server, client,
+                ok_msg, u_strlen(ok_msg));
+            break;
+        default: case STATS_REQUEST_NONE: case STATS_N_REQUESTS:
+            break;
+        }
+    }
+}
+
+static void log_stats(struct main_ctx *ctx)
+{
+    const u64 mark = arena_mark(&ctx->arena);
+    u64 size = 0;
+    char *text = format_stats(ctx, &size);
+    if (text == NULL)
+        return;
+
+    if (size > 0 && text[size - 1] == '\n')
+        text[size - 1] = '\0';
+    s_log_info("Statistics:\n%s", text);
+    arena_rewind(&ctx->arena, mark);
 }
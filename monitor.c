@@ -1,118 +1,105 @@
 #define _GNU_SOURCE
 #include "monitor.h"
-#include "librtld.h"
+#include "evdev-source.h"
 #include <core/int.h>
 #include <core/log.h>
 #include <core/util.h>
 #include <core/vector.h>
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
-#include <stdatomic.h>
 #include <poll.h>
-#include <fcntl.h>
-#include <dirent.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/filter.h>
 #include <linux/limits.h>
+#include <linux/netlink.h>
 
 #define MODULE_NAME "monitor"
 
-#define DEV_INPUT_DIR "/dev/input"
-
-#define LIBUDEV_LIBNAME "udev"
-#define LIBUDEV_FUNCTIONS_LIST                                              \
-    X_(struct udev *, udev_new, void)                                       \
-    X_(struct udev_monitor *, udev_monitor_new_from_netlink,                \
-        struct udev *udev, const char *name                                 \
-    )                                                                       \
-    X_(int, udev_monitor_filter_add_match_subsystem_devtype,                \
-        struct udev_monitor *udev_monitor,                                  \
-        const char *subsystem, const char *devtype                          \
-    )                                                                       \
-    X_(int, udev_monitor_enable_receiving,                                  \
-        struct udev_monitor *udev_monitor                                   \
-    )                                                                       \
-    X_(int, udev_monitor_get_fd, struct udev_monitor *udev_monitor)         \
-    X_(struct udev_device *, udev_monitor_receive_device,                   \
-        struct udev_monitor *udev_monitor                                   \
-    )                                                                       \
-    X_(const char *, udev_device_get_devnode,                               \
-        struct udev_device *udev_device                                     \
-    )                                                                       \
-    X_(const char *, udev_device_get_action,                                \
-        struct udev_device *udev_device                                     \
-    )                                                                       \
-    /* All udev_*_unref() functions always return `NULL` */                 \
-    X_(struct udev_device *, udev_device_unref,                             \
-        struct udev_device *udev_device                                     \
-    )                                                                       \
-    X_(struct udev_monitor *, udev_monitor_unref,                           \
-        struct udev_monitor *udev_monitor                                   \
-    )                                                                       \
-    X_(struct udev *, udev_unref, struct udev *udev)                        \
-
-
-#define X_(ret_type, name, ...) \
-    union { ret_type (*name)(__VA_ARGS__); void *_voidp_##name; };
-struct libudev_functions {
-    LIBUDEV_FUNCTIONS_LIST
-};
-#undef X_
-
-#define X_(ret_type, name, ...) #name,
-static const char *const libudev_symnames[] = {
-    LIBUDEV_FUNCTIONS_LIST
-    NULL
-};
-#undef X_
-
-static struct p_lib *g_libudev_handle = NULL;
-static struct libudev_functions udev = { 0 };
-static pthread_mutex_t g_libudev_mutex = PTHREAD_MUTEX_INITIALIZER;
-static _Atomic u32 g_n_active_handles = 0;
-
-static i32 load_libudev(void);
-static void unload_libudev(void);
+/* The kernel's `UEVENT_BUFFER_SIZE` - no uevent is ever longer */
+#define UEVENT_BUF_SIZE 2048
+
+/* The multicast group of the uevents sent by the kernel itself
+ * (as opposed to the ones re-broadcast by udev) */
+#define UEVENT_GROUP_KERNEL 1
+
+/* The kernel always starts a uevent with the header "<action>@<devpath>",
+ * followed by "ACTION=<action>", "DEVPATH=<devpath>" and "SUBSYSTEM=...",
+ * all NUL-terminated, so with a header `H` bytes long (with the NUL),
+ * the subsystem is always at the offset `2 * H + 15`.
+ *
+ * Classic BPF has no loops, so the socket filter tries every header length
+ * that an event device can have, checking the last word of
+ * `UEVENT_FILTER_MATCH` (3 instructions per length). The uevents that
+ * pass are still checked by `parse_uevent`, as are those with longer
+ * headers (which are let through). */
+#define UEVENT_FILTER_MATCH "SUBSYSTEM=input"
+#define UEVENT_FILTER_SUBSYSTEM_OFFSET(header_len) (2 * (header_len) + 15)
+
+#define UEVENT_FILTER_MIN_HEADER_LEN 32
+#define UEVENT_FILTER_MAX_HEADER_LEN 288
+#define UEVENT_FILTER_BLOCK_LEN 3
+#define UEVENT_FILTER_LEN ((UEVENT_FILTER_MAX_HEADER_LEN -                  \
+        UEVENT_FILTER_MIN_HEADER_LEN) * UEVENT_FILTER_BLOCK_LEN + 1)
+static_assert(UEVENT_FILTER_LEN <= BPF_MAXINSNS,
+    "The uevent socket filter is too long");
+
+#define UEVENT_INPUT_DEVNAME_PREFIX "input/"
+
+static struct sock_filter g_uevent_filter[UEVENT_FILTER_LEN];
+static pthread_once_t g_uevent_filter_once = PTHREAD_ONCE_INIT;
+
+static i32 netlink_monitor_init(struct evdev_monitor *o);
+static i32 netlink_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event);
+static void build_uevent_filter(void);
+static bool parse_uevent(const char *buf, u32 len,
+    struct evdev_monitor_event *o_event);
+static bool in_user_namespace(void);
+
+static i32 inotify_monitor_init(struct evdev_monitor *o);
+static i32 inotify_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event);
 
 i32 evdev_monitor_init(struct evdev_monitor *o)
 {
     u_check_params(o != NULL);
     o->destroyed__ = false;
+    o->fd = -1;
+    o->inotify_buf_offset = o->inotify_buf_len = 0;
+
+    if (!evdev_source_is_default())
+        return inotify_monitor_init(o);
+
+    /* The kernel only broadcasts the uevents to the network namespaces
+     * owned by the initial user namespace */
+    if (in_user_namespace()) {
+        s_log_info("Running in a user namespace, "
+            "falling back to watching the device directory");
+        return inotify_monitor_init(o);
+    }
 
-    u32 tmp_n_active_handles = atomic_load(&g_n_active_handles);
-    if (tmp_n_active_handles == 0 && load_libudev() != 0)
-        goto_error("Couldn't load libudev");
-
-    tmp_n_active_handles++;
-    atomic_store(&g_n_active_handles, tmp_n_active_handles);
-
-    o->udev = udev.udev_new();
-    if (o->udev == NULL)
-        goto_error("Failed to create the udev context");
-
-    o->mon = udev.udev_monitor_new_from_netlink(o->udev, "udev");
-    if (o->mon == NULL)
-        goto_error("Failed to create the udev monitor");
-
-    i32 ret = udev.udev_monitor_filter_add_match_subsystem_devtype(o->mon,
-        "input", NULL);
-    if (ret != 0)
-        goto_error("Failed to set the filter in udev: %s", strerror(ret));
-
-    ret = udev.udev_monitor_enable_receiving(o->mon);
-    if (ret != 0)
-        goto_error("Failed to enable udev events: %s", strerror(ret));
-
-    o->fd = udev.udev_monitor_get_fd(o->mon);
-    if (o->fd < 0)
-        goto_error("Failed to get the udev fd: %s", strerror(o->fd));
+    if (netlink_monitor_init(o)) {
+        s_log_warn("Failed to open the uevent socket, "
+            "falling back to watching the device directory");
+        return inotify_monitor_init(o);
+    }
 
-    s_log_debug("Initialized a udev monitor with fd %i", o->fd);
     return 0;
+}
 
-err:
-    evdev_monitor_destroy(o);
-    return 1;
+i32 evdev_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event)
+{
+    u_check_params(mon != NULL && !mon->destroyed__ && o_event != NULL);
+
+    if (mon->type == EVDEV_MONITOR_INOTIFY)
+        return inotify_monitor_next(mon, o_event);
+    else
+        return netlink_monitor_next(mon, o_event);
 }
 
 i32 evdev_monitor_poll_and_read(struct evdev_monitor *mon, i32 delay_sec,
@@ -156,58 +143,34 @@ i32 evdev_monitor_read(struct evdev_monitor *mon,
     VECTOR(char *) deleted = NULL;
     if (o_deleted != NULL) deleted = vector_new(char *);
 
-    struct udev_device *dev = NULL;
-    char *duped_path = NULL;
-    while (dev = udev.udev_monitor_receive_device(mon->mon), dev != NULL) {
-        const char *path = udev.udev_device_get_devnode(dev);
-        if (path == NULL) { /* A sysfs entry with no device node */
-            (void) udev.udev_device_unref(dev);
-            dev = NULL;
+    struct evdev_monitor_event ev;
+    i32 ret = 0;
+    while (ret = evdev_monitor_next(mon, &ev), ret == 1) {
+        VECTOR(char *) *target_p = ev.action == EVDEV_MONITOR_CREATED ?
+            &created : &deleted;
+        if (*target_p == NULL)
             continue;
-        }
 
-        /* Strip off the `/dev/input/` prefix */
-        if (strncmp(path, "/dev/input/", u_strlen("/dev/input/")))
-            goto_error("Invalid evdev path received: %s", path);
-
-        duped_path = strdup(path + u_strlen("/dev/input/"));
+        char *duped_path = strdup(ev.name);
         s_assert(duped_path != NULL, "Failed to duplicate string");
-
-        const char *action = udev.udev_device_get_action(dev);
-        if (action == NULL)
-            goto_error("Failed to get action performed on udev device");
-
-        if (!strcmp(action, "add")) {
-            if (created != NULL) vector_push_back(created, duped_path);
-            else u_nfree(&duped_path);
-        } else if (!strcmp(action, "remove")) {
-            if (deleted != NULL) vector_push_back(deleted, duped_path);
-            else u_nfree(&duped_path);
-        }
-
-        (void) udev.udev_device_unref(dev);
-        dev = NULL;
+        vector_push_back(*target_p, duped_path);
     }
+    if (ret < 0)
+        goto err;
 
     if (o_created != NULL) *o_created = created;
     if (o_deleted != NULL) *o_deleted = deleted;
     return 0;
 
 err:
-    if (duped_path != NULL)
-        u_nfree(&duped_path);
-    if (dev != NULL) {
-        (void) udev.udev_device_unref(dev);
-        dev = NULL;
-    }
     if (created != NULL) {
         for (u32 i = 0; i < vector_size(created); i++)
-            free(&created[i]);
+            u_nfree(&created[i]);
         vector_destroy(&created);
     }
     if (deleted != NULL) {
         for (u32 i = 0; i < vector_size(deleted); i++)
-            free(&deleted[i]);
+            u_nfree(&deleted[i]);
         vector_destroy(&deleted);
     }
 
@@ -221,62 +184,265 @@ void evdev_monitor_destroy(struct evdev_monitor *mon)
     if (mon == NULL || mon->destroyed__)
         return;
 
-    s_log_debug("Destroying udev monitor...");
-    /* Both udev_..._unref functions always return NULL */
-    if (mon->mon != NULL) {
-        (void) udev.udev_monitor_unref(mon->mon);
-        mon->mon = NULL;
+    s_log_debug("Destroying %s monitor...",
+        mon->type == EVDEV_MONITOR_INOTIFY ? "inotify" : "uevent");
+    if (mon->fd != -1) {
+        close(mon->fd);
+        mon->fd = -1;
     }
-    if (mon->udev != NULL) {
-        (void) udev.udev_unref(mon->udev);
-        mon->udev = NULL;
+    mon->inotify_buf_offset = mon->inotify_buf_len = 0;
+    mon->destroyed__ = true;
+}
+
+static i32 netlink_monitor_init(struct evdev_monitor *o)
+{
+    o->type = EVDEV_MONITOR_NETLINK;
+
+    o->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        NETLINK_KOBJECT_UEVENT);
+    if (o->fd == -1)
+        goto_error("Failed to create the uevent socket: %s", strerror(errno));
+
+    (void) pthread_once(&g_uevent_filter_once, build_uevent_filter);
+    const struct sock_fprog prog = {
+        .len = UEVENT_FILTER_LEN,
+        .filter = g_uevent_filter,
+    };
+    if (setsockopt(o->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+        /* Not fatal - every uevent is still checked by `parse_uevent` */
+        s_log_warn("Failed to attach the uevent filter (%s), "
+            "all uevents will be received", strerror(errno));
     }
 
-    mon->fd = -1;
+    const struct sockaddr_nl addr = {
+        .nl_family = AF_NETLINK,
+        .nl_groups = UEVENT_GROUP_KERNEL,
+    };
+    if (bind(o->fd, (const struct sockaddr *)&addr, sizeof(addr)))
+        goto_error("Failed to bind the uevent socket: %s", strerror(errno));
 
-    u32 tmp_n_active_handles = atomic_load(&g_n_active_handles);
-    tmp_n_active_handles--;
-    atomic_store(&g_n_active_handles, tmp_n_active_handles);
-    if (tmp_n_active_handles == 0)
-        unload_libudev();
+    s_log_debug("Initialized a uevent monitor with fd %i", o->fd);
+    return 0;
 
-    mon->destroyed__ = true;
+err:
+    if (o->fd != -1) {
+        close(o->fd);
+        o->fd = -1;
+    }
+    return 1;
 }
 
-static i32 load_libudev(void)
+static i32 netlink_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event)
 {
-    pthread_mutex_lock(&g_libudev_mutex);
-    if (g_libudev_handle == NULL) {
-        s_assert(atomic_load(&g_n_active_handles) == 0,
-            "%u monitor handles active while libudev isn't loaded",
-            g_n_active_handles);
-
-        g_libudev_handle = p_librtld_load(LIBUDEV_LIBNAME, libudev_symnames);
-        if (g_libudev_handle == NULL)
+    char buf[UEVENT_BUF_SIZE + 1];
+    struct sockaddr_nl sender;
+    struct iovec iov = { .iov_base = buf, .iov_len = UEVENT_BUF_SIZE };
+
+    while (true) {
+        struct msghdr msg = {
+            .msg_name = &sender,
+            .msg_namelen = sizeof(sender),
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+        };
+        const i64 n_bytes_read = recvmsg(mon->fd, &msg, 0);
+        if (n_bytes_read == -1 && errno == EINTR) {
+            continue;
+        } else if (n_bytes_read == -1 && errno == EAGAIN) {
+            return 0;
+        } else if (n_bytes_read == -1 && errno == ENOBUFS) {
+            s_log_warn("The uevent socket overflowed, "
+                "some devices may have been missed");
+            continue;
+        } else if (n_bytes_read == -1) {
+            s_log_error("Failed to receive from the uevent socket: %s",
+                strerror(errno));
+            return -1;
+        }
+
+        /* Only the kernel itself can be trusted */
+        if (msg.msg_namelen != sizeof(sender) || sender.nl_pid != 0 ||
+            (msg.msg_flags & MSG_TRUNC))
+        {
+            continue;
+        }
+
+        buf[n_bytes_read] = '\0';
+        if (parse_uevent(buf, n_bytes_read, o_event))
             return 1;
+    }
+}
+
+static void build_uevent_filter(void)
+{
+    /* `BPF_LD | BPF_W` loads are big-endian */
+    const u32 match_offset = sizeof(UEVENT_FILTER_MATCH) - 4;
+    const u8 *b = (const u8 *)UEVENT_FILTER_MATCH + match_offset;
+    const u32 match_word =
+        (u32)b[0] << 24 | (u32)b[1] << 16 | (u32)b[2] << 8 | b[3];
+
+    /* A load past the end of the packet drops it, so the search
+     * stops by itself at the end of a short uevent */
+    struct sock_filter *insn = g_uevent_filter;
+    for (u32 len = UEVENT_FILTER_MIN_HEADER_LEN;
+        len < UEVENT_FILTER_MAX_HEADER_LEN; len++)
+    {
+        const u32 n_left = g_uevent_filter + UEVENT_FILTER_LEN - insn;
+        *insn++ = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+            UEVENT_FILTER_SUBSYSTEM_OFFSET(len) + match_offset);
+        *insn++ = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, match_word, 0, 1);
+        /* (Jumps are relative to the next instruction) */
+        *insn++ = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JA,
+            n_left - UEVENT_FILTER_BLOCK_LEN - 1, 0, 0);
+    }
+    *insn++ = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, ~0U);
 
-#define X_(ret_type, name, ...)                                             \
-        udev._voidp_##name = p_librtld_load_sym(g_libudev_handle, #name);   \
-        if (udev._voidp_##name == NULL) return 1;                           \
+    s_assert(insn == g_uevent_filter + UEVENT_FILTER_LEN,
+        "The uevent filter has %li instructions instead of %u",
+        (long)(insn - g_uevent_filter), UEVENT_FILTER_LEN);
+}
+
+/* A uevent is a header ("<action>@<devpath>")
+ * followed by "KEY=value" pairs, all NUL-terminated.
+ * Returns true if it's the creation or deletion of an event device. */
+static bool parse_uevent(const char *buf, u32 len,
+    struct evdev_monitor_event *o_event)
+{
+    if (strchr(buf, '@') == NULL)
+        return false;
+
+    const char *action = NULL, *subsystem = NULL, *devname = NULL;
+    for (const char *p = buf + strlen(buf) + 1; p < buf + len;
+        p += strlen(p) + 1)
+    {
+        if (!strncmp(p, "ACTION=", u_strlen("ACTION=")))
+            action = p + u_strlen("ACTION=");
+        else if (!strncmp(p, "SUBSYSTEM=", u_strlen("SUBSYSTEM=")))
+            subsystem = p + u_strlen("SUBSYSTEM=");
+        else if (!strncmp(p, "DEVNAME=", u_strlen("DEVNAME=")))
+            devname = p + u_strlen("DEVNAME=");
+    }
 
-        LIBUDEV_FUNCTIONS_LIST
-#undef X_
+    if (action == NULL || subsystem == NULL || devname == NULL ||
+        strcmp(subsystem, "input") ||
+        strncmp(devname, UEVENT_INPUT_DEVNAME_PREFIX "event",
+            u_strlen(UEVENT_INPUT_DEVNAME_PREFIX "event")))
+    {
+        return false;
     }
-    pthread_mutex_unlock(&g_libudev_mutex);
+
+    if (!strcmp(action, "add"))
+        o_event->action = EVDEV_MONITOR_CREATED;
+    else if (!strcmp(action, "remove"))
+        o_event->action = EVDEV_MONITOR_DELETED;
+    else
+        return false;
+
+    const char *name = devname + u_strlen(UEVENT_INPUT_DEVNAME_PREFIX);
+    if (strlen(name) >= sizeof(o_event->name))
+        return false;
+    strcpy(o_event->name, name);
+
+    return true;
+}
+
+static bool in_user_namespace(void)
+{
+    FILE *fp = fopen("/proc/self/uid_map", "rb");
+    if (fp == NULL)
+        return false;
+
+    /* The initial user namespace maps all the uids to themselves */
+    unsigned long inside = 0, outside = 0, count = 0;
+    const bool ret = fscanf(fp, "%lu %lu %lu", &inside, &outside, &count) == 3
+        && !(inside == 0 && outside == 0 && count == 0xffffffffUL);
+    fclose(fp);
+
+    return ret;
+}
+
+static i32 inotify_monitor_init(struct evdev_monitor *o)
+{
+    o->type = EVDEV_MONITOR_INOTIFY;
+
+    const char *root_dir = evdev_source_get()->root_dir;
+    o->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (o->fd == -1)
+        goto_error("Failed to create the inotify instance: %s",
+            strerror(errno));
+
+    /* Nothing to watch - all the devices are registered up front */
+    if (root_dir[0] == '\0') {
+        s_log_debug("No directory to monitor");
+        return 0;
+    }
+
+    if (inotify_add_watch(o->fd, root_dir,
+            IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) == -1)
+    {
+        goto_error("Failed to watch \"%s\": %s", root_dir, strerror(errno));
+    }
+
+    s_log_debug("Initialized an inotify monitor for \"%s\" with fd %i",
+        root_dir, o->fd);
     return 0;
+
+err:
+    evdev_monitor_destroy(o);
+    return 1;
 }
 
-static void unload_libudev(void)
+static i32 inotify_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event)
 {
-    pthread_mutex_lock(&g_libudev_mutex);
-    if (g_libudev_handle != NULL) {
-        s_assert(atomic_load(&g_n_active_handles) == 0,
-            "%u monitor handles active while libudev is being unloaded",
-            g_n_active_handles);
-
-        p_librtld_close(&g_libudev_handle);
-        memset(&udev, 0, sizeof(struct libudev_functions));
-        s_log_debug("Unloaded libudev");
+    while (true) {
+        while (mon->inotify_buf_offset < mon->inotify_buf_len) {
+            const struct inotify_event *ev = (const struct inotify_event *)
+                (mon->inotify_buf + mon->inotify_buf_offset);
+            mon->inotify_buf_offset += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                s_log_warn("The inotify queue overflowed, "
+                    "some devices may have been missed");
+                continue;
+            } else if (ev->len == 0 ||
+                strncmp(ev->name, "event", u_strlen("event")))
+            {
+                continue;
+            }
+
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+                o_event->action = EVDEV_MONITOR_CREATED;
+            else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+                o_event->action = EVDEV_MONITOR_DELETED;
+            else
+                continue;
+
+            /* `ev->name` is NUL-terminated and at most `NAME_MAX` long */
+            strncpy(o_event->name, ev->name, sizeof(o_event->name) - 1);
+            o_event->name[sizeof(o_event->name) - 1] = '\0';
+            return 1;
+        }
+
+        const i64 n_bytes_read = read(mon->fd, mon->inotify_buf,
+            EVDEV_MONITOR_INOTIFY_BUF_SIZE);
+        if (n_bytes_read == -1 && errno == EINTR) {
+            continue;
+        } else if (n_bytes_read == -1 && errno == EAGAIN) {
+            mon->inotify_buf_offset = mon->inotify_buf_len = 0;
+            return 0;
+        } else if (n_bytes_read == -1) {
+            s_log_error("Failed to read from the inotify fd: %s",
+                strerror(errno));
+            return -1;
+        } else if (n_bytes_read == 0) {
+            mon->inotify_buf_offset = mon->inotify_buf_len = 0;
+            return 0;
+        }
+
+        mon->inotify_buf_offset = 0;
+        mon->inotify_buf_len = n_bytes_read;
     }
-    pthread_mutex_unlock(&g_libudev_mutex);
 }
@@ -3,24 +3,74 @@
 
 #include <core/int.h>
 #include <core/vector.h>
+#include <stdbool.h>
+#include <sys/inotify.h>
+#include <linux/limits.h>
 
 /* The purpose of this class is to monitor /dev/input
  * for creation or deletion of files (event devices).
  *
  * The state should be checked with `monitor_poll` e.g. in a main loop
  * and creation/deletion of devices should be handled
- * before any action is performed on them. */
+ * before any action is performed on them.
+ *
+ * By default, the kernel's uevents are received directly from a
+ * `NETLINK_KOBJECT_UEVENT` socket, with a socket filter that only lets
+ * through the ones from the input subsystem (so no udev is involved).
+ * Where the uevents aren't delivered (in a user namespace, e.g. a rootless
+ * container) or the socket can't be opened, /dev/input is watched
+ * with inotify instead.
+ *
+ * If the devices don't come from /dev/input (see `evdev-source.h`),
+ * their root directory is always watched with inotify.
+ * In that case, files should be created atomically (e.g. written
+ * elsewhere and then renamed into place), as they're loaded right away. */
+
+#define EVDEV_MONITOR_INOTIFY_BUF_SIZE 4096
+
+enum evdev_monitor_type {
+    EVDEV_MONITOR_NETLINK,
+    EVDEV_MONITOR_INOTIFY,
+};
+
 struct evdev_monitor {
-    struct udev *udev;
-    struct udev_monitor *mon;
     i32 fd;
+    enum evdev_monitor_type type;
+
+    /* The inotify events that were read, but not returned yet */
+    u32 inotify_buf_offset;
+    u32 inotify_buf_len;
+    _Alignas(struct inotify_event) u8 inotify_buf[EVDEV_MONITOR_INOTIFY_BUF_SIZE];
+
     bool destroyed__;
 };
 
+enum evdev_monitor_action {
+    EVDEV_MONITOR_CREATED,
+    EVDEV_MONITOR_DELETED,
+};
+
+struct evdev_monitor_event {
+    enum evdev_monitor_action action;
+
+    /* The path of the device relative to the evdev source's root directory
+     * (e.g. "event3"). Only event devices are ever reported. */
+    char name[NAME_MAX + 1];
+};
+
 /* Initializes a new /dev/input monitor `o`.
  * Returns 0 on success and non-zero on failure. */
 i32 evdev_monitor_init(struct evdev_monitor *o);
 
+/* Reads the next event from the monitor `mon` into `o_event`,
+ * without allocating anything.
+ *
+ * Returns 1 if an event was read, 0 if there are none left
+ * (for now - the monitor's fd should be polled again),
+ * and -1 if an error occurs. */
+i32 evdev_monitor_next(struct evdev_monitor *mon,
+    struct evdev_monitor_event *o_event);
+
 /* Read all events from the monitor `mon`
  * and store a new vector with the affected devices' paths (as malloced strings)
  * in `o_created` and `o_deleted`, respectively.
@@ -23,6 +23,14 @@ void p_time(timestamp_t *o);
  * Guarantees high precision, but is not in sync with UTC. */
 void p_time_get_ticks(timestamp_t *o);
 
+/* Same as `p_time_get_ticks`, but the value is returned in milliseconds. */
+u64 p_time_get_ticks_ms(void);
+
+/* Same as `p_time_get_ticks`, but the value is returned in nanoseconds.
+ * Comparable with the timestamps of event devices that use
+ * `CLOCK_MONOTONIC` (see `EVIOCSCLOCKID`). */
+u64 p_time_get_ticks_ns(void);
+
 /* Get the time elapsed since `t0` */
 i64 p_time_delta_us(const timestamp_t *t0);
 i64 p_time_delta_ms(const timestamp_t *t0);
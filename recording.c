@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+#define P_INTERNAL_GUARD__
+#include "evdev.h"
+#undef P_INTERNAL_GUARD__
+#include "recording.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/vector.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "recording"
+
+/* A varint takes up at most 10 bytes;
+ * the largest record is a tag, an escaped device id and 5 varints */
+#define VARINT_MAX_LEN 10
+#define RECORD_MAX_LEN (1 + 6 * VARINT_MAX_LEN)
+
+static u32 put_varint(u8 *buf, u64 val);
+static u64 zigzag_encode(i64 val);
+static i64 zigzag_decode(u64 val);
+static i32 get_varint(const u8 *data, u64 size, u64 *offset, u64 *o_val);
+static void put_u64_le(u8 *buf, u64 val);
+static u64 get_u64_le(const u8 *buf);
+static i64 event_ts_us(const struct input_event *ev);
+
+static void recorder_write(struct recorder *rec, const void *buf, u64 size);
+static void recorder_write_record(struct recorder *rec,
+    enum recording_item_kind kind, u32 id, i64 ts_us,
+    const struct input_event *ev);
+static i64 recorder_now_us(const struct recorder *rec);
+
+static i32 read_device_table(struct recording *rec);
+
+i32 recorder_init(struct recorder *o, const char *path)
+{
+    u_check_params(o != NULL && path != NULL);
+    memset(o, 0, sizeof(struct recorder));
+
+    o->fp = fopen(path, "wbe");
+    if (o->fp == NULL) {
+        s_log_error("Failed to create the recording \"%s\": %s",
+            path, strerror(errno));
+        return 1;
+    }
+
+    o->devices = vector_new(struct recording_device);
+    o->index = vector_new(struct recording_index_entry);
+
+    recorder_write(o, RECORDING_MAGIC, RECORDING_MAGIC_LEN);
+
+    s_log_info("Recording the input to \"%s\"", path);
+    return 0;
+}
+
+u32 recorder_add_device(struct recorder *rec, const struct evdev *dev)
+{
+    u_check_params(rec != NULL && rec->fp != NULL && dev != NULL);
+
+    struct recording_device rdev = {
+        .id = rec->next_device_id++,
+        .type = dev->type,
+    };
+    memcpy(rdev.name, dev->name, MAX_EVDEV_NAME_LEN);
+    rdev.name[MAX_EVDEV_NAME_LEN - 1] = '\0';
+
+    /* Emulated devices don't have any ids */
+    if (ioctl(dev->fd, EVIOCGID, &rdev.ids) < 0)
+        memset(&rdev.ids, 0, sizeof(struct input_id));
+
+    vector_push_back(rec->devices, rdev);
+    recorder_write_record(rec, RECORDING_ITEM_DEVICE_ADD, rdev.id,
+        recorder_now_us(rec), NULL);
+
+    return rdev.id;
+}
+
+void recorder_remove_device(struct recorder *rec, u32 id)
+{
+    u_check_params(rec != NULL && rec->fp != NULL);
+
+    recorder_write_record(rec, RECORDING_ITEM_DEVICE_REMOVE, id,
+        recorder_now_us(rec), NULL);
+}
+
+void recorder_write_events(struct recorder *rec, u32 id,
+    const struct input_event *events, u32 n)
+{
+    u_check_params(rec != NULL && rec->fp != NULL && events != NULL);
+
+    for (u32 i = 0; i < n; i++) {
+        const struct input_event *ev = &events[i];
+        if (rec->n_events % RECORDING_INDEX_INTERVAL == 0) {
+            vector_push_back(rec->index, (struct recording_index_entry) {
+                .offset = rec->offset,
+                .base_ts_us = rec->prev_ts_us,
+                .event_index = rec->n_events,
+            });
+        }
+
+        const enum recording_item_kind kind =
+            (ev->type == EV_SYN && ev->code == SYN_REPORT && ev->value == 0)
+            ? RECORDING_ITEM_SYN_REPORT : RECORDING_ITEM_EVENT;
+        recorder_write_record(rec, kind, id, event_ts_us(ev), ev);
+        rec->n_events++;
+    }
+}
+
+i32 recorder_destroy(struct recorder *rec)
+{
+    if (rec == NULL || rec->fp == NULL)
+        return 0;
+
+    u8 buf[VARINT_MAX_LEN * 6];
+
+    /* Device table */
+    const u64 devices_offset = rec->offset;
+    for (u32 i = 0; i < vector_size(rec->devices); i++) {
+        const struct recording_device *d = &rec->devices[i];
+        const char *type_name = evdev_type_strings[
+            d->type > EVDEV_TYPE_UNKNOWN && d->type < EVDEV_N_TYPES ?
+            d->type : EVDEV_TYPE_UNKNOWN
+        ];
+        const u32 name_len = strlen(d->name);
+        const u32 type_len = strlen(type_name);
+
+        u32 n = put_varint(buf, d->id);
+        n += put_varint(buf + n, name_len);
+        recorder_write(rec, buf, n);
+        recorder_write(rec, d->name, name_len);
+        n = put_varint(buf, type_len);
+        recorder_write(rec, buf, n);
+        recorder_write(rec, type_name, type_len);
+        n = put_varint(buf, d->ids.bustype);
+        n += put_varint(buf + n, d->ids.vendor);
+        n += put_varint(buf + n, d->ids.product);
+        n += put_varint(buf + n, d->ids.version);
+        recorder_write(rec, buf, n);
+    }
+
+    /* Index */
+    const u8 padding[sizeof(u64)] = { 0 };
+    recorder_write(rec, padding,
+        (sizeof(u64) - rec->offset % sizeof(u64)) % sizeof(u64));
+    const u64 index_offset = rec->offset;
+    for (u32 i = 0; i < vector_size(rec->index); i++) {
+        u8 entry[3 * sizeof(u64)];
+        put_u64_le(entry, rec->index[i].offset);
+        put_u64_le(entry + sizeof(u64), (u64)rec->index[i].base_ts_us);
+        put_u64_le(entry + 2 * sizeof(u64), rec->index[i].event_index);
+        recorder_write(rec, entry, sizeof(entry));
+    }
+
+    /* Footer */
+    u8 footer[RECORDING_FOOTER_SIZE];
+    put_u64_le(footer, devices_offset);
+    put_u64_le(footer + 8, vector_size(rec->devices));
+    put_u64_le(footer + 16, index_offset);
+    put_u64_le(footer + 24, vector_size(rec->index));
+    put_u64_le(footer + 32, rec->n_events);
+    memcpy(footer + 40, RECORDING_MAGIC, RECORDING_MAGIC_LEN);
+    recorder_write(rec, footer, RECORDING_FOOTER_SIZE);
+
+    if (fclose(rec->fp) != 0)
+        rec->write_failed_ = true;
+    rec->fp = NULL;
+
+    s_log_info("Recorded %lu event(s) from %u device(s) in %lu bytes",
+        (unsigned long)rec->n_events, vector_size(rec->devices),
+        (unsigned long)rec->offset);
+
+    vector_destroy(&rec->devices);
+    vector_destroy(&rec->index);
+
+    if (rec->write_failed_) {
+        s_log_error("The recording is incomplete");
+        return 1;
+    }
+    return 0;
+}
+
+i32 recording_open(struct recording *o, const char *path)
+{
+    u_check_params(o != NULL && path != NULL);
+    memset(o, 0, sizeof(struct recording));
+    o->data = MAP_FAILED;
+
+    const i32 fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        goto_error("Failed to open the recording \"%s\": %s",
+            path, strerror(errno));
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        goto_error("Failed to stat \"%s\": %s", path, strerror(errno));
+    }
+    o->size = st.st_size;
+    if (o->size < RECORDING_MAGIC_LEN + RECORDING_FOOTER_SIZE) {
+        close(fd);
+        goto_error("\"%s\" is too small to be a recording", path);
+    }
+
+    o->data = mmap(NULL, o->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (o->data == MAP_FAILED)
+        goto_error("Failed to map \"%s\": %s", path, strerror(errno));
+
+    const u8 *f = o->data + o->size - RECORDING_FOOTER_SIZE;
+    o->footer = (struct recording_footer) {
+        .devices_offset = get_u64_le(f),
+        .n_devices = get_u64_le(f + 8),
+        .index_offset = get_u64_le(f + 16),
+        .n_index_entries = get_u64_le(f + 24),
+        .n_events = get_u64_le(f + 32),
+    };
+    memcpy(o->footer.magic, f + 40, RECORDING_MAGIC_LEN);
+
+    const u64 trailer_end = o->size - RECORDING_FOOTER_SIZE;
+    if (memcmp(o->data, RECORDING_MAGIC, RECORDING_MAGIC_LEN) ||
+        memcmp(o->footer.magic, RECORDING_MAGIC, RECORDING_MAGIC_LEN))
+    {
+        goto_error("\"%s\" is not a recording (or it's incomplete)", path);
+    } else if (o->footer.devices_offset < RECORDING_MAGIC_LEN ||
+        o->footer.devices_offset > o->footer.index_offset ||
+        o->footer.index_offset > trailer_end ||
+        o->footer.n_index_entries >
+            (trailer_end - o->footer.index_offset) /
+                sizeof(struct recording_index_entry))
+    {
+        goto_error("The trailer of \"%s\" is corrupted", path);
+    }
+
+    if (read_device_table(o))
+        goto_error("The device table of \"%s\" is corrupted", path);
+
+    s_log_debug("Opened the recording \"%s\" (%lu events from %u devices)",
+        path, (unsigned long)o->footer.n_events, vector_size(o->devices));
+    return 0;
+
+err:
+    recording_close(o);
+    return 1;
+}
+
+void recording_rewind(const struct recording *rec,
+    struct recording_cursor *cursor)
+{
+    u_check_params(rec != NULL && cursor != NULL);
+
+    *cursor = (struct recording_cursor) {
+        .offset = RECORDING_MAGIC_LEN,
+        .prev_ts_us = 0,
+        .event_index = 0,
+    };
+}
+
+void recording_seek(const struct recording *rec,
+    struct recording_cursor *cursor, i64 ts_us)
+{
+    u_check_params(rec != NULL && cursor != NULL);
+
+    recording_rewind(rec, cursor);
+
+    /* Find the last index entry that is still before `ts_us` */
+    const u8 *index = rec->data + rec->footer.index_offset;
+    const u64 entry_size = sizeof(struct recording_index_entry);
+    u64 lo = 0, hi = rec->footer.n_index_entries;
+    while (lo < hi) {
+        const u64 mid = lo + (hi - lo) / 2;
+        const u8 *entry = index + mid * entry_size;
+        /* The very first entry has no previous record */
+        if (mid == 0 || (i64)get_u64_le(entry + sizeof(u64)) < ts_us) {
+            cursor->offset = get_u64_le(entry);
+            cursor->prev_ts_us = (i64)get_u64_le(entry + sizeof(u64));
+            cursor->event_index = get_u64_le(entry + 2 * sizeof(u64));
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* Then go through the records one by one */
+    struct recording_cursor tmp = *cursor;
+    struct recording_item item;
+    while (recording_next(rec, &tmp, &item) == 0 && item.ts_us < ts_us)
+        *cursor = tmp;
+}
+
+i32 recording_next(const struct recording *rec,
+    struct recording_cursor *cursor, struct recording_item *o_item)
+{
+    u_check_params(rec != NULL && cursor != NULL && o_item != NULL);
+
+    const u64 end = rec->footer.devices_offset;
+    if (cursor->offset >= end)
+        return 1;
+
+    u64 offset = cursor->offset;
+    const u8 tag = rec->data[offset++];
+    memset(o_item, 0, sizeof(struct recording_item));
+    o_item->kind = tag & 0x3;
+
+    u64 id = tag >> 2, dt = 0;
+    if (id == RECORDING_DEV_ID_ESCAPE &&
+        get_varint(rec->data, end, &offset, &id))
+    {
+        return -1;
+    }
+    if (get_varint(rec->data, end, &offset, &dt))
+        return -1;
+
+    o_item->device_id = id;
+    o_item->ts_us = cursor->prev_ts_us + zigzag_decode(dt);
+
+    if (o_item->kind == RECORDING_ITEM_EVENT) {
+        u64 type = 0, code = 0, value = 0;
+        if (get_varint(rec->data, end, &offset, &type) ||
+            get_varint(rec->data, end, &offset, &code) ||
+            get_varint(rec->data, end, &offset, &value))
+        {
+            return -1;
+        }
+        o_item->ev.type = type;
+        o_item->ev.code = code;
+        o_item->ev.value = zigzag_decode(value);
+    } else if (o_item->kind == RECORDING_ITEM_SYN_REPORT) {
+        o_item->ev.type = EV_SYN;
+        o_item->ev.code = SYN_REPORT;
+        o_item->ev.value = 0;
+    }
+    if (o_item->kind == RECORDING_ITEM_EVENT ||
+        o_item->kind == RECORDING_ITEM_SYN_REPORT)
+    {
+        o_item->ev.input_event_sec = o_item->ts_us / 1000000;
+        o_item->ev.input_event_usec = o_item->ts_us % 1000000;
+        cursor->event_index++;
+    }
+
+    cursor->offset = offset;
+    cursor->prev_ts_us = o_item->ts_us;
+    return 0;
+}
+
+const struct recording_device * recording_get_device(
+    const struct recording *rec, u32 id)
+{
+    u_check_params(rec != NULL);
+
+    for (u32 i = 0; i < vector_size(rec->devices); i++) {
+        if (rec->devices[i].id == id)
+            return &rec->devices[i];
+    }
+
+    return NULL;
+}
+
+void recording_close(struct recording *rec)
+{
+    if (rec == NULL)
+        return;
+
+    if (rec->data != MAP_FAILED && rec->data != NULL)
+        munmap((void *)rec->data, rec->size);
+    rec->data = NULL;
+    rec->size = 0;
+
+    if (rec->devices != NULL)
+        vector_destroy(&rec->devices);
+}
+
+static void recorder_write(struct recorder *rec, const void *buf, u64 size)
+{
+    if (size == 0 || rec->write_failed_)
+        return;
+
+    if (fwrite(buf, 1, size, rec->fp) != size) {
+        s_log_error("Failed to write to the recording: %s", strerror(errno));
+        rec->write_failed_ = true;
+        return;
+    }
+    rec->offset += size;
+}
+
+static void recorder_write_record(struct recorder *rec,
+    enum recording_item_kind kind, u32 id, i64 ts_us,
+    const struct input_event *ev)
+{
+    u8 buf[RECORD_MAX_LEN];
+    u32 n = 0;
+
+    if (id < RECORDING_DEV_ID_ESCAPE) {
+        buf[n++] = kind | (id << 2);
+    } else {
+        buf[n++] = kind | (RECORDING_DEV_ID_ESCAPE << 2);
+        n += put_varint(buf + n, id);
+    }
+    n += put_varint(buf + n, zigzag_encode(ts_us - rec->prev_ts_us));
+    rec->prev_ts_us = ts_us;
+
+    if (kind == RECORDING_ITEM_EVENT) {
+        n += put_varint(buf + n, ev->type);
+        n += put_varint(buf + n, ev->code);
+        n += put_varint(buf + n, zigzag_encode(ev->value));
+    }
+
+    recorder_write(rec, buf, n);
+}
+
+static i64 recorder_now_us(const struct recorder *rec)
+{
+    /* Device additions and removals don't have timestamps of their own,
+     * so just keep them in line with the surrounding events */
+    return rec->prev_ts_us;
+}
+
+static i32 read_device_table(struct recording *rec)
+{
+    rec->devices = vector_new(struct recording_device);
+
+    const u64 end = rec->footer.index_offset;
+    u64 offset = rec->footer.devices_offset;
+    for (u64 i = 0; i < rec->footer.n_devices; i++) {
+        struct recording_device d = { 0 };
+        u64 id = 0, name_len = 0, type_len = 0;
+        u64 bustype = 0, vendor = 0, product = 0, version = 0;
+
+        if (get_varint(rec->data, end, &offset, &id) ||
+            get_varint(rec->data, end, &offset, &name_len) ||
+            name_len > end - offset)
+        {
+            return 1;
+        }
+        memcpy(d.name, rec->data + offset,
+            name_len < MAX_EVDEV_NAME_LEN ? name_len : MAX_EVDEV_NAME_LEN - 1);
+        offset += name_len;
+
+        if (get_varint(rec->data, end, &offset, &type_len) ||
+            type_len > end - offset)
+        {
+            return 1;
+        }
+        d.type = EVDEV_TYPE_UNKNOWN;
+        for (u32 t = 0; t < EVDEV_N_TYPES; t++) {
+            if (strlen(evdev_type_strings[t]) == type_len &&
+                !memcmp(evdev_type_strings[t], rec->data + offset, type_len))
+            {
+                d.type = t;
+                break;
+            }
+        }
+        offset += type_len;
+
+        if (get_varint(rec->data, end, &offset, &bustype) ||
+            get_varint(rec->data, end, &offset, &vendor) ||
+            get_varint(rec->data, end, &offset, &product) ||
+            get_varint(rec->data, end, &offset, &version))
+        {
+            return 1;
+        }
+        d.id = id;
+        d.ids = (struct input_id) {
+            .bustype = bustype, .vendor = vendor,
+            .product = product, .version = version,
+        };
+
+        vector_push_back(rec->devices, d);
+    }
+
+    return 0;
+}
+
+static u32 put_varint(u8 *buf, u64 val)
+{
+    u32 n = 0;
+    while (val >= 0x80) {
+        buf[n++] = (val & 0x7f) | 0x80;
+        val >>= 7;
+    }
+    buf[n++] = val;
+    return n;
+}
+
+static i32 get_varint(const u8 *data, u64 size, u64 *offset, u64 *o_val)
+{
+    u64 val = 0;
+    for (u32 shift = 0; shift < 64 && *offset < size; shift += 7) {
+        const u8 b = data[(*offset)++];
+        val |= (u64)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *o_val = val;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static u64 zigzag_encode(i64 val)
+{
+    return ((u64)val << 1) ^ (u64)(val >> 63);
+}
+
+static i64 zigzag_decode(u64 val)
+{
+    return (i64)(val >> 1) ^ -(i64)(val & 1);
+}
+
+static void put_u64_le(u8 *buf, u64 val)
+{
+    for (u32 i = 0; i < sizeof(u64); i++)
+        buf[i] = (val >> (8 * i)) & 0xff;
+}
+
+static u64 get_u64_le(const u8 *buf)
+{
+    u64 val = 0;
+    for (u32 i = 0; i < sizeof(u64); i++)
+        val |= (u64)buf[i] << (8 * i);
+    return val;
+}
+
+static i64 event_ts_us(const struct input_event *ev)
+{
+    return (i64)ev->input_event_sec * 1000000 + ev->input_event_usec;
+}
@@ -0,0 +1,156 @@
+#ifndef RECORDING_H_
+#define RECORDING_H_
+
+#include "evdev.h"
+#include <core/int.h>
+#include <core/vector.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+/* A compact binary format for recorded controller input.
+ *
+ * The file starts with an 8-byte magic, followed by a stream of records.
+ * Every record starts with a tag byte: the low 2 bits are the record kind
+ * (`enum recording_item_kind`), and the rest is the id of the device
+ * (or `RECORDING_DEV_ID_ESCAPE`, in which case the id follows as a varint).
+ * Next comes the (zigzag varint) difference between the record's timestamp
+ * and the previous record's timestamp, in microseconds, and then,
+ * for `RECORDING_ITEM_EVENT` only, the type, code and (zigzag) value
+ * of the event, all as varints. SYN_REPORTs, the most common event,
+ * have a record kind of their own, and don't need any more fields.
+ *
+ * After the records comes the trailer:
+ * the device table (for every device: its id, name, type name
+ * (see `evdev_type_strings`) and the 4 fields of its `struct input_id`,
+ * with the strings prefixed by their length and everything else as varints),
+ * then the (8-byte aligned) index of fixed-size `struct recording_index_entry`s,
+ * which allows starting the replay from the middle of the file,
+ * and finally the fixed-size `struct recording_footer` at the very end.
+ *
+ * All fixed-size fields are little-endian.
+ * A typical event takes up 3 to 7 bytes, compared to the 24 bytes
+ * of a `struct input_event`. */
+
+#define RECORDING_MAGIC "PS4CREC\x01"
+#define RECORDING_MAGIC_LEN 8
+
+#define RECORDING_DEV_ID_ESCAPE 63
+#define RECORDING_INDEX_INTERVAL 1024
+
+#define RECORDING_ITEM_KINDS_LIST           \
+    X_(RECORDING_ITEM_EVENT)                \
+    X_(RECORDING_ITEM_SYN_REPORT)           \
+    X_(RECORDING_ITEM_DEVICE_ADD)           \
+    X_(RECORDING_ITEM_DEVICE_REMOVE)        \
+
+#define X_(name) name,
+enum recording_item_kind {
+    RECORDING_ITEM_KINDS_LIST
+    RECORDING_N_ITEM_KINDS
+};
+#undef X_
+
+struct recording_index_entry {
+    u64 offset; /* Of the first record after this entry */
+    i64 base_ts_us; /* The timestamp of the record before `offset` */
+    u64 event_index; /* The number of events before `offset` */
+};
+
+struct recording_footer {
+    u64 devices_offset;
+    u64 n_devices;
+    u64 index_offset;
+    u64 n_index_entries;
+    u64 n_events;
+    u8 magic[RECORDING_MAGIC_LEN];
+};
+#define RECORDING_FOOTER_SIZE (5 * sizeof(u64) + RECORDING_MAGIC_LEN)
+
+struct recording_device {
+    u32 id;
+    enum evdev_type type;
+    struct input_id ids;
+    char name[MAX_EVDEV_NAME_LEN];
+};
+
+struct recorder {
+    FILE *fp;
+    u64 offset;
+    u64 n_events;
+    i64 prev_ts_us;
+    u32 next_device_id;
+    bool write_failed_;
+
+    VECTOR(struct recording_device) devices;
+    VECTOR(struct recording_index_entry) index;
+};
+
+/* Creates a new recording at `path`.
+ * Returns 0 on success and non-zero on failure. */
+i32 recorder_init(struct recorder *o, const char *path);
+
+/* Adds the device `dev` to the recording, and returns its new id.
+ * Its ids are read from the device itself, if possible. */
+u32 recorder_add_device(struct recorder *rec, const struct evdev *dev);
+
+/* Marks the end of device `id`'s events */
+void recorder_remove_device(struct recorder *rec, u32 id);
+
+/* Appends the `n` events in `events` of the device `id` to the recording */
+void recorder_write_events(struct recorder *rec, u32 id,
+    const struct input_event *events, u32 n);
+
+/* Writes the trailer and closes the recording.
+ * Returns 0 on success and non-zero if the recording
+ * couldn't be written properly. */
+i32 recorder_destroy(struct recorder *rec);
+
+struct recording {
+    const u8 *data;
+    u64 size;
+
+    struct recording_footer footer;
+    VECTOR(struct recording_device) devices;
+};
+
+struct recording_item {
+    enum recording_item_kind kind;
+    u32 device_id;
+    i64 ts_us;
+    struct input_event ev; /* Only for the *_EVENT and *_SYN_REPORT kinds */
+};
+
+struct recording_cursor {
+    u64 offset;
+    i64 prev_ts_us;
+    u64 event_index;
+};
+
+/* Maps the recording at `path` into memory and reads its device table.
+ * Returns 0 on success and non-zero on failure. */
+i32 recording_open(struct recording *o, const char *path);
+
+/* Positions `cursor` at the first record of `rec` */
+void recording_rewind(const struct recording *rec,
+    struct recording_cursor *cursor);
+
+/* Positions `cursor` at the first record of `rec` with a timestamp
+ * of at least `ts_us`, using the index to skip most of the file. */
+void recording_seek(const struct recording *rec,
+    struct recording_cursor *cursor, i64 ts_us);
+
+/* Decodes the record at `cursor` into `o_item` and advances the cursor.
+ * Returns 0 on success, 1 at the end of the records
+ * and -1 if the recording is corrupted. */
+i32 recording_next(const struct recording *rec,
+    struct recording_cursor *cursor, struct recording_item *o_item);
+
+/* Returns the device with the id `id`, or NULL if there is none */
+const struct recording_device * recording_get_device(
+    const struct recording *rec, u32 id);
+
+/* Unmaps the recording */
+void recording_close(struct recording *rec);
+
+#endif /* RECORDING_H_ */
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include "replay.h"
+#include "recording.h"
+#include "evdev-source.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "replay"
+
+/* In the as-fast-as-possible mode, give the rest of the pipeline
+ * a chance to run after this many events */
+#define REPLAY_STEP_MAX_EVENTS 4096
+
+static u64 get_time_us(void);
+static i32 find_device(const struct replay *r, u32 id);
+static i32 flush_write_buf(struct replay *r);
+static i32 arm_timer(struct replay *r, u64 deadline_us);
+static void finish(struct replay *r);
+
+i32 replay_init(struct replay *o, const char *path, bool realtime)
+{
+    u_check_params(o != NULL && path != NULL);
+    memset(o, 0, sizeof(struct replay));
+    o->timer_fd = -1;
+    o->realtime = realtime;
+    for (u32 i = 0; i < REPLAY_MAX_DEVICES; i++)
+        o->devices[i].write_fd = o->devices[i].read_fd = -1;
+    o->write_buf_dev_ = -1;
+
+    if (recording_open(&o->rec, path))
+        goto_error("Failed to open the recording");
+    recording_rewind(&o->rec, &o->cursor);
+
+    if (vector_size(o->rec.devices) > REPLAY_MAX_DEVICES)
+        goto_error("Can't replay more than %u devices at once",
+            REPLAY_MAX_DEVICES);
+
+    for (u32 i = 0; i < vector_size(o->rec.devices); i++) {
+        const struct recording_device *d = &o->rec.devices[i];
+        struct replay_device *rd = &o->devices[o->n_devices++];
+        rd->id = d->id;
+
+        i32 pipe_fds[2];
+        if (pipe2(pipe_fds, O_NONBLOCK | O_CLOEXEC))
+            goto_error("Failed to create a pipe: %s", strerror(errno));
+        rd->read_fd = pipe_fds[0];
+        rd->write_fd = pipe_fds[1];
+
+        char rel_path[32] = { 0 };
+        (void) snprintf(rel_path, sizeof(rel_path), "event%u", d->id);
+        const enum evdev_type type = d->type == EVDEV_TYPE_UNKNOWN ?
+            evdev_source_get()->emulated_type : d->type;
+        if (evdev_source_add_fd(rel_path, rd->read_fd, type, d->name))
+            goto_error("Failed to register the device \"%s\"", d->name);
+    }
+
+    o->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (o->timer_fd == -1)
+        goto_error("Failed to create the replay timer: %s", strerror(errno));
+    if (arm_timer(o, 0))
+        goto err;
+
+    s_log_info("Replaying %lu event(s) from %u device(s) %s",
+        (unsigned long)o->rec.footer.n_events, o->n_devices,
+        realtime ? "in real time" : "as fast as possible");
+    return 0;
+
+err:
+    replay_destroy(o);
+    return 1;
+}
+
+i32 replay_step(struct replay *r)
+{
+    u_check_params(r != NULL);
+    if (r->finished)
+        return 0;
+
+    /* Acknowledge the expiration */
+    u64 n_expirations = 0;
+    (void) !read(r->timer_fd, &n_expirations, sizeof(n_expirations));
+
+    const u64 now = get_time_us();
+
+    /* Anything left over from last time has to go first */
+    if (r->write_buf_len_ > 0) {
+        const i32 ret = flush_write_buf(r);
+        if (ret < 0)
+            return 1;
+        else if (ret > 0)
+            return arm_timer(r, 0); /* Still full */
+    }
+
+    for (u32 n = 0; n < REPLAY_STEP_MAX_EVENTS; n++) {
+        struct recording_item item;
+        if (r->has_pending_) {
+            item = r->pending_;
+            r->has_pending_ = false;
+        } else {
+            const i32 ret = recording_next(&r->rec, &r->cursor, &item);
+            if (ret < 0) {
+                s_log_error("The recording is corrupted");
+                return 1;
+            } else if (ret > 0) {
+                if (flush_write_buf(r) > 0)
+                    return arm_timer(r, 0);
+                finish(r);
+                return 0;
+            }
+        }
+
+        /* The device additions before the first event don't have
+         * meaningful timestamps, so the clock starts with the first event */
+        const bool is_event = item.kind == RECORDING_ITEM_EVENT ||
+            item.kind == RECORDING_ITEM_SYN_REPORT;
+        if (!r->started_ && is_event) {
+            r->started_ = true;
+            r->first_ts_us_ = item.ts_us;
+            r->start_time_us_ = now;
+        }
+
+        if (r->realtime && r->started_ && item.ts_us > r->first_ts_us_) {
+            const u64 due = r->start_time_us_ + (item.ts_us - r->first_ts_us_);
+            if (due > now) {
+                r->pending_ = item;
+                r->has_pending_ = true;
+                if (flush_write_buf(r) < 0)
+                    return 1;
+                return arm_timer(r, due);
+            }
+        }
+
+        const i32 dev = find_device(r, item.device_id);
+        if (dev == -1 || r->devices[dev].write_fd == -1)
+            continue;
+
+        switch (item.kind) {
+        case RECORDING_ITEM_EVENT:
+        case RECORDING_ITEM_SYN_REPORT:
+            if ((r->write_buf_len_ > 0 && r->write_buf_dev_ != dev) ||
+                r->write_buf_len_ == REPLAY_WRITE_BATCH_N_EVENTS)
+            {
+                const i32 ret = flush_write_buf(r);
+                if (ret < 0) {
+                    return 1;
+                } else if (ret > 0) {
+                    r->pending_ = item;
+                    r->has_pending_ = true;
+                    return arm_timer(r, 0);
+                }
+            }
+            r->write_buf_[r->write_buf_len_++] = item.ev;
+            r->write_buf_dev_ = dev;
+            r->n_events_replayed++;
+            break;
+        case RECORDING_ITEM_DEVICE_REMOVE:
+            if (r->write_buf_len_ > 0) {
+                const i32 ret = flush_write_buf(r);
+                if (ret < 0) {
+                    return 1;
+                } else if (ret > 0) {
+                    r->pending_ = item;
+                    r->has_pending_ = true;
+                    return arm_timer(r, 0);
+                }
+            }
+            close(r->devices[dev].write_fd);
+            r->devices[dev].write_fd = -1;
+            break;
+        case RECORDING_ITEM_DEVICE_ADD:
+        default:
+            /* All devices are registered from the start */
+            break;
+        }
+    }
+
+    if (flush_write_buf(r) < 0)
+        return 1;
+    return arm_timer(r, 0);
+}
+
+u64 replay_get_elapsed_us(const struct replay *r)
+{
+    u_check_params(r != NULL);
+    if (!r->started_)
+        return 0;
+
+    return get_time_us() - r->start_time_us_;
+}
+
+void replay_destroy(struct replay *r)
+{
+    if (r == NULL)
+        return;
+
+    for (u32 i = 0; i < r->n_devices; i++) {
+        if (r->devices[i].write_fd != -1) {
+            close(r->devices[i].write_fd);
+            r->devices[i].write_fd = -1;
+        }
+        if (r->devices[i].read_fd != -1) {
+            close(r->devices[i].read_fd);
+            r->devices[i].read_fd = -1;
+        }
+    }
+    r->n_devices = 0;
+    evdev_source_clear_fds();
+
+    if (r->timer_fd != -1) {
+        close(r->timer_fd);
+        r->timer_fd = -1;
+    }
+    recording_close(&r->rec);
+}
+
+static u64 get_time_us(void)
+{
+    struct timespec ts;
+    (void) clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static i32 find_device(const struct replay *r, u32 id)
+{
+    for (u32 i = 0; i < r->n_devices; i++) {
+        if (r->devices[i].id == id)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Returns 0 if the buffer was written, 1 if the pipe is full
+ * and -1 on failure */
+static i32 flush_write_buf(struct replay *r)
+{
+    if (r->write_buf_len_ == 0)
+        return 0;
+
+    const i32 fd = r->devices[r->write_buf_dev_].write_fd;
+    const u32 size = r->write_buf_len_ * sizeof(struct input_event);
+    i64 ret = 0;
+    do {
+        ret = write(fd, r->write_buf_, size);
+    } while (ret == -1 && errno == EINTR);
+
+    if (ret == -1 && errno == EAGAIN) {
+        return 1;
+    } else if (ret != size) {
+        s_log_error("Failed to write the events to device %u: %s",
+            r->devices[r->write_buf_dev_].id, strerror(errno));
+        return -1;
+    }
+
+    r->write_buf_len_ = 0;
+    return 0;
+}
+
+/* Arms the timer to fire at `deadline_us`, or right away if it's 0 */
+static i32 arm_timer(struct replay *r, u64 deadline_us)
+{
+    struct itimerspec its = { 0 };
+    i32 flags = 0;
+    if (deadline_us == 0) {
+        its.it_value.tv_nsec = 1; /* Relative; fires immediately */
+    } else {
+        its.it_value.tv_sec = deadline_us / 1000000;
+        its.it_value.tv_nsec = (deadline_us % 1000000) * 1000;
+        flags = TFD_TIMER_ABSTIME;
+    }
+
+    if (timerfd_settime(r->timer_fd, flags, &its, NULL)) {
+        s_log_error("Failed to arm the replay timer: %s", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+static void finish(struct replay *r)
+{
+    /* Closing the write ends makes the devices disconnect
+     * once the pipeline reads everything */
+    for (u32 i = 0; i < r->n_devices; i++) {
+        if (r->devices[i].write_fd != -1) {
+            close(r->devices[i].write_fd);
+            r->devices[i].write_fd = -1;
+        }
+    }
+
+    const struct itimerspec its = { 0 };
+    (void) timerfd_settime(r->timer_fd, 0, &its, NULL);
+
+    r->finished = true;
+    s_log_info("Replayed %lu event(s) in %lu ms",
+        (unsigned long)r->n_events_replayed,
+        (unsigned long)(replay_get_elapsed_us(r) / 1000));
+}
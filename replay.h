@@ -0,0 +1,76 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include "recording.h"
+#include <core/int.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+/* Pushes a recording (see `recording.h`) back through the whole pipeline.
+ *
+ * Every device in the recording is registered as an emulated device
+ * (see `evdev-source.h`) backed by a pipe, so that it's found
+ * and read from just like a real one. The recorded events are then
+ * written into the pipes, either as fast as they're consumed,
+ * or with the same timing as when they were recorded.
+ *
+ * The replay is driven by `timer_fd`, which should be added
+ * to the event loop; `replay_step` should be called whenever it's ready. */
+
+#define REPLAY_MAX_DEVICES 16
+
+/* Writes to a pipe of at most PIPE_BUF bytes are atomic,
+ * so an event is never written only partially */
+#define REPLAY_WRITE_BATCH_N_EVENTS (4096 / sizeof(struct input_event))
+
+struct replay_device {
+    u32 id;
+    i32 write_fd;
+    i32 read_fd; /* Registered in the event source */
+};
+
+struct replay {
+    struct recording rec;
+    struct recording_cursor cursor;
+    bool realtime;
+    i32 timer_fd;
+
+    struct replay_device devices[REPLAY_MAX_DEVICES];
+    u32 n_devices;
+
+    /* The next item to be written, if it couldn't be written yet */
+    struct recording_item pending_;
+    bool has_pending_;
+
+    /* Consecutive events of one device are written together */
+    struct input_event write_buf_[REPLAY_WRITE_BATCH_N_EVENTS];
+    u32 write_buf_len_;
+    i32 write_buf_dev_;
+
+    i64 first_ts_us_;
+    u64 start_time_us_;
+    bool started_;
+
+    u64 n_events_replayed;
+    bool finished;
+};
+
+/* Opens the recording at `path` and registers its devices as emulated ones.
+ * With `realtime`, the original timing of the events is preserved.
+ * Returns 0 on success and non-zero on failure. */
+i32 replay_init(struct replay *o, const char *path, bool realtime);
+
+/* Writes all the events that are due to their devices.
+ * Once the whole recording has been replayed, all the devices
+ * are closed (so that they disconnect) and `finished` is set.
+ * Returns 0 on success and non-zero on failure. */
+i32 replay_step(struct replay *r);
+
+/* Returns the time elapsed since the first event was replayed,
+ * in microseconds */
+u64 replay_get_elapsed_us(const struct replay *r);
+
+/* Closes the recording and all its devices */
+void replay_destroy(struct replay *r);
+
+#endif /* REPLAY_H_ */
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include "scheduler.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define MODULE_NAME "scheduler"
+
+static u32 do_pulse(struct emit_scheduler *s, u64 now_ms);
+static u64 deadline_interval_ms(const struct emit_scheduler *s);
+static void arm_timer(struct emit_scheduler *s, u64 deadline_ms);
+static void disarm_timer(struct emit_scheduler *s);
+
+i32 emit_scheduler_init(struct emit_scheduler *o, enum emit_mode mode,
+    u64 throttle_ms, u64 idle_timeout_ms, u64 deadline_margin_ms,
+    u64 leading_edge_idle_ms)
+{
+    u_check_params(o != NULL && mode >= 0 && mode < EMIT_N_MODES);
+    memset(o, 0, sizeof(struct emit_scheduler));
+    o->mode = mode;
+    o->throttle_ms = throttle_ms;
+    o->idle_timeout_ms = idle_timeout_ms;
+    o->deadline_margin_ms = deadline_margin_ms;
+    o->leading_edge_idle_ms = leading_edge_idle_ms;
+    o->timer_fd = -1;
+
+    if (mode == EMIT_MODE_DEADLINE) {
+        if (deadline_margin_ms >= idle_timeout_ms) {
+            s_log_warn("The emit deadline margin (%lu ms) is not smaller "
+                "than the idle timeout (%lu ms); "
+                "pulses will be sent on every activity",
+                deadline_margin_ms, idle_timeout_ms);
+        }
+
+        o->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+            TFD_NONBLOCK | TFD_CLOEXEC);
+        if (o->timer_fd == -1)
+            goto_error("Failed to create the deadline timer: %s",
+                strerror(errno));
+    }
+
+    s_log_debug("Initialized the emit scheduler (mode %i)", mode);
+    return 0;
+
+err:
+    emit_scheduler_destroy(o);
+    return 1;
+}
+
+u32 emit_scheduler_on_activity(struct emit_scheduler *s,
+    u32 n_events, u64 now_ms)
+{
+    u_check_params(s != NULL);
+    if (n_events == 0)
+        return 0;
+
+    if (s->mode == EMIT_MODE_EVERY_EVENT)
+        return n_events;
+
+    /* Leading edge - the first activity after a long idle period */
+    const bool leading_edge = !s->seen_activity_ ||
+        now_ms - s->last_activity_ms_ >= s->leading_edge_idle_ms;
+    s->seen_activity_ = true;
+    s->last_activity_ms_ = now_ms;
+
+    if (leading_edge || !s->seen_pulse_)
+        return do_pulse(s, now_ms);
+
+    switch (s->mode) {
+    case EMIT_MODE_THROTTLE:
+        if (now_ms - s->last_pulse_ms_ >= s->throttle_ms)
+            return do_pulse(s, now_ms);
+        return 0;
+    case EMIT_MODE_DEADLINE:;
+        const u64 deadline_ms = s->last_pulse_ms_ + deadline_interval_ms(s);
+        if (now_ms >= deadline_ms)
+            return do_pulse(s, now_ms);
+
+        s->pending_ = true;
+        if (!s->timer_armed_)
+            arm_timer(s, deadline_ms);
+        return 0;
+    default:
+        s_log_fatal(MODULE_NAME, __func__, "Invalid emit mode %i", s->mode);
+    }
+}
+
+u32 emit_scheduler_on_timer(struct emit_scheduler *s, u64 now_ms)
+{
+    u_check_params(s != NULL);
+    if (s->timer_fd == -1)
+        return 0;
+
+    /* Consume the expiration count so that the fd stops being readable */
+    u64 n_expirations = 0;
+    while (read(s->timer_fd, &n_expirations, sizeof(u64)) == -1 &&
+        errno == EINTR)
+        ;
+    s->timer_armed_ = false;
+
+    if (!s->pending_)
+        return 0;
+
+    if (now_ms >= s->timer_deadline_ms_)
+        return do_pulse(s, now_ms);
+
+    /* Woke up too early - try again later */
+    arm_timer(s, s->timer_deadline_ms_);
+    return 0;
+}
+
+void emit_scheduler_destroy(struct emit_scheduler *s)
+{
+    if (s == NULL)
+        return;
+
+    if (s->timer_fd != -1) {
+        close(s->timer_fd);
+        s->timer_fd = -1;
+    }
+    s->timer_armed_ = false;
+    s->pending_ = false;
+}
+
+static u32 do_pulse(struct emit_scheduler *s, u64 now_ms)
+{
+    s->seen_pulse_ = true;
+    s->last_pulse_ms_ = now_ms;
+    s->pending_ = false;
+    if (s->timer_armed_)
+        disarm_timer(s);
+
+    return 1;
+}
+
+static u64 deadline_interval_ms(const struct emit_scheduler *s)
+{
+    if (s->deadline_margin_ms >= s->idle_timeout_ms)
+        return 0;
+
+    return s->idle_timeout_ms - s->deadline_margin_ms;
+}
+
+static void arm_timer(struct emit_scheduler *s, u64 deadline_ms)
+{
+    /* An all-zero `it_value` would disarm the timer instead */
+    if (deadline_ms == 0) deadline_ms = 1;
+
+    const struct itimerspec its = {
+        .it_value = {
+            .tv_sec = deadline_ms / 1000,
+            .tv_nsec = (deadline_ms % 1000) * 1000000,
+        },
+    };
+    if (timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        s_log_error("Failed to arm the deadline timer: %s", strerror(errno));
+        return;
+    }
+    s->timer_armed_ = true;
+    s->timer_deadline_ms_ = deadline_ms;
+}
+
+static void disarm_timer(struct emit_scheduler *s)
+{
+    const struct itimerspec its = { 0 };
+    if (timerfd_settime(s->timer_fd, 0, &its, NULL))
+        s_log_error("Failed to disarm the deadline timer: %s",
+            strerror(errno));
+    s->timer_armed_ = false;
+}
@@ -0,0 +1,76 @@
+#ifndef EMIT_SCHEDULER_H_
+#define EMIT_SCHEDULER_H_
+
+#include <core/int.h>
+#include <stdbool.h>
+
+/* The emit scheduler sits between the device reader and the fake keyboard.
+ *
+ * The compositor's idle timer only needs to be reset once in a while,
+ * so instead of sending a fake keypress for every single controller event,
+ * the scheduler decides when a pulse (a fake key press + release)
+ * actually has to be sent. */
+
+#define EMIT_MODES_LIST         \
+    X_(EMIT_MODE_EVERY_EVENT)   \
+    X_(EMIT_MODE_THROTTLE)      \
+    X_(EMIT_MODE_DEADLINE)      \
+
+#define X_(name) name,
+enum emit_mode {
+    EMIT_MODES_LIST
+    EMIT_N_MODES
+};
+#undef X_
+
+struct emit_scheduler {
+    enum emit_mode mode;
+
+    /* EMIT_MODE_THROTTLE: send at most one pulse per `throttle_ms` */
+    u64 throttle_ms;
+
+    /* EMIT_MODE_DEADLINE: send one pulse `deadline_margin_ms`
+     * before `idle_timeout_ms` expires, but only if there was
+     * any activity since the last pulse */
+    u64 idle_timeout_ms;
+    u64 deadline_margin_ms;
+
+    /* The first activity after at least this much time without any
+     * is always forwarded immediately (so that a blanked screen
+     * wakes up right away) */
+    u64 leading_edge_idle_ms;
+
+    /* Only used in EMIT_MODE_DEADLINE, -1 otherwise */
+    i32 timer_fd;
+
+    bool pending_;
+    bool timer_armed_;
+    bool seen_activity_;
+    bool seen_pulse_;
+    u64 last_activity_ms_;
+    u64 last_pulse_ms_;
+    u64 timer_deadline_ms_;
+};
+
+/* Initializes the scheduler `o`. In `EMIT_MODE_DEADLINE` a timerfd
+ * is created, which has to be polled for `POLLIN` by the caller and handled
+ * with `emit_scheduler_on_timer`.
+ * Returns 0 on success and non-zero on failure. */
+i32 emit_scheduler_init(struct emit_scheduler *o, enum emit_mode mode,
+    u64 throttle_ms, u64 idle_timeout_ms, u64 deadline_margin_ms,
+    u64 leading_edge_idle_ms);
+
+/* Reports `n_events` activity events that happened at `now_ms`
+ * (CLOCK_MONOTONIC milliseconds) to `s`.
+ * Returns the number of pulses that should be sent right away. */
+u32 emit_scheduler_on_activity(struct emit_scheduler *s,
+    u32 n_events, u64 now_ms);
+
+/* Handles the expiry of the scheduler's timer at `now_ms`.
+ * Returns the number of pulses that should be sent right away. */
+u32 emit_scheduler_on_timer(struct emit_scheduler *s, u64 now_ms);
+
+/* Destroys the scheduler `s`, closing the timer fd (if any). */
+void emit_scheduler_destroy(struct emit_scheduler *s);
+
+#endif /* EMIT_SCHEDULER_H_ */
@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include "stats.h"
+#include "key-codes.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/arena.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#define MODULE_NAME "stats"
+
+#define STATS_LISTEN_BACKLOG 4
+
+struct stats g_stats = { 0 };
+
+static void accept_clients(struct stats_server *s);
+static void disconnect_client(struct stats_server *s, struct stats_client *c);
+
+#define X_(name, str) [name] = str,
+static const char *const counter_names[STATS_N_COUNTERS] = {
+    STATS_COUNTERS_LIST
+};
+#undef X_
+
+#define X_(name, value) [value] = #name,
+static const char *const ev_type_names[EV_CNT] = {
+    EV_TYPE_LIST
+};
+#undef X_
+
+#define PRINT_(...) do {                                \
+    if (arena_printf(out, __VA_ARGS__) == NULL)         \
+        return 1;                                       \
+} while (0)
+
+i32 stats_write_global(struct arena *out)
+{
+    u_check_params(out != NULL);
+
+    for (u32 i = 0; i < STATS_N_COUNTERS; i++) {
+        PRINT_("%s %lu\n", counter_names[i],
+            (unsigned long)stats_get_global(i));
+    }
+    if (histogram_write(out, "kernel_to_read_ns", &g_stats.kernel_to_read_ns) ||
+        histogram_write(out, "read_to_emit_ns", &g_stats.read_to_emit_ns))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+i32 stats_write_device(struct arena *out, u32 index, const char *path,
+    const char *name, const struct stats_device *s)
+{
+    u_check_params(out != NULL && path != NULL && name != NULL && s != NULL);
+
+#define LOAD_(counter_) \
+    ((unsigned long)atomic_load_explicit(&(counter_), memory_order_relaxed))
+
+    PRINT_("device%u.path %s\n", index, path);
+    PRINT_("device%u.name %s\n", index, name);
+    PRINT_("device%u.reads %lu\n", index, LOAD_(s->reads));
+    PRINT_("device%u.events_read %lu\n", index, LOAD_(s->events_read));
+    PRINT_("device%u.syn_dropped %lu\n", index, LOAD_(s->syn_dropped));
+    for (u32 i = 0; i < EV_CNT; i++) {
+        const unsigned long n = LOAD_(s->filtered_by_type[i]);
+        if (n == 0)
+            continue;
+
+        if (ev_type_names[i] != NULL)
+            PRINT_("device%u.filtered.%s %lu\n", index, ev_type_names[i], n);
+        else
+            PRINT_("device%u.filtered.%#x %lu\n", index, i, n);
+    }
+
+#undef LOAD_
+
+    char prefix[64];
+    (void) snprintf(prefix, sizeof(prefix), "device%u.kernel_to_read_ns", index);
+    if (histogram_write(out, prefix, &s->kernel_to_read_ns))
+        return 1;
+    (void) snprintf(prefix, sizeof(prefix), "device%u.read_to_emit_ns", index);
+    if (histogram_write(out, prefix, &s->read_to_emit_ns))
+        return 1;
+
+    return 0;
+}
+
+#undef PRINT_
+
+void stats_reset_global(void)
+{
+    histogram_reset(&g_stats.kernel_to_read_ns);
+    histogram_reset(&g_stats.read_to_emit_ns);
+}
+
+void stats_reset_device(struct stats_device *s)
+{
+    u_check_params(s != NULL);
+
+    histogram_reset(&s->kernel_to_read_ns);
+    histogram_reset(&s->read_to_emit_ns);
+}
+
+i32 stats_server_init(struct stats_server *o, const char *path,
+    struct event_loop *loop)
+{
+    u_check_params(o != NULL && path != NULL && loop != NULL);
+    memset(o, 0, sizeof(struct stats_server));
+    o->loop = loop;
+    o->listen_src = (struct event_loop_source) {
+        .fd = -1,
+        .type = EVENT_LOOP_SOURCE_STATS,
+        .data = o,
+    };
+    for (u32 i = 0; i < STATS_MAX_CLIENTS; i++) {
+        o->clients[i].src = (struct event_loop_source) {
+            .fd = -1,
+            .type = EVENT_LOOP_SOURCE_STATS,
+            .data = o,
+        };
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path) || strlen(path) >= sizeof(o->path))
+        goto_error("The stats socket path \"%s\" is too long", path);
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+
+    /* A socket left behind by a previous instance would make bind() fail */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode))
+            goto_error("\"%s\" exists and is not a socket", path);
+        (void) unlink(path);
+    }
+
+    o->listen_src.fd = socket(AF_UNIX,
+        SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (o->listen_src.fd == -1)
+        goto_error("Failed to create the stats socket: %s", strerror(errno));
+    if (bind(o->listen_src.fd, (const struct sockaddr *)&addr, sizeof(addr)))
+        goto_error("Failed to bind the stats socket to \"%s\": %s",
+            path, strerror(errno));
+    memcpy(o->path, path, strlen(path) + 1);
+    if (listen(o->listen_src.fd, STATS_LISTEN_BACKLOG))
+        goto_error("Failed to listen on the stats socket: %s",
+            strerror(errno));
+    if (event_loop_add(loop, &o->listen_src, EPOLLIN))
+        goto_error("Failed to register the stats socket");
+
+    s_log_info("Serving the statistics on \"%s\"", path);
+    return 0;
+
+err:
+    stats_server_destroy(o);
+    return 1;
+}
+
+enum stats_request stats_server_handle(struct stats_server *s,
+    struct event_loop_source *src, struct stats_client **o_client)
+{
+    u_check_params(s != NULL && src != NULL && o_client != NULL);
+
+    if (src == &s->listen_src) {
+        accept_clients(s);
+        return STATS_REQUEST_NONE;
+    }
+
+    struct stats_client *c = (struct stats_client *)
+        ((u8 *)src - offsetof(struct stats_client, src));
+    *o_client = c;
+    if (c->src.fd == -1)
+        return STATS_REQUEST_NONE; /* Already disconnected */
+
+    while (true) {
+        /* Requests that have already been received go first */
+        char *newline = memchr(c->buf, '\n', c->buf_len);
+        if (newline != NULL) {
+            *newline = '\0';
+            const u32 line_len = newline - c->buf;
+            if (line_len > 0 && c->buf[line_len - 1] == '\r')
+                c->buf[line_len - 1] = '\0';
+
+            enum stats_request req = STATS_REQUEST_NONE;
+            if (c->buf[0] == '\0' || !strcmp(c->buf, "stats")) {
+                req = STATS_REQUEST_DUMP;
+            } else if (!strcmp(c->buf, "reset")) {
+                req = STATS_REQUEST_RESET;
+            }
+
+            c->buf_len -= line_len + 1;
+            memmove(c->buf, newline + 1, c->buf_len);
+            c->n_requests++;
+
+            if (req != STATS_REQUEST_NONE)
+                return req;
+
+            static const char error_msg[] = "ERROR unknown request\n";
+            stats_server_reply(s, c, error_msg, u_strlen(error_msg));
+            if (c->src.fd == -1)
+                return STATS_REQUEST_NONE;
+            continue;
+        }
+
+        if (c->eof) {
+            /* Those who don't ask still get the dump */
+            if (c->n_requests++ == 0)
+                return STATS_REQUEST_DUMP;
+
+            disconnect_client(s, c);
+            return STATS_REQUEST_NONE;
+        }
+
+        if (c->buf_len == STATS_CLIENT_BUF_SIZE) {
+            s_log_warn("A stats client sent a request that's too long");
+            disconnect_client(s, c);
+            return STATS_REQUEST_NONE;
+        }
+
+        const i64 n_read = read(c->src.fd, c->buf + c->buf_len,
+            STATS_CLIENT_BUF_SIZE - c->buf_len);
+        if (n_read > 0) {
+            c->buf_len += n_read;
+        } else if (n_read == 0) {
+            c->eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return STATS_REQUEST_NONE;
+        } else {
+            disconnect_client(s, c);
+            return STATS_REQUEST_NONE;
+        }
+    }
+}
+
+void stats_server_reply(struct stats_server *s, struct stats_client *c,
+    const char *text, u64 size)
+{
+    u_check_params(s != NULL && c != NULL && text != NULL);
+    if (c->src.fd == -1)
+        return;
+
+    /* The replies easily fit into the socket buffer, and there's no point
+     * in waiting for a client that doesn't read them anyway */
+    const i64 ret = send(c->src.fd, text, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (ret != (i64)size) {
+        s_log_warn("Failed to send the statistics: %s",
+            ret == -1 ? strerror(errno) : "short write");
+        disconnect_client(s, c);
+    }
+}
+
+void stats_server_destroy(struct stats_server *s)
+{
+    if (s == NULL)
+        return;
+
+    for (u32 i = 0; i < STATS_MAX_CLIENTS; i++) {
+        if (s->clients[i].src.fd != -1)
+            disconnect_client(s, &s->clients[i]);
+    }
+
+    if (s->listen_src.fd != -1) {
+        event_loop_remove(s->loop, &s->listen_src);
+        close(s->listen_src.fd);
+        s->listen_src.fd = -1;
+        if (s->path[0] != '\0')
+            (void) unlink(s->path);
+    }
+    s->path[0] = '\0';
+}
+
+static void accept_clients(struct stats_server *s)
+{
+    i32 fd = -1;
+    while (fd = accept4(s->listen_src.fd, NULL, NULL,
+            SOCK_NONBLOCK | SOCK_CLOEXEC),
+        fd != -1 || errno == EINTR)
+    {
+        if (fd == -1)
+            continue;
+
+        struct stats_client *c = NULL;
+        for (u32 i = 0; i < STATS_MAX_CLIENTS && c == NULL; i++) {
+            if (s->clients[i].src.fd == -1)
+                c = &s->clients[i];
+        }
+        if (c == NULL) {
+            static const char busy_msg[] = "ERROR too many clients\n";
+            (void) !send(fd, busy_msg, u_strlen(busy_msg),
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(fd);
+            continue;
+        }
+
+        c->src.fd = fd;
+        c->buf_len = 0;
+        c->n_requests = 0;
+        c->eof = false;
+        if (event_loop_add(s->loop, &c->src, EPOLLIN)) {
+            s_log_error("Failed to register a stats client");
+            close(fd);
+            c->src.fd = -1;
+        }
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK)
+        s_log_error("Failed to accept a connection: %s", strerror(errno));
+}
+
+static void disconnect_client(struct stats_server *s, struct stats_client *c)
+{
+    event_loop_remove(s->loop, &c->src);
+    close(c->src.fd);
+    c->src.fd = -1;
+}
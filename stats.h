@@ -0,0 +1,173 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "histogram.h"
+#include "event-loop.h"
+#include <core/int.h>
+#include <core/util.h>
+#include <core/arena.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <linux/input.h>
+
+/* Counters of what the daemon is doing on the hot path, e.g. to tell
+ * whether it's busy with stick noise or failing to emit fake keypresses.
+ *
+ * The counters are only ever written by the main thread,
+ * so an increment is a relaxed load and store instead of an atomic
+ * read-modify-write. That costs the same as a plain increment,
+ * but the counters can still be read from anywhere without tearing.
+ *
+ * Next to the counters, there are latency histograms (see `histogram.h`):
+ *  - kernel-to-read: from the kernel's timestamp of an event to the moment
+ *    the daemon got to it (only for devices that support `EVIOCSCLOCKID`),
+ *  - read-to-emit: from the read of the first activity event
+ *    to the write of the fake keypress it caused.
+ *
+ * Everything can be dumped to the log with SIGUSR2, or read from the
+ * `stats_socket` (if it's configured). Its protocol is line-based:
+ *  - "stats" (or an empty line) - dump everything, as "name value" lines
+ *    terminated by an empty line,
+ *  - "reset" - clear all the histograms (the counters are never reset),
+ *    answered with "OK",
+ * and a client that closes its end without sending anything gets the dump,
+ * e.g. `socat - UNIX-CONNECT:/run/ps4-controller-input-faker.sock </dev/null`.
+ */
+
+/* X_(enum name, name in the dump) */
+#define STATS_COUNTERS_LIST                                                 \
+    X_(STATS_WAKEUPS, "wakeups") /* Returns from `event_loop_wait` */       \
+    X_(STATS_READ_SYSCALLS, "read_syscalls") /* Incl. io_uring reads */     \
+    X_(STATS_WRITE_SYSCALLS, "write_syscalls") /* Incl. io_uring writes */  \
+    X_(STATS_WRITE_FAILURES, "write_failures") /* Of the fake keypresses */ \
+    X_(STATS_EVENTS_READ, "events_read")                                    \
+    X_(STATS_EVENTS_FILTERED, "events_filtered") /* Not activity */         \
+    X_(STATS_SYN_DROPPED, "syn_dropped")                                    \
+    X_(STATS_FAKE_KEYPRESSES, "fake_keypresses")                            \
+
+#define X_(name, str) name,
+enum stats_counter {
+    STATS_COUNTERS_LIST
+    STATS_N_COUNTERS
+};
+#undef X_
+
+struct stats {
+    _Atomic u64 counters[STATS_N_COUNTERS];
+
+    /* Of all the devices together */
+    struct histogram kernel_to_read_ns;
+    struct histogram read_to_emit_ns;
+};
+
+/* The counters of a single device */
+struct stats_device {
+    _Atomic u64 reads;
+    _Atomic u64 events_read;
+    _Atomic u64 syn_dropped;
+
+    /* The events that didn't count as activity, by their type */
+    _Atomic u64 filtered_by_type[EV_CNT];
+
+    struct histogram kernel_to_read_ns;
+    struct histogram read_to_emit_ns;
+};
+
+extern struct stats g_stats;
+
+static inline void stats_add(_Atomic u64 *counter, u64 n)
+{
+    atomic_store_explicit(counter,
+        atomic_load_explicit(counter, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+#define stats_add_global(counter, n) \
+    stats_add(&g_stats.counters[counter], n)
+
+static inline u64 stats_get_global(enum stats_counter counter)
+{
+    return atomic_load_explicit(&g_stats.counters[counter],
+        memory_order_relaxed);
+}
+
+/* The most text that `stats_write_global`
+ * and `stats_write_device` can append, respectively */
+#define STATS_TEXT_GLOBAL_MAX_SIZE 4096
+#define STATS_TEXT_DEVICE_MAX_SIZE 4096
+
+/* Appends all the global counters and histograms to the text in `out`
+ * (see `arena_printf`), as "name value" lines.
+ * Returns non-zero if they don't fit. */
+i32 stats_write_global(struct arena *out);
+
+/* Appends the counters `s` of the device `index`,
+ * as "device<index>.name value" lines (with only the non-zero counters
+ * of `filtered_by_type`). Returns non-zero if they don't fit. */
+i32 stats_write_device(struct arena *out, u32 index, const char *path,
+    const char *name, const struct stats_device *s);
+
+/* Clears the global histograms (but not the counters) */
+void stats_reset_global(void);
+
+/* Clears the histograms of the device `s` (but not its counters) */
+void stats_reset_device(struct stats_device *s);
+
+#define STATS_MAX_CLIENTS 4
+#define STATS_CLIENT_BUF_SIZE 64
+
+#define STATS_REQUESTS_LIST     \
+    X_(STATS_REQUEST_NONE)      \
+    X_(STATS_REQUEST_DUMP)      \
+    X_(STATS_REQUEST_RESET)     \
+
+#define X_(name) name,
+enum stats_request {
+    STATS_REQUESTS_LIST
+    STATS_N_REQUESTS
+};
+#undef X_
+
+struct stats_client {
+    /* `src.data` points to the server */
+    struct event_loop_source src;
+
+    char buf[STATS_CLIENT_BUF_SIZE];
+    u32 buf_len;
+    u32 n_requests;
+    bool eof;
+};
+
+/* The `stats_socket`. Both the listening socket and the clients
+ * are sources of the type `EVENT_LOOP_SOURCE_STATS`. */
+struct stats_server {
+    struct event_loop *loop;
+    struct event_loop_source listen_src;
+    filepath_t path;
+
+    struct stats_client clients[STATS_MAX_CLIENTS];
+};
+
+/* Creates a listening Unix socket at `path` (replacing a stale socket,
+ * but nothing else, that's already there) and registers it in `loop`.
+ * Returns 0 on success and non-zero on failure. */
+i32 stats_server_init(struct stats_server *o, const char *path,
+    struct event_loop *loop);
+
+/* Handles the readiness of `src`, which belongs to `s`.
+ * Returns the next request of the client (written to `*o_client`),
+ * which should be answered with `stats_server_reply`,
+ * or `STATS_REQUEST_NONE` once there are no more requests.
+ * Should be called until it returns `STATS_REQUEST_NONE`. */
+enum stats_request stats_server_handle(struct stats_server *s,
+    struct event_loop_source *src, struct stats_client **o_client);
+
+/* Sends `size` bytes of `text` to the client `c` of `s`.
+ * A client that isn't reading its replies is disconnected. */
+void stats_server_reply(struct stats_server *s, struct stats_client *c,
+    const char *text, u64 size);
+
+/* Disconnects all the clients, closes the socket and removes it */
+void stats_server_destroy(struct stats_server *s);
+
+#endif /* STATS_H_ */
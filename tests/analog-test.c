@@ -0,0 +1,214 @@
+#include "analog.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <stdlib.h>
+#include <linux/input-event-codes.h>
+
+#define MODULE_NAME "analog-test"
+
+#define DEADZONE_PERCENT 10
+#define HYSTERESIS_PERCENT 3
+#define RECALIBRATE_MS 10000
+
+/* 1 kHz, like a DualShock 4 over USB */
+#define SAMPLE_PERIOD_NS 1000000ULL
+
+#define expect_activity(expr, n) do {                                       \
+    const u32 n_ = (expr);                                                  \
+    if (n_ != (n)) {                                                        \
+        s_log_error("%s: expected %u activity event(s), got %u",            \
+            #expr, (n), n_);                                                \
+        goto err;                                                           \
+    }                                                                       \
+} while (0)
+
+static const struct analog_params params = {
+    .enabled = true,
+    .deadzone_percent = DEADZONE_PERCENT,
+    .hysteresis_percent = HYSTERESIS_PERCENT,
+    .recalibrate_ns = RECALIBRATE_MS * 1000000ULL,
+};
+
+static u64 now_ns;
+
+static i32 test_noise(void);
+static i32 test_drift(void);
+static i32 test_excursion(void);
+static i32 test_hysteresis(void);
+static i32 test_trigger(void);
+static i32 test_stuck(void);
+static i32 test_disabled(void);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    if (test_noise() || test_drift() || test_excursion() ||
+        test_hysteresis() || test_trigger() || test_stuck() ||
+        test_disabled())
+    {
+        s_log_info("Test result is FAIL");
+        return EXIT_FAILURE;
+    }
+
+    s_log_info("Test result is OK");
+    return EXIT_SUCCESS;
+}
+
+/* Feeds the values from `from` to `to` (inclusive) in `n` evenly spaced
+ * steps, each with `noise` added in turns, one sample per millisecond.
+ * Returns the number of activity events. */
+static u32 feed_ramp(struct analog_detector *d, u16 code,
+    i32 from, i32 to, u32 n, i32 noise)
+{
+    u32 n_activity = 0;
+    for (u32 i = 0; i < n; i++) {
+        const i32 value = from + (i32)(((i64)to - from) * i / (n > 1 ? n - 1 : 1))
+            + (i % 2 ? noise : -noise);
+        n_activity += analog_detector_feed(d, code, value, now_ns);
+        now_ns += SAMPLE_PERIOD_NS;
+    }
+    return n_activity;
+}
+
+static u32 feed(struct analog_detector *d, u16 code, i32 value)
+{
+    const u32 ret = analog_detector_feed(d, code, value, now_ns);
+    now_ns += SAMPLE_PERIOD_NS;
+    return ret;
+}
+
+static i32 test_noise(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 128);
+
+    /* A few seconds of the usual jitter of a resting stick */
+    expect_activity(feed_ramp(&d, ABS_X, 128, 128, 5000, 3), 0);
+    expect_activity(feed_ramp(&d, ABS_RY, 130, 130, 5000, 5), 0);
+
+    /* Not an analog axis at all */
+    expect_activity(feed(&d, ABS_HAT0X, 1), 0);
+    expect_activity(feed(&d, ABS_MT_POSITION_X, 1000), 0);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_drift(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 128);
+
+    /* A worn-out stick drifting far beyond the deadzone over a minute
+     * should be followed by the rest position */
+    expect_activity(feed_ramp(&d, ABS_Y, 128, 190, 60000, 2), 0);
+
+    /* ...and then still register a real push, relative to the new rest */
+    expect_activity(feed(&d, ABS_Y, 255), 1);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_excursion(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 128);
+
+    /* Leaving the deadzone counts once... */
+    expect_activity(feed(&d, ABS_RX, 200), 1);
+    /* ...holding still (with noise) doesn't */
+    expect_activity(feed_ramp(&d, ABS_RX, 200, 200, 1000, 2), 0);
+    /* ...but moving further does, once per hysteresis step */
+    expect_activity(feed(&d, ABS_RX, 230), 1);
+    expect_activity(feed(&d, ABS_RX, 233), 0);
+    expect_activity(feed(&d, ABS_RX, 200), 1);
+    /* Going back to rest doesn't */
+    expect_activity(feed_ramp(&d, ABS_RX, 128, 128, 100, 1), 0);
+    /* The other axes are independent */
+    expect_activity(feed(&d, ABS_X, 10), 1);
+    expect_activity(feed(&d, ABS_RX, 20), 1);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_hysteresis(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 128);
+
+    /* The edge of the deadzone is 128 + 25; noise around it
+     * should only count when it's first crossed */
+    u32 n = 0;
+    for (u32 i = 0; i < 1000; i++)
+        n += feed(&d, ABS_X, i % 2 ? 128 + 24 : 128 + 27);
+    expect_activity(n, 1);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_trigger(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 0);
+
+    /* Triggers rest at the minimum */
+    expect_activity(feed_ramp(&d, ABS_Z, 2, 2, 1000, 2), 0);
+    expect_activity(feed(&d, ABS_RZ, 128), 1);
+    expect_activity(feed(&d, ABS_RZ, 0), 0);
+    expect_activity(feed(&d, ABS_Z, 255), 1);
+
+    /* Initialized while pressed - still assumed to rest at the minimum */
+    analog_detector_init_range(&d, &params, 0, 255, 255);
+    expect_activity(feed(&d, ABS_Z, 255), 1);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_stuck(void)
+{
+    struct analog_detector d;
+    analog_detector_init_range(&d, &params, 0, 255, 128);
+
+    /* A stick stuck far from the center counts once... */
+    expect_activity(feed(&d, ABS_Y, 30), 1);
+    /* ...and after `RECALIBRATE_MS` becomes the new rest */
+    expect_activity(feed_ramp(&d, ABS_Y, 30, 30, RECALIBRATE_MS + 10, 3), 0);
+    expect_activity(feed_ramp(&d, ABS_Y, 30, 30, 60000, 6), 0);
+    /* Pushing it somewhere else still counts */
+    expect_activity(feed(&d, ABS_Y, 128), 1);
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_disabled(void)
+{
+    struct analog_params disabled = params;
+    disabled.enabled = false;
+
+    struct analog_detector d;
+    analog_detector_init_range(&d, &disabled, 0, 255, 128);
+    expect_activity(feed(&d, ABS_X, 0), 0);
+    expect_activity(feed(&d, ABS_Z, 255), 0);
+
+    /* No device to query */
+    analog_detector_init(&d, -1, &params);
+    expect_activity(feed(&d, ABS_X, 128), 0);
+    expect_activity(feed(&d, ABS_X, 255), 1);
+
+    return 0;
+err:
+    return 1;
+}
@@ -0,0 +1,141 @@
+#include "device-registry.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/arena.h>
+#include <core/pool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#include <linux/major.h>
+
+#define MODULE_NAME "device-registry-test"
+
+#define N_ROUNDS 1000
+
+static dev_t devnum_of(u32 n);
+static i32 check_contents(const struct device_registry *r,
+    const bool present[DEVICE_REGISTRY_MAX_DEVICES * 4]);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    i32 ret = EXIT_FAILURE;
+    struct arena arena = { 0 };
+    struct device_registry r = { 0 };
+    if (arena_init(&arena, DEVICE_REGISTRY_ARENA_SIZE))
+        goto_error("Failed to create the arena");
+    if (device_registry_init(&r, &arena))
+        goto_error("Failed to initialize the registry");
+
+    /* Basic add, find and remove */
+    struct device *dev = device_registry_add(&r, devnum_of(3));
+    if (dev == NULL || device_registry_find(&r, devnum_of(3)) != dev)
+        goto_error("Failed to add and find a device");
+    if (device_registry_add(&r, devnum_of(3)) != NULL)
+        goto_error("A device number was registered twice");
+    if (device_registry_add(&r, EVDEV_DEVNUM_NONE) == NULL ||
+        device_registry_add(&r, EVDEV_DEVNUM_NONE) == NULL)
+        goto_error("Failed to add devices without a device number");
+    if (device_registry_count(&r) != 3)
+        goto_error("Expected 3 devices, got %u", device_registry_count(&r));
+
+    const struct device_id id = device_registry_get_id(dev);
+    const u32 slot = dev->slot;
+    dev->src.fd = 42;
+    device_registry_remove(&r, dev);
+    if (dev->src.fd != -1 || device_registry_find(&r, devnum_of(3)) != NULL)
+        goto_error("The removed device can still be found");
+    if (device_registry_lookup(&r, id) != NULL)
+        goto_error("The id of the removed device is still valid");
+
+    /* The slot can't be reused before the batch is over */
+    struct device *other = device_registry_add(&r, devnum_of(4));
+    if (other == NULL || other->slot == slot)
+        goto_error("The slot of the removed device was reused too early");
+    device_registry_collect(&r);
+    while (device_registry_count(&r) > 0)
+        device_registry_remove(&r, device_registry_at(&r, 0));
+    device_registry_collect(&r);
+
+    /* Slots 0-3 have been used, and are reused before any of the others */
+    for (u32 n = 5; n < 9; n++) {
+        dev = device_registry_add(&r, devnum_of(n));
+        if (dev == NULL || dev->slot >= 4)
+            goto_error("The free slots aren't reused");
+        if (dev->slot == slot)
+            break;
+    }
+    if (dev->slot != slot)
+        goto_error("The slot of the removed device wasn't reused");
+    if (device_registry_lookup(&r, id) != NULL)
+        goto_error("The stale id refers to the new device");
+    if (device_registry_lookup(&r, device_registry_get_id(dev)) != dev)
+        goto_error("Failed to look up the new device by its id");
+    while (device_registry_count(&r) > 0)
+        device_registry_remove(&r, device_registry_at(&r, 0));
+    device_registry_collect(&r);
+
+    /* Random adds and removes, with plenty of collisions */
+    bool present[DEVICE_REGISTRY_MAX_DEVICES * 4] = { 0 };
+    srand(12345);
+    for (u32 i = 0; i < N_ROUNDS; i++) {
+        const u32 n = rand() % u_arr_size(present);
+        struct device *d = device_registry_find(&r, devnum_of(n));
+        if ((d != NULL) != present[n])
+            goto_error("Round %u: device %u is%s registered", i, n,
+                d == NULL ? "n't" : "");
+
+        if (d != NULL) {
+            device_registry_remove(&r, d);
+            present[n] = false;
+        } else if (!pool_is_full(&r.slots)) {
+            /* (The removed devices' slots are only free after a collect) */
+            if (device_registry_add(&r, devnum_of(n)) == NULL)
+                goto_error("Round %u: failed to add device %u", i, n);
+            present[n] = true;
+        } else if (device_registry_add(&r, devnum_of(n)) != NULL) {
+            goto_error("Round %u: added a device to a full registry", i);
+        }
+
+        if (rand() % 4 == 0)
+            device_registry_collect(&r);
+        if (check_contents(&r, present))
+            goto_error("Round %u: the registry is inconsistent", i);
+    }
+
+    ret = EXIT_SUCCESS;
+err:
+    if (r.devices != NULL) {
+        while (device_registry_count(&r) > 0)
+            device_registry_remove(&r, device_registry_at(&r, 0));
+    }
+    device_registry_destroy(&r);
+    arena_destroy(&arena);
+
+    s_log_info("Test result is %s", ret == EXIT_SUCCESS ? "OK" : "FAIL");
+    return ret;
+}
+
+static dev_t devnum_of(u32 n)
+{
+    return makedev(INPUT_MAJOR, 64 + n);
+}
+
+static i32 check_contents(const struct device_registry *r,
+    const bool present[DEVICE_REGISTRY_MAX_DEVICES * 4])
+{
+    u32 n_present = 0;
+    for (u32 i = 0; i < DEVICE_REGISTRY_MAX_DEVICES * 4; i++) {
+        if (!present[i])
+            continue;
+
+        n_present++;
+        const struct device *dev = device_registry_find(r, devnum_of(i));
+        if (dev == NULL || device_registry_info(r, dev)->devnum != devnum_of(i))
+            return 1;
+    }
+
+    return n_present != device_registry_count(r);
+}
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "evdev.h"
+#include "evdev-source.h"
+#include "monitor.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/vector.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "event-source-test"
+
+#define N_RECORDED_EVENTS 1000
+
+static i32 write_recording(const char *path, u32 n_events);
+static i32 expect_n_events(struct evdev *dev, u32 n_events);
+static i32 test_monitor(const char *root_dir);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    i32 ret = EXIT_FAILURE;
+    char root_dir[] = "/tmp/event-source-test.XXXXXX";
+    char fifo_path[u_FILEPATH_MAX] = { 0 };
+    char rec_path[u_FILEPATH_MAX] = { 0 };
+    VECTOR(struct evdev) devs = NULL;
+    i32 sock_fds[2] = { -1, -1 };
+    i32 fifo_fd = -1;
+
+    if (mkdtemp(root_dir) == NULL)
+        goto_error("Failed to create a temporary directory: %s",
+            strerror(errno));
+
+    (void) snprintf(fifo_path, u_FILEPATH_MAX, "%s/event0", root_dir);
+    (void) snprintf(rec_path, u_FILEPATH_MAX, "%s/event1", root_dir);
+    if (mkfifo(fifo_path, 0600))
+        goto_error("Failed to create the FIFO: %s", strerror(errno));
+    if (write_recording(rec_path, N_RECORDED_EVENTS))
+        goto err;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock_fds))
+        goto_error("Failed to create a socketpair: %s", strerror(errno));
+
+    struct evdev_source source = {
+        .type = EVDEV_SOURCE_EMULATED,
+        .emulated_type = EVDEV_TYPE_PS4_CONTROLLER,
+    };
+    strncpy(source.root_dir, root_dir, u_FILEPATH_MAX);
+    evdev_source_set(&source);
+    if (evdev_source_add_fd("event2", sock_fds[0],
+            EVDEV_TYPE_PS4_CONTROLLER, "Socket controller"))
+        goto_error("Failed to register the socket");
+
+    devs = evdev_find_and_load_devices(EVDEV_MASK_PS4_CONTROLLER);
+    if (devs == NULL)
+        goto_error("Failed to load the emulated devices");
+    if (vector_size(devs) != 3)
+        goto_error("Expected 3 devices, got %u", vector_size(devs));
+    if (strcmp(devs[2].name, "Socket controller"))
+        goto_error("Unexpected name of the socket device: \"%s\"",
+            devs[2].name);
+
+    /* FIFO */
+    fifo_fd = open(fifo_path, O_WRONLY | O_CLOEXEC);
+    if (fifo_fd == -1)
+        goto_error("Failed to open the FIFO for writing: %s", strerror(errno));
+    const struct input_event ev = { .type = EV_KEY, .code = BTN_SOUTH };
+    for (u32 i = 0; i < 3; i++) {
+        if (write(fifo_fd, &ev, sizeof(ev)) != sizeof(ev))
+            goto_error("Failed to write to the FIFO: %s", strerror(errno));
+    }
+    if (expect_n_events(&devs[0], 3))
+        goto err;
+
+    /* Recording */
+    if (expect_n_events(&devs[1], N_RECORDED_EVENTS))
+        goto err;
+
+    /* Socketpair */
+    if (write(sock_fds[1], &ev, sizeof(ev)) != sizeof(ev))
+        goto_error("Failed to write to the socket: %s", strerror(errno));
+    if (expect_n_events(&devs[2], 1))
+        goto err;
+
+    if (test_monitor(root_dir))
+        goto err;
+
+    ret = EXIT_SUCCESS;
+err:
+    evdev_list_destroy(&devs);
+    evdev_source_clear_fds();
+    evdev_source_set(NULL);
+    if (fifo_fd != -1) close(fifo_fd);
+    if (sock_fds[0] != -1) close(sock_fds[0]);
+    if (sock_fds[1] != -1) close(sock_fds[1]);
+    if (fifo_path[0]) (void) unlink(fifo_path);
+    if (rec_path[0]) (void) unlink(rec_path);
+    (void) rmdir(root_dir);
+
+    s_log_info("Test result is %s", ret == EXIT_SUCCESS ? "OK" : "FAIL");
+    return ret;
+}
+
+static i32 write_recording(const char *path, u32 n_events)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        s_log_error("Failed to create \"%s\": %s", path, strerror(errno));
+        return 1;
+    }
+
+    for (u32 i = 0; i < n_events; i++) {
+        const struct input_event ev = {
+            .type = i % 2 ? EV_SYN : EV_ABS,
+            .code = i % 2 ? SYN_REPORT : ABS_X,
+            .value = i,
+        };
+        if (fwrite(&ev, sizeof(ev), 1, fp) != 1) {
+            s_log_error("Failed to write to \"%s\"", path);
+            fclose(fp);
+            return 1;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+static i32 expect_n_events(struct evdev *dev, u32 n_events)
+{
+    struct input_event buf[64];
+    u32 total = 0;
+    i64 n_read = 0;
+    while (n_read = read(dev->fd, buf, sizeof(buf)), n_read > 0)
+        total += n_read / sizeof(struct input_event);
+
+    if (total != n_events) {
+        s_log_error("Expected %u events from %s, got %u",
+            n_events, dev->path, total);
+        return 1;
+    }
+
+    return 0;
+}
+
+static i32 test_monitor(const char *root_dir)
+{
+    struct evdev_monitor mon = { .fd = -1, .destroyed__ = true };
+    VECTOR(char *) created = NULL;
+    VECTOR(char *) deleted = NULL;
+    char tmp_path[u_FILEPATH_MAX] = { 0 };
+    char new_path[u_FILEPATH_MAX] = { 0 };
+    i32 ret = 1;
+
+    if (evdev_monitor_init(&mon))
+        goto_error("Failed to initialize the monitor");
+
+    /* Recordings are moved into place, so that they're complete
+     * by the time they're noticed */
+    (void) snprintf(tmp_path, u_FILEPATH_MAX, "%s/tmp-recording", root_dir);
+    (void) snprintf(new_path, u_FILEPATH_MAX, "%s/event3", root_dir);
+    if (write_recording(tmp_path, 2))
+        goto err;
+    if (rename(tmp_path, new_path))
+        goto_error("Failed to rename the recording: %s", strerror(errno));
+    if (unlink(new_path))
+        goto_error("Failed to delete the recording: %s", strerror(errno));
+
+    if (evdev_monitor_poll_and_read(&mon, 1000, &created, &deleted))
+        goto_error("Failed to read from the monitor");
+    if (vector_size(created) != 1 || strcmp(created[0], "event3"))
+        goto_error("The creation of event3 wasn't reported");
+    if (vector_size(deleted) != 1 || strcmp(deleted[0], "event3"))
+        goto_error("The deletion of event3 wasn't reported");
+
+    ret = 0;
+err:
+    (void) unlink(tmp_path);
+    if (created != NULL) {
+        for (u32 i = 0; i < vector_size(created); i++)
+            u_nfree(&created[i]);
+        vector_destroy(&created);
+    }
+    if (deleted != NULL) {
+        for (u32 i = 0; i < vector_size(deleted); i++)
+            u_nfree(&deleted[i]);
+        vector_destroy(&deleted);
+    }
+    evdev_monitor_destroy(&mon);
+    return ret;
+}
@@ -0,0 +1,119 @@
+#include "histogram.h"
+#include <core/log.h>
+#include <core/util.h>
+#include <stdlib.h>
+
+#define MODULE_NAME "histogram-test"
+
+#define N_VALUES 100000
+
+static struct histogram h;
+
+static i32 test_buckets(void);
+static i32 test_percentiles(void);
+static i32 test_reset(void);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    if (test_buckets() || test_percentiles() || test_reset()) {
+        s_log_info("Test result is FAIL");
+        return EXIT_FAILURE;
+    }
+
+    s_log_info("Test result is OK");
+    return EXIT_SUCCESS;
+}
+
+static i32 test_buckets(void)
+{
+    /* The buckets must cover all the values without gaps or overlaps */
+    u64 expected_lower_bound = 0;
+    for (u32 i = 0; i < HISTOGRAM_N_BUCKETS; i++) {
+        const u64 lower = histogram_bucket_lower_bound(i);
+        const u64 upper = histogram_bucket_upper_bound(i);
+        if (lower != expected_lower_bound)
+            goto_error("Bucket %u starts at %lu, expected %lu", i,
+                (unsigned long)lower, (unsigned long)expected_lower_bound);
+        if (upper < lower)
+            goto_error("Bucket %u is empty", i);
+        if (histogram_bucket_index(lower) != i ||
+            histogram_bucket_index(upper) != i)
+        {
+            goto_error("The bounds of bucket %u don't map back to it", i);
+        }
+        /* Every bucket is at most 1/16 of the values in it wide */
+        if (lower >= HISTOGRAM_N_SUB_BUCKETS &&
+            (upper - lower + 1) * HISTOGRAM_N_SUB_BUCKETS > lower)
+        {
+            goto_error("Bucket %u ([%lu, %lu]) is too wide", i,
+                (unsigned long)lower, (unsigned long)upper);
+        }
+        expected_lower_bound = upper + 1;
+    }
+    if (expected_lower_bound != HISTOGRAM_MAX_VALUE + 1)
+        goto_error("The buckets end at %lu",
+            (unsigned long)expected_lower_bound - 1);
+
+    if (histogram_bucket_index(~0ULL) != HISTOGRAM_N_BUCKETS - 1)
+        goto_error("Values above the maximum aren't clamped");
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_percentiles(void)
+{
+    histogram_reset(&h);
+    if (histogram_percentile(&h, 50) != 0)
+        goto_error("An empty histogram has a non-zero median");
+
+    /* 1 us ... 100 ms */
+    for (u64 i = 1; i <= N_VALUES; i++)
+        histogram_record(&h, i * 1000);
+
+    static const f64 percentiles[] = { 0, 50, 90, 99, 99.9, 100 };
+    for (u32 i = 0; i < u_arr_size(percentiles); i++) {
+        u64 expected = percentiles[i] / 100.0 * N_VALUES * 1000;
+        if (expected < 1000)
+            expected = 1000;
+
+        const u64 got = histogram_percentile(&h, percentiles[i]);
+        if (got < expected || got - expected > expected / 16)
+            goto_error("p%g is %lu, expected %lu (+ 1/16)", percentiles[i],
+                (unsigned long)got, (unsigned long)expected);
+    }
+
+    if (atomic_load(&h.count) != N_VALUES)
+        goto_error("The count is %lu", (unsigned long)atomic_load(&h.count));
+    if (atomic_load(&h.max) != N_VALUES * 1000)
+        goto_error("The maximum is %lu", (unsigned long)atomic_load(&h.max));
+    if (atomic_load(&h.sum) / N_VALUES != (N_VALUES + 1) * 1000 / 2)
+        goto_error("The mean is %lu",
+            (unsigned long)(atomic_load(&h.sum) / N_VALUES));
+
+    return 0;
+err:
+    return 1;
+}
+
+static i32 test_reset(void)
+{
+    histogram_record(&h, 12345);
+    histogram_reset(&h);
+    if (atomic_load(&h.count) != 0 || atomic_load(&h.max) != 0 ||
+        histogram_percentile(&h, 99) != 0)
+    {
+        goto_error("The histogram isn't empty after a reset");
+    }
+
+    histogram_record(&h, 7);
+    if (histogram_percentile(&h, 50) != 7 || histogram_percentile(&h, 0) != 7)
+        goto_error("A single value isn't its own percentile after a reset");
+
+    return 0;
+err:
+    return 1;
+}
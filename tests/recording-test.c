@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "evdev.h"
+#include "recording.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "recording-test"
+
+#define RECORDING_PATH "/tmp/recording-test.rec"
+#define N_FRAMES 5000
+#define FRAME_INTERVAL_US 4000 /* A controller at 250 Hz */
+
+static struct input_event make_event(u32 i, i64 ts_us);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    i32 ret = EXIT_FAILURE;
+    struct recording rec = { 0 };
+    struct recorder recorder = { 0 };
+    const i64 t0_us = 1700000000LL * 1000000;
+
+    /* Record a stick movement with a SYN_REPORT after every event,
+     * alternating between 2 devices */
+    struct evdev devs[2] = {
+        { .fd = -1, .type = EVDEV_TYPE_PS4_CONTROLLER, .name = "Pad 0" },
+        { .fd = -1, .type = EVDEV_TYPE_PS4_CONTROLLER, .name = "Pad 1" },
+    };
+    if (recorder_init(&recorder, RECORDING_PATH))
+        goto_error("Failed to create the recording");
+    u32 ids[2];
+    for (u32 i = 0; i < 2; i++)
+        ids[i] = recorder_add_device(&recorder, &devs[i]);
+    for (u32 i = 0; i < N_FRAMES; i++) {
+        const i64 ts = t0_us + (i64)i * FRAME_INTERVAL_US;
+        const struct input_event frame[2] = {
+            make_event(i, ts),
+            { .type = EV_SYN, .code = SYN_REPORT, .value = 0,
+                .input_event_sec = ts / 1000000,
+                .input_event_usec = ts % 1000000 },
+        };
+        recorder_write_events(&recorder, ids[i % 2], frame, 2);
+    }
+    recorder_remove_device(&recorder, ids[0]);
+    const u64 raw_size = 2ULL * N_FRAMES * sizeof(struct input_event);
+    const u64 rec_size = recorder.offset;
+    if (recorder_destroy(&recorder))
+        goto_error("Failed to finish the recording");
+
+    if (rec_size * 3 > raw_size)
+        goto_error("The recording is too large (%lu bytes, raw %lu bytes)",
+            (unsigned long)rec_size, (unsigned long)raw_size);
+
+    /* Read it back */
+    if (recording_open(&rec, RECORDING_PATH))
+        goto_error("Failed to open the recording");
+    if (vector_size(rec.devices) != 2 ||
+        rec.devices[1].type != EVDEV_TYPE_PS4_CONTROLLER ||
+        strcmp(rec.devices[1].name, "Pad 1"))
+    {
+        goto_error("The device table doesn't match");
+    }
+
+    struct recording_cursor cursor;
+    struct recording_item item;
+    recording_rewind(&rec, &cursor);
+    u32 n_events = 0, n_removed = 0;
+    i32 r = 0;
+    while (r = recording_next(&rec, &cursor, &item), r == 0) {
+        if (item.kind == RECORDING_ITEM_DEVICE_REMOVE) {
+            n_removed++;
+            continue;
+        } else if (item.kind == RECORDING_ITEM_DEVICE_ADD) {
+            continue;
+        }
+
+        const u32 frame = n_events / 2;
+        const i64 ts = t0_us + (i64)frame * FRAME_INTERVAL_US;
+        const struct input_event expected = n_events % 2 ?
+            (struct input_event) { .type = EV_SYN, .code = SYN_REPORT } :
+            make_event(frame, ts);
+        if (item.device_id != ids[frame % 2] || item.ts_us != ts ||
+            item.ev.type != expected.type || item.ev.code != expected.code ||
+            item.ev.value != expected.value)
+        {
+            goto_error("Event %u doesn't match", n_events);
+        }
+        n_events++;
+    }
+    if (r < 0 || n_events != 2 * N_FRAMES || n_removed != 1)
+        goto_error("Read %u events (%u removals), result %i",
+            n_events, n_removed, r);
+
+    /* Seeking */
+    const u32 seek_frame = N_FRAMES - 123;
+    recording_seek(&rec, &cursor,
+        t0_us + (i64)seek_frame * FRAME_INTERVAL_US);
+    if (recording_next(&rec, &cursor, &item) ||
+        item.ev.value != make_event(seek_frame, 0).value ||
+        cursor.event_index != 2 * seek_frame + 1)
+    {
+        goto_error("Seeking to frame %u failed", seek_frame);
+    }
+
+    ret = EXIT_SUCCESS;
+err:
+    recording_close(&rec);
+    (void) unlink(RECORDING_PATH);
+    s_log_info("Test result is %s", ret == EXIT_SUCCESS ? "OK" : "FAIL");
+    return ret;
+}
+
+static struct input_event make_event(u32 i, i64 ts_us)
+{
+    return (struct input_event) {
+        .type = EV_ABS,
+        .code = i % 3 ? ABS_X : ABS_HAT0X,
+        .value = (i32)(i % 256) - 128,
+        .input_event_sec = ts_us / 1000000,
+        .input_event_usec = ts_us % 1000000,
+    };
+}
@@ -0,0 +1,118 @@
+#include "scheduler.h"
+#include <core/log.h>
+#include <core/util.h>
+#include <stdlib.h>
+
+#define MODULE_NAME "scheduler-test"
+
+#define THROTTLE_MS 1000
+#define IDLE_TIMEOUT_MS 60000
+#define DEADLINE_MARGIN_MS 5000
+#define LEADING_EDGE_IDLE_MS 2000
+
+#define expect_pulses(expr, n) do {                                     \
+    const u32 n_ = (expr);                                              \
+    if (n_ != (n)) {                                                    \
+        s_log_error("%s: expected %u pulse(s), got %u", #expr, (n), n_);\
+        goto err;                                                       \
+    }                                                                   \
+} while (0)
+
+static i32 test_every_event(void);
+static i32 test_throttle(void);
+static i32 test_deadline(void);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    if (test_every_event() || test_throttle() || test_deadline()) {
+        s_log_info("Test result is FAIL");
+        return EXIT_FAILURE;
+    }
+
+    s_log_info("Test result is OK");
+    return EXIT_SUCCESS;
+}
+
+static i32 test_every_event(void)
+{
+    struct emit_scheduler s = { 0 };
+    if (emit_scheduler_init(&s, EMIT_MODE_EVERY_EVENT, THROTTLE_MS,
+            IDLE_TIMEOUT_MS, DEADLINE_MARGIN_MS, LEADING_EDGE_IDLE_MS))
+        goto_error("Failed to initialize the scheduler");
+
+    expect_pulses(emit_scheduler_on_activity(&s, 5, 100), 5);
+    expect_pulses(emit_scheduler_on_activity(&s, 0, 101), 0);
+    expect_pulses(emit_scheduler_on_activity(&s, 1, 102), 1);
+
+    emit_scheduler_destroy(&s);
+    return 0;
+err:
+    emit_scheduler_destroy(&s);
+    return 1;
+}
+
+static i32 test_throttle(void)
+{
+    struct emit_scheduler s = { 0 };
+    if (emit_scheduler_init(&s, EMIT_MODE_THROTTLE, THROTTLE_MS,
+            IDLE_TIMEOUT_MS, DEADLINE_MARGIN_MS, LEADING_EDGE_IDLE_MS))
+        goto_error("Failed to initialize the scheduler");
+
+    /* The first event is always forwarded */
+    expect_pulses(emit_scheduler_on_activity(&s, 10, 10000), 1);
+
+    /* Button mashing - one pulse per `THROTTLE_MS` */
+    u32 n_pulses = 0;
+    for (u64 t = 10010; t < 10000 + 5 * THROTTLE_MS; t += 10)
+        n_pulses += emit_scheduler_on_activity(&s, 3, t);
+    expect_pulses(n_pulses, 4);
+
+    /* Leading edge after a long idle period */
+    expect_pulses(emit_scheduler_on_activity(&s, 1,
+        10000 + 5 * THROTTLE_MS + LEADING_EDGE_IDLE_MS), 1);
+
+    emit_scheduler_destroy(&s);
+    return 0;
+err:
+    emit_scheduler_destroy(&s);
+    return 1;
+}
+
+static i32 test_deadline(void)
+{
+    struct emit_scheduler s = { 0 };
+    if (emit_scheduler_init(&s, EMIT_MODE_DEADLINE, THROTTLE_MS,
+            IDLE_TIMEOUT_MS, DEADLINE_MARGIN_MS, LEADING_EDGE_IDLE_MS))
+        goto_error("Failed to initialize the scheduler");
+
+    const u64 interval = IDLE_TIMEOUT_MS - DEADLINE_MARGIN_MS;
+    const u64 t0 = 100000;
+
+    /* Leading edge */
+    expect_pulses(emit_scheduler_on_activity(&s, 1, t0), 1);
+
+    /* Continuous activity doesn't produce any pulses until the deadline */
+    u32 n_pulses = 0;
+    for (u64 t = t0 + 100; t < t0 + interval; t += 100)
+        n_pulses += emit_scheduler_on_activity(&s, 2, t);
+    expect_pulses(n_pulses, 0);
+    if (!s.timer_armed_ || s.timer_deadline_ms_ != t0 + interval)
+        goto_error("The deadline timer wasn't armed properly");
+
+    /* The timer fires - there was activity, so a pulse is due */
+    expect_pulses(emit_scheduler_on_timer(&s, t0 + interval), 1);
+
+    /* No activity since the last pulse - nothing to send */
+    expect_pulses(emit_scheduler_on_timer(&s, t0 + 2 * interval), 0);
+
+    /* Activity after the deadline has already passed is sent right away */
+    expect_pulses(emit_scheduler_on_activity(&s, 1, t0 + 3 * interval), 1);
+
+    emit_scheduler_destroy(&s);
+    return 0;
+err:
+    emit_scheduler_destroy(&s);
+    return 1;
+}
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include "evdev.h"
+#include "evdev-source.h"
+#include "monitor.h"
+#include "event-loop.h"
+#include "device-registry.h"
+#include "stats.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <core/arena.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "steady-state-alloc-test"
+
+/* Connects and disconnects controllers the way the daemon handles them,
+ * and checks that nothing is allocated once everything is set up */
+
+#define N_CYCLES 50
+#define N_CONTROLLERS 3
+#define N_EVENTS_PER_CYCLE 8
+#define WAIT_TIMEOUT_MS 1000
+
+#define TEST_ARENA_SIZE (DEVICE_REGISTRY_ARENA_SIZE + \
+    STATS_TEXT_GLOBAL_MAX_SIZE + N_CONTROLLERS * STATS_TEXT_DEVICE_MAX_SIZE)
+
+static _Atomic u64 g_n_allocs = 0;
+static _Atomic u64 g_n_frees = 0;
+static _Atomic bool g_counting = false;
+
+static void count_alloc(void);
+static void count_free(void);
+static i32 install_alloc_hooks(void);
+
+struct test_ctx {
+    const char *root_dir;
+    struct arena arena;
+    struct device_registry devices;
+    struct evdev_monitor mon;
+    struct event_loop loop;
+    struct event_loop_source mon_src;
+};
+
+static i32 run_cycle(struct test_ctx *ctx, u32 cycle);
+static struct device * connect_controller(struct test_ctx *ctx,
+    const char *name);
+static i32 wait_for_source(struct test_ctx *ctx,
+    const struct event_loop_source *src, u32 events);
+static i32 dump_stats(struct test_ctx *ctx);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    i32 ret = EXIT_FAILURE;
+    char root_dir[] = "/tmp/steady-state-alloc-test.XXXXXX";
+    struct test_ctx ctx = {
+        .root_dir = root_dir,
+        .mon = { .fd = -1, .destroyed__ = true },
+        .loop = { .epoll_fd = -1 },
+    };
+    bool devices_initialized = false;
+
+    if (install_alloc_hooks())
+        goto_error("Failed to install the allocation hooks");
+
+    /* Startup */
+    if (mkdtemp(root_dir) == NULL)
+        goto_error("Failed to create a temporary directory: %s",
+            strerror(errno));
+    struct evdev_source source = {
+        .type = EVDEV_SOURCE_EMULATED,
+        .emulated_type = EVDEV_TYPE_PS4_CONTROLLER,
+    };
+    strncpy(source.root_dir, root_dir, u_FILEPATH_MAX);
+    evdev_source_set(&source);
+
+    if (arena_init(&ctx.arena, TEST_ARENA_SIZE) ||
+        device_registry_init(&ctx.devices, &ctx.arena))
+        goto_error("Failed to initialize the device registry");
+    devices_initialized = true;
+    if (event_loop_init(&ctx.loop, EVENT_LOOP_BACKEND_EPOLL))
+        goto_error("Failed to initialize the event loop");
+    if (evdev_monitor_init(&ctx.mon))
+        goto_error("Failed to initialize the monitor");
+    ctx.mon_src = (struct event_loop_source) {
+        .fd = ctx.mon.fd,
+        .type = EVENT_LOOP_SOURCE_MONITOR,
+    };
+    if (event_loop_add(&ctx.loop, &ctx.mon_src, EPOLLIN))
+        goto_error("Failed to register the monitor");
+
+    /* The first cycle may still set things up (e.g. stdio buffers) */
+    if (run_cycle(&ctx, 0))
+        goto err;
+
+    atomic_store(&g_counting, true);
+    for (u32 i = 1; i <= N_CYCLES; i++) {
+        if (run_cycle(&ctx, i))
+            goto err;
+    }
+    atomic_store(&g_counting, false);
+
+    if (atomic_load(&g_n_allocs) != 0 || atomic_load(&g_n_frees) != 0) {
+        goto_error("%lu allocation(s) and %lu free(s) in %u cycles",
+            (unsigned long)atomic_load(&g_n_allocs),
+            (unsigned long)atomic_load(&g_n_frees), N_CYCLES);
+    }
+    s_log_info("No allocations in %u connect/disconnect cycles "
+        "(%lu of %lu bytes of the arena used)", N_CYCLES,
+        (unsigned long)ctx.arena.high_water, (unsigned long)ctx.arena.size);
+
+    ret = EXIT_SUCCESS;
+err:
+    atomic_store(&g_counting, false);
+    if (devices_initialized) {
+        while (device_registry_count(&ctx.devices) > 0) {
+            struct device *dev = device_registry_at(&ctx.devices, 0);
+            event_loop_remove(&ctx.loop, &dev->src);
+            evdev_destroy(&device_registry_info(&ctx.devices, dev)->evdev);
+            device_registry_remove(&ctx.devices, dev);
+        }
+        device_registry_destroy(&ctx.devices);
+    }
+    arena_destroy(&ctx.arena);
+    evdev_monitor_destroy(&ctx.mon);
+    event_loop_destroy(&ctx.loop);
+    evdev_source_set(NULL);
+    if (root_dir[0] != '\0') {
+        char cmd[u_FILEPATH_MAX + 16];
+        (void) snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root_dir);
+        (void) !system(cmd);
+    }
+
+    s_log_info("Test result is %s", ret == EXIT_SUCCESS ? "OK" : "FAIL");
+    return ret;
+}
+
+/* Connects `N_CONTROLLERS` FIFOs, sends some events through each of them,
+ * dumps the statistics and then disconnects them all again */
+static i32 run_cycle(struct test_ctx *ctx, u32 cycle)
+{
+    char path[u_FILEPATH_MAX];
+    char tmp_path[u_FILEPATH_MAX];
+    char name[16];
+    i32 writer_fds[N_CONTROLLERS];
+    struct device *devs[N_CONTROLLERS] = { 0 };
+    for (u32 i = 0; i < N_CONTROLLERS; i++)
+        writer_fds[i] = -1;
+
+    for (u32 i = 0; i < N_CONTROLLERS; i++) {
+        /* Different names (and so device numbers) every time */
+        (void) snprintf(name, sizeof(name), "event%u",
+            (cycle * N_CONTROLLERS + i) % 200);
+        (void) snprintf(tmp_path, u_FILEPATH_MAX, "%s/tmp", ctx->root_dir);
+        (void) snprintf(path, u_FILEPATH_MAX, "%s/%s", ctx->root_dir, name);
+        if (mkfifo(tmp_path, 0600) || rename(tmp_path, path))
+            goto_error("Failed to create %s: %s", path, strerror(errno));
+
+        devs[i] = connect_controller(ctx, name);
+        if (devs[i] == NULL)
+            goto err;
+
+        writer_fds[i] = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+        if (writer_fds[i] == -1)
+            goto_error("Failed to open %s: %s", path, strerror(errno));
+    }
+
+    for (u32 i = 0; i < N_CONTROLLERS; i++) {
+        struct input_event events[N_EVENTS_PER_CYCLE] = { 0 };
+        for (u32 j = 0; j < N_EVENTS_PER_CYCLE; j += 2) {
+            events[j] = (struct input_event) {
+                .type = EV_KEY, .code = BTN_SOUTH, .value = 1
+            };
+            events[j + 1] = (struct input_event) {
+                .type = EV_SYN, .code = SYN_REPORT
+            };
+        }
+        if (write(writer_fds[i], events, sizeof(events)) != sizeof(events))
+            goto_error("Failed to write the events: %s", strerror(errno));
+
+        if (wait_for_source(ctx, &devs[i]->src, EPOLLIN))
+            goto err;
+        struct input_event buf[N_EVENTS_PER_CYCLE];
+        if (read(devs[i]->src.fd, buf, sizeof(buf)) != sizeof(buf))
+            goto_error("Failed to read the events: %s", strerror(errno));
+
+        struct stats_device *stats =
+            &device_registry_info(&ctx->devices, devs[i])->stats;
+        stats_add(&stats->reads, 1);
+        stats_add(&stats->events_read, N_EVENTS_PER_CYCLE);
+        histogram_record(&stats->kernel_to_read_ns, 1000 + cycle);
+    }
+
+    if (dump_stats(ctx))
+        goto err;
+
+    /* Disconnect them in a different order than they were connected.
+     * Emulated devices never hang up, so (like the daemon does for
+     * devices that don't) they're removed once their files are deleted. */
+    for (i32 i = N_CONTROLLERS - 1; i >= 0; i--) {
+        close(writer_fds[i]);
+        writer_fds[i] = -1;
+        (void) snprintf(path, u_FILEPATH_MAX, "%s/event%u", ctx->root_dir,
+            (cycle * N_CONTROLLERS + i) % 200);
+        if (unlink(path))
+            goto_error("Failed to delete %s: %s", path, strerror(errno));
+    }
+    for (u32 n_removed = 0; n_removed < N_CONTROLLERS; ) {
+        if (wait_for_source(ctx, &ctx->mon_src, EPOLLIN))
+            goto err;
+
+        struct evdev_monitor_event ev;
+        i32 r = 0;
+        while (r = evdev_monitor_next(&ctx->mon, &ev), r == 1) {
+            struct device *dev = device_registry_find(&ctx->devices,
+                evdev_source_get_devnum(ev.name, -1));
+            if (ev.action != EVDEV_MONITOR_DELETED || dev == NULL)
+                continue;
+
+            event_loop_remove(&ctx->loop, &dev->src);
+            evdev_destroy(&device_registry_info(&ctx->devices, dev)->evdev);
+            device_registry_remove(&ctx->devices, dev);
+            n_removed++;
+        }
+        if (r < 0)
+            goto_error("Failed to read from the monitor");
+    }
+    device_registry_collect(&ctx->devices);
+    if (device_registry_count(&ctx->devices) != 0)
+        goto_error("%u device(s) weren't removed",
+            device_registry_count(&ctx->devices));
+
+    return 0;
+
+err:
+    for (u32 i = 0; i < N_CONTROLLERS; i++) {
+        if (writer_fds[i] != -1)
+            close(writer_fds[i]);
+    }
+    return 1;
+}
+
+/* Waits for the creation of `name` to be reported,
+ * and then loads and registers it */
+static struct device * connect_controller(struct test_ctx *ctx,
+    const char *name)
+{
+    struct evdev_monitor_event ev = { 0 };
+    while (ev.action != EVDEV_MONITOR_CREATED || strcmp(ev.name, name)) {
+        const i32 r = evdev_monitor_next(&ctx->mon, &ev);
+        if (r < 0) {
+            goto_error("Failed to read from the monitor");
+        } else if (r == 0) {
+            memset(&ev, 0, sizeof(ev));
+            if (wait_for_source(ctx, &ctx->mon_src, EPOLLIN))
+                goto err;
+        }
+    }
+
+    struct evdev evdev;
+    if (evdev_load(name, &evdev, EVDEV_MASK_PS4_CONTROLLER))
+        goto_error("Failed to load %s", name);
+
+    struct device *dev = device_registry_add(&ctx->devices,
+        evdev_source_get_devnum(name, evdev.fd));
+    if (dev == NULL) {
+        evdev_destroy(&evdev);
+        goto_error("Failed to register %s", name);
+    }
+    device_registry_info(&ctx->devices, dev)->evdev = evdev;
+
+    dev->src = (struct event_loop_source) {
+        .fd = evdev.fd,
+        .type = EVENT_LOOP_SOURCE_DEVICE,
+        .data = dev,
+    };
+    if (event_loop_add(&ctx->loop, &dev->src, EPOLLIN))
+        goto_error("Failed to add %s to the event loop", name);
+
+    return dev;
+
+err:
+    return NULL;
+}
+
+/* Waits until `src` reports any of `events` */
+static i32 wait_for_source(struct test_ctx *ctx,
+    const struct event_loop_source *src, u32 events)
+{
+    while (true) {
+        const i32 n_ready = event_loop_wait(&ctx->loop, WAIT_TIMEOUT_MS);
+        if (n_ready < 0)
+            goto_error("Failed to wait for the events");
+        else if (n_ready == 0)
+            goto_error("Timed out waiting for fd %i", src->fd);
+
+        for (i32 i = 0; i < n_ready; i++) {
+            const struct event_loop_ready *r = event_loop_get_ready(&ctx->loop, i);
+            if (r->src == src && (r->events & events))
+                return 0;
+        }
+    }
+
+err:
+    return 1;
+}
+
+static i32 dump_stats(struct test_ctx *ctx)
+{
+    const u64 mark = arena_mark(&ctx->arena);
+    const char *text = arena_printf(&ctx->arena, "%s", "");
+    if (text == NULL || stats_write_global(&ctx->arena))
+        goto_error("The global statistics don't fit in the arena");
+
+    for (u32 i = 0; i < device_registry_count(&ctx->devices); i++) {
+        const struct device *dev = device_registry_at(&ctx->devices, i);
+        const struct device_info *info = device_registry_info(&ctx->devices, dev);
+        if (stats_write_device(&ctx->arena, dev->slot, info->evdev.path,
+                info->evdev.name, &info->stats))
+            goto_error("The statistics of %s don't fit in the arena",
+                info->evdev.path);
+    }
+    if (strstr(text, "device0.events_read") == NULL)
+        goto_error("The statistics of the controllers are missing");
+
+    arena_rewind(&ctx->arena, mark);
+    return 0;
+
+err:
+    arena_rewind(&ctx->arena, mark);
+    return 1;
+}
+
+static void count_alloc(void)
+{
+    if (atomic_load_explicit(&g_counting, memory_order_relaxed))
+        atomic_fetch_add(&g_n_allocs, 1);
+}
+
+static void count_free(void)
+{
+    if (atomic_load_explicit(&g_counting, memory_order_relaxed))
+        atomic_fetch_add(&g_n_frees, 1);
+}
+
+#ifdef __SANITIZE_ADDRESS__
+/* The tests are built with ASan, which intercepts malloc() and friends
+ * itself, but can report them to a hook
+ * (declared in <sanitizer/allocator_interface.h>, which isn't always
+ * installed) */
+extern int __sanitizer_install_malloc_and_free_hooks(
+    void (*malloc_hook)(const volatile void *ptr, size_t size),
+    void (*free_hook)(const volatile void *ptr));
+
+static void malloc_hook(const volatile void *ptr, size_t size)
+{
+    (void) ptr;
+    (void) size;
+    count_alloc();
+}
+
+static void free_hook(const volatile void *ptr)
+{
+    (void) ptr;
+    count_free();
+}
+
+static i32 install_alloc_hooks(void)
+{
+    return !__sanitizer_install_malloc_and_free_hooks(malloc_hook, free_hook);
+}
+#else
+/* Without ASan, the glibc allocator is wrapped directly */
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void * malloc(size_t size)
+{
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+    count_alloc();
+    return __libc_calloc(n, size);
+}
+
+void * realloc(void *ptr, size_t size)
+{
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL)
+        count_free();
+    __libc_free(ptr);
+}
+
+static i32 install_alloc_hooks(void)
+{
+    return 0;
+}
+#endif /* __SANITIZE_ADDRESS__ */
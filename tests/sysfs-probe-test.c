@@ -0,0 +1,221 @@
+#define _GNU_SOURCE
+#include "evdev.h"
+#include "evdev-source.h"
+#include <core/int.h>
+#include <core/log.h>
+#include <core/util.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#define MODULE_NAME "sysfs-probe-test"
+
+#define CAP_N_WORDS (KEY_CNT / 64)
+
+struct fake_device {
+    const char *rel_path;
+    const char *name;
+    i32 ev_types[8];
+    i32 keys[64];
+    i32 rels[8];
+    i32 abs[16];
+};
+
+#define END_ (-1)
+static const struct fake_device fake_devices[] = {
+    {
+        "event0", "AT Translated Set 2 keyboard",
+        { EV_SYN, EV_KEY, EV_MSC, EV_LED, EV_REP, END_ },
+        {
+            KEY_ESC, KEY_1, KEY_2, KEY_3, KEY_4, KEY_5, KEY_6, KEY_7, KEY_8,
+            KEY_9, KEY_0, KEY_BACKSPACE, KEY_TAB, KEY_Q, KEY_W, KEY_E, KEY_R,
+            KEY_T, KEY_Y, KEY_U, KEY_O, KEY_P, KEY_ENTER, KEY_A, KEY_S,
+            KEY_D, KEY_F, KEY_G, KEY_H, KEY_J, KEY_L, KEY_Z, KEY_X, KEY_C,
+            KEY_V, KEY_B, KEY_N, KEY_M, KEY_SPACE, KEY_UP, KEY_DOWN,
+            KEY_LEFT, KEY_RIGHT, KEY_F21, END_
+        },
+        { END_ }, { END_ },
+    },
+    {
+        "event1", "Logitech USB Optical Mouse",
+        { EV_SYN, EV_KEY, EV_REL, EV_MSC, END_ },
+        { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, END_ },
+        { REL_X, REL_Y, REL_WHEEL, END_ },
+        { END_ },
+    },
+    {
+        "event2", "Wireless Controller",
+        { EV_SYN, EV_KEY, EV_ABS, EV_MSC, EV_FF, END_ },
+        {
+            BTN_SOUTH, BTN_EAST, BTN_WEST, BTN_NORTH, BTN_TL, BTN_TR,
+            BTN_TL2, BTN_TR2, BTN_THUMBL, BTN_THUMBR,
+            BTN_SELECT, BTN_START, BTN_MODE, END_
+        },
+        { END_ },
+        {
+            ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ,
+            ABS_HAT0X, ABS_HAT0Y, END_
+        },
+    },
+};
+
+static i32 write_file(const char *dir, const char *name, const char *content);
+static i32 write_caps(const char *dir, const char *name, const i32 *codes);
+static i32 create_fake_sysfs(const char *sysfs_dir,
+    const struct fake_device *dev);
+
+int main(void)
+{
+    s_configure_log(LOG_DEBUG, stdout, stderr);
+
+    i32 ret = EXIT_FAILURE;
+    char root_dir[] = "/tmp/sysfs-probe-test.XXXXXX";
+    char dev_dir[u_FILEPATH_MAX] = { 0 };
+    char sysfs_dir[u_FILEPATH_MAX] = { 0 };
+    char path[u_FILEPATH_MAX] = { 0 };
+    struct evdev dev = { 0 };
+
+    if (mkdtemp(root_dir) == NULL)
+        goto_error("Failed to create a temporary directory: %s",
+            strerror(errno));
+    (void) snprintf(dev_dir, u_FILEPATH_MAX, "%s/dev", root_dir);
+    (void) snprintf(sysfs_dir, u_FILEPATH_MAX, "%s/sys", root_dir);
+    if (mkdir(dev_dir, 0755) || mkdir(sysfs_dir, 0755))
+        goto_error("Failed to create the directories: %s", strerror(errno));
+
+    for (u32 i = 0; i < u_arr_size(fake_devices); i++) {
+        if (create_fake_sysfs(sysfs_dir, &fake_devices[i]))
+            goto err;
+    }
+
+    /* Only the controller can actually be opened, so loading the others
+     * fails loudly as soon as anything tries to open them */
+    (void) snprintf(path, u_FILEPATH_MAX, "%s/event0", dev_dir);
+    if (symlink("nonexistent", path))
+        goto_error("Failed to create %s: %s", path, strerror(errno));
+    (void) snprintf(path, u_FILEPATH_MAX, "%s/event1", dev_dir);
+    if (symlink("nonexistent", path))
+        goto_error("Failed to create %s: %s", path, strerror(errno));
+    if (write_file(dev_dir, "event2", ""))
+        goto err;
+
+    struct evdev_source source = {
+        .type = EVDEV_SOURCE_KERNEL,
+        .emulated_type = EVDEV_TYPE_PS4_CONTROLLER,
+    };
+    strncpy(source.root_dir, dev_dir, u_FILEPATH_MAX);
+    strncpy(source.sysfs_dir, sysfs_dir, u_FILEPATH_MAX);
+    evdev_source_set(&source);
+
+    if (evdev_load("event0", &dev, EVDEV_MASK_PS4_CONTROLLER) != 1)
+        goto_error("The keyboard wasn't rejected without being opened");
+    if (evdev_load("event1", &dev, EVDEV_MASK_PS4_CONTROLLER) != 1)
+        goto_error("The mouse wasn't rejected without being opened");
+    if (evdev_load("event2", &dev, EVDEV_MASK_MOUSE) != 1)
+        goto_error("The controller was probed as a mouse");
+
+    /* A match is opened (which fails here) */
+    if (evdev_load("event0", &dev, EVDEV_MASK_KEYBOARD) != -1)
+        goto_error("The keyboard wasn't probed as a keyboard");
+
+    if (evdev_load("event2", &dev,
+            EVDEV_MASK_KEYBOARD | EVDEV_MASK_PS4_CONTROLLER))
+        goto_error("Failed to load the controller");
+    if (dev.type != EVDEV_TYPE_PS4_CONTROLLER)
+        goto_error("The controller was probed as type %i", dev.type);
+    if (strcmp(dev.name, "Wireless Controller"))
+        goto_error("The controller's name is \"%s\"", dev.name);
+    if (dev.fd == -1)
+        goto_error("The controller wasn't opened");
+    evdev_destroy(&dev);
+
+    ret = EXIT_SUCCESS;
+err:
+    evdev_destroy(&dev);
+    evdev_source_set(NULL);
+    if (root_dir[0] != '\0') {
+        char cmd[u_FILEPATH_MAX + 16];
+        (void) snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root_dir);
+        (void) !system(cmd);
+    }
+
+    s_log_info("Test result is %s", ret == EXIT_SUCCESS ? "OK" : "FAIL");
+    return ret;
+}
+
+static i32 write_file(const char *dir, const char *name, const char *content)
+{
+    char path[u_FILEPATH_MAX];
+    (void) snprintf(path, u_FILEPATH_MAX, "%s/%s", dir, name);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) {
+        s_log_error("Failed to create %s: %s", path, strerror(errno));
+        return 1;
+    }
+    fputs(content, fp);
+    if (fclose(fp)) {
+        s_log_error("Failed to write %s: %s", path, strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Writes `codes` as a bitmap, the way the kernel does it */
+static i32 write_caps(const char *dir, const char *name, const i32 *codes)
+{
+    u64 words[CAP_N_WORDS] = { 0 };
+    for (u32 i = 0; codes[i] != END_; i++)
+        words[codes[i] / 64] |= 1ULL << (codes[i] % 64);
+
+    i32 top = CAP_N_WORDS - 1;
+    while (top > 0 && words[top] == 0)
+        top--;
+
+    char buf[CAP_N_WORDS * 17 + 2] = { 0 };
+    u32 len = 0;
+    for (i32 i = top; i >= 0; i--) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%lx%s",
+            (unsigned long)words[i], i > 0 ? " " : "\n");
+    }
+
+    return write_file(dir, name, buf);
+}
+
+static i32 create_fake_sysfs(const char *sysfs_dir,
+    const struct fake_device *dev)
+{
+    char dir[u_FILEPATH_MAX];
+    (void) snprintf(dir, u_FILEPATH_MAX, "%s/%s", sysfs_dir, dev->rel_path);
+    if (mkdir(dir, 0755))
+        goto_error("Failed to create %s: %s", dir, strerror(errno));
+    strncat(dir, "/device", u_FILEPATH_MAX - strlen(dir) - 1);
+    if (mkdir(dir, 0755))
+        goto_error("Failed to create %s: %s", dir, strerror(errno));
+
+    char name[MAX_EVDEV_NAME_LEN + 1];
+    (void) snprintf(name, sizeof(name), "%s\n", dev->name);
+    if (write_file(dir, "name", name))
+        return 1;
+
+    strncat(dir, "/capabilities", u_FILEPATH_MAX - strlen(dir) - 1);
+    if (mkdir(dir, 0755))
+        goto_error("Failed to create %s: %s", dir, strerror(errno));
+    if (write_caps(dir, "ev", dev->ev_types) ||
+        write_caps(dir, "key", dev->keys) ||
+        write_caps(dir, "rel", dev->rels) ||
+        write_caps(dir, "abs", dev->abs))
+    {
+        return 1;
+    }
+
+    return 0;
+err:
+    return 1;
+}
@@ -36,6 +36,22 @@ void p_time_get_ticks(timestamp_t *o)
     o->ns = ts.tv_nsec;
 }
 
+u64 p_time_get_ticks_ms(void)
+{
+    timestamp_t t = { 0 };
+    p_time_get_ticks(&t);
+
+    return (t.s * 1000) + (t.ns / 1000000);
+}
+
+u64 p_time_get_ticks_ns(void)
+{
+    timestamp_t t = { 0 };
+    p_time_get_ticks(&t);
+
+    return (t.s * 1000000000) + t.ns;
+}
+
 i64 p_time_delta_us(const timestamp_t *t0)
 {
     if (t0 == NULL) return 0;